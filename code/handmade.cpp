@@ -1,9 +1,31 @@
 /* Cross platform code */
 #include "handmade.h"
+#include "handmade_render_group.h"
+#include "handmade_asset.h"
+#include "handmade_audio.h"
 
 
 
 #include <cstring>
+#include <immintrin.h> // SSE2 and AVX2 intrinsics
+
+internal void
+simulateTick(game_simulation* simulation, game_input_state* inputState, real32 seconds)
+{
+	game_controller_state& input0 = inputState->keyboard;
+	if (input0.isAnalog)
+	{
+		// 4 pixels a frame at 30 Hz like before
+		real32 pixelsPerSecond = 120.0f;
+		simulation->x += pixelsPerSecond * input0.xAxis.average * seconds;
+		simulation->y += pixelsPerSecond * input0.yAxis.average * seconds;
+	}
+	else
+	{
+		// Digital input
+
+	}
+}
 
 GAME_UPDATE_AND_RENDER(gameUpdateAndRender)
 {
@@ -11,30 +33,134 @@ GAME_UPDATE_AND_RENDER(gameUpdateAndRender)
 	// Check controller validity
 	hm_assert( &inputState->controllers[0].terminator - &inputState->controllers[0].buttons[0] == ArrayCount(inputState->controllers[0].buttons))
 
-	int32& xOffset = gameState->xOffset;
-	int32& yOffset = gameState->yOffset;
+	// Fixed ticks, the same input for every tick of this frame
+	gameState->secondsToSimulate += inputState->secondsElapsed;
+	uint32 tickCount = 0;
+	while (gameState->secondsToSimulate >= SIMULATION_TICK_SECONDS)
+	{
+		if (tickCount == MAX_SIMULATION_TICKS_PER_FRAME)
+		{
+			uint32 droppedTicks = (uint32)(gameState->secondsToSimulate / SIMULATION_TICK_SECONDS);
+			gameState->droppedTickCount += droppedTicks;
+			gameState->secondsToSimulate -= (real32)droppedTicks * SIMULATION_TICK_SECONDS;
+			break;
+		}
+		gameState->previousSimulation = gameState->simulation;
+		simulateTick(&gameState->simulation, inputState, SIMULATION_TICK_SECONDS);
+		gameState->secondsToSimulate -= SIMULATION_TICK_SECONDS;
+		tickCount++;
+	}
+	gameState->simulationTickCount += tickCount;
 
-	game_controller_state& input0 = inputState->keyboard;
-	if (input0.isAnalog)
+	// How far this frame is from the last tick towards the next one
+	real32 t = gameState->secondsToSimulate / SIMULATION_TICK_SECONDS;
+	if (t > 1.0f)
 	{
-		// TODO(Tia) analog input movement
-		xOffset += (int)4.0f*(input0.xAxis.average);
-		yOffset += (int)4.0f*(input0.yAxis.average);
+		t = 1.0f;
+	}
+	game_simulation* previous = &gameState->previousSimulation;
+	game_simulation* current = &gameState->simulation;
+	real32 drawX = previous->x + t * (current->x - previous->x);
+	real32 drawY = previous->y + t * (current->y - previous->y);
 
+	if (gameState->arena.base == NULL)
+	{
+		// Permanent storage is all zeros at startup
+		initializeArena(&gameState->arena, gameState + 1, 
+			memory->permanentStorageSize - sizeof(game_state));
 	}
-	else
+
+	hm_assert(sizeof(transient_state) <= memory->transientStorageSize);
+	transient_state* tranState = (transient_state*)memory->transientStoragePointer;
+	if (!tranState->isInitialized)
 	{
-		// Digital input
+		memory_arena* arena = &tranState->arena;
+		initializeArena(arena, tranState + 1, memory->transientStorageSize - sizeof(transient_state));
+
+		tranState->renderGroup = allocateRenderGroup(pushSize(arena, RENDER_GROUP_MEMORY_SIZE), RENDER_GROUP_MEMORY_SIZE);
+
+		// Assets point straight into the archive the platform mapped
+		tranState->assets = pushStruct(arena, game_assets);
+		initializeAssets(tranState->assets, memory->assetArchiveMemory, memory->assetArchiveSize);
+
+		tranState->assetStream = pushStruct(arena, asset_stream);
+		initializeAssetStream(tranState->assetStream, arena, ASSET_STREAM_MEMORY_SIZE);
 
+		tranState->audio = pushStruct(arena, audio_state);
+		initializeAudioState(tranState->audio);
+		tranState->music = NULL;
+
+		// Music is read from its own file while it plays, next to the archive
+		tranState->musicStream = pushStruct(arena, sound_stream);
+		initializeSoundStream(tranState->musicStream, pushSize(arena, SOUND_STREAM_MEMORY_SIZE), "music.wav", true);
+		tranState->isInitialized = true;
+	}
+
+	// Music fades in when the first part of it is there
+	sound_stream* musicStream = tranState->musicStream;
+	updateSoundStream(memory, tranState->audio, musicStream);
+	if (tranState->music == NULL && musicStream->sound)
+	{
+		tranState->music = musicStream->sound;
+		changeVolume(tranState->music, 0.0f, 0.0f, 0.0f);
+		changeVolume(tranState->music, 2.0f, 0.5f, 0.0f);
 	}
 
-	//renderWeirdGradient(pixelBuffer, xOffset, yOffset);
-	renderBlackScreen(pixelBuffer);
+	// Without the file, the whole track is loaded from the archive
+	if (tranState->music == NULL && musicStream->state == SoundStream_Failed)
+	{
+		asset_stream_slot* musicSlot = requestAsset(memory, tranState->assets, tranState->assetStream,
+			AssetType_Sound, "music", 0);
+		loaded_sound music;
+		if (musicSlot && getStreamedSound(musicSlot, &music))
+		{
+			tranState->music = playSound(tranState->audio, &music, true);
+			if (tranState->music)
+			{
+				changeVolume(tranState->music, 0.0f, 0.0f, 0.0f);
+				changeVolume(tranState->music, 2.0f, 0.5f, 0.0f);
+			}
+		}
+	}
+
+	render_group* renderGroup = tranState->renderGroup;
+	clearRenderGroup(renderGroup);
+
+	pushClear(renderGroup, 0xFF000000);
+	//pushWeirdGradient(renderGroup, (int32)drawX, (int32)drawY);
+
+	// Marker that the stick moves
+	int32 markerX = pixelBuffer->bitmapWidth / 2 + (int32)roundf(drawX);
+	int32 markerY = pixelBuffer->bitmapHeight / 2 - (int32)roundf(drawY);
+	pushRectangle(renderGroup, markerX - 8, markerY - 8, markerX + 8, markerY + 8, 0xFFFFFFFF);
+
+	renderGroupToOutput(memory, renderGroup, pixelBuffer);
+	checkArena(&tranState->arena);
 }
 
 GAME_GET_SOUND_SAMPLES(gameGetSoundSamples)
 {
-	gameOutputSound(buffer);
+	transient_state* tranState = (transient_state*)memory->transientStoragePointer;
+	if (tranState->isInitialized)
+	{
+		audio_state* audio = tranState->audio;
+		if (audio->tones.voiceCount == 0 && buffer->samplesPerWavePeriod > 0)
+		{
+			// Debug tone at the pitch the platform asks for, mixed under the sounds
+			addOscillatorVoice(&audio->tones, 
+				(real32)buffer->samplesPerSecond / (real32)buffer->samplesPerWavePeriod,
+				(real32)buffer->samplesPerSecond, 3000.0f);
+		}
+		// Mix memory is only needed while mixing
+		temporary_memory mixMemory = beginTemporaryMemory(&tranState->arena);
+		outputPlayingSounds(audio, buffer, pushSize(&tranState->arena, AUDIO_MIX_MEMORY_SIZE), AUDIO_MIX_MEMORY_SIZE);
+		endTemporaryMemory(mixMemory);
+	}
+	else
+	{
+		// Called before the first update
+		gameOutputSound(buffer);
+	}
 }
 
 
@@ -49,66 +175,373 @@ void gameOutputSound(game_sound_buffer* buffer)
 
 void writeSineWave(game_sound_buffer* buffer)
 {
-	
-	void *samples = buffer->samples;
-	uint32 samplesToWrite = buffer->samplesToWrite;
-	
-	uint32 sampleCount = samplesToWrite;
-	int16 toneVolume = 3000;
-	
-	int16* sampleOut = (int16*)samples;
-	real32 sampleValue = 0.0f;
-	int32 runningSampleIndex = buffer->runningSampleIndex;
-	
-	real32 sineWavePeriod = 2.0f * PI32;
-	
-	for (uint32 sampleIndex = 0;
-			sampleIndex < sampleCount;
-			sampleIndex++)
-			{
-				// t should be between [0, 2PI]
-				// clamp runningSampleIndex between 0 and samplesPerWavePeriod
-				// int clampedRunningSampleIndex = runningSampleIndex % audioConfig.samplesPerWavePeriod;
-				// clamp t between [0.0f, 1.0f]
-				
-				//real32 t = (real32)runningSampleIndex / (real32)audioConfig.samplesPerWavePeriod;
-				// sin works with multiples of 2PI, the number does not matter otherwise.
-				// t *= 2.0f * PI32;
-				// sinf() returns[ -1.0f, 1.0f]
-				real32 sineValue = sinf(buffer->tForSine);
-				
-				sampleValue = (int16)(sineValue * toneVolume);
-				*sampleOut = sampleValue;
-				sampleOut++;
-				*sampleOut = sampleValue;
-				sampleOut++;
-				
-				runningSampleIndex++;
-				// Advance t for sine by one sample
-				buffer->tForSine += (sineWavePeriod) / (real32)(buffer->samplesPerWavePeriod);
-				
-				if (buffer->tForSine > sineWavePeriod)
-				{
-						buffer->tForSine -= sineWavePeriod;
-				}
-			}
-		
-	buffer->runningSampleIndex = runningSampleIndex;
+	// One voice of the oscillator bank, continues from tForSine
+	oscillator_bank bank;
+	bank.voiceCount = 1;
+	oscillator_voice& voice = bank.voices[0];
+	voice.phase = buffer->tForSine;
+	voice.phaseStep = (2.0f * PI32) / (real32)buffer->samplesPerWavePeriod;
+	voice.volume = 3000.0f;
+
+	// Mixed in chunks so that the mix fits on the stack
+	real32 mix[512];
+	int16* sampleOut = (int16*)buffer->samples;
+	uint32 samplesLeft = buffer->samplesToWrite;
+	while (samplesLeft > 0)
+	{
+		uint32 chunkSamples = (samplesLeft < ArrayCount(mix)) ? samplesLeft : ArrayCount(mix);
+		renderOscillatorBank(&bank, mix, chunkSamples);
+		writeMixToStereo(mix, sampleOut, chunkSamples);
 
+		sampleOut += 2 * chunkSamples;
+		samplesLeft -= chunkSamples;
+	}
+
+	buffer->tForSine = voice.phase;
+	buffer->runningSampleIndex += buffer->samplesToWrite;
 }
 
-void renderBlackScreen(game_pixel_buffer* pixelBuffer)
+// TILED RENDERING
+
+struct tile_render_work
 {
-	void *texturePixels = pixelBuffer->texturePixels;
-	int32 texturePitch = pixelBuffer->texturePitch;
+	game_pixel_buffer tile;
+	int32 tileMinY;
+	render_tile *renderTile;
+	void *context;
+};
+
+internal
+PLATFORM_WORK_QUEUE_CALLBACK(doTileRenderWork)
+{
+	tile_render_work *work = (tile_render_work*)data;
+	work->renderTile(&work->tile, work->tileMinY, work->context);
+}
+
+internal int32
+greatestCommonDivisor(int32 a, int32 b)
+{
+	while (b != 0)
+	{
+		int32 remainder = a % b;
+		a = b;
+		b = remainder;
+	}
+	return a;
+}
+
+void renderTiled(game_memory* memory, game_pixel_buffer* pixelBuffer, render_tile *renderTile, void *context)
+{
+	int32 pitch = pixelBuffer->texturePitch;
 	int32 height = pixelBuffer->bitmapHeight;
-	
+	if (pixelBuffer->texturePixels == NULL || pitch <= 0 || height <= 0)
+	{
+		return;
+	}
+
+	if (memory == NULL || memory->renderQueue == NULL)
+	{
+		renderTile(pixelBuffer, 0, context);
+		return;
+	}
+
+	// Tile height must be a multiple of this so that every
+	// tile starts at the beginning of a cache line.
+	int32 rowsPerCacheLine = CACHE_LINE_BYTES / greatestCommonDivisor(pitch, CACHE_LINE_BYTES);
+
+	int32 tileRows = RENDER_TILE_TARGET_BYTES / pitch;
+
+	// Make sure every thread gets some work, and that the work fits in 
+	// the work array
+	int32 maxRowsForThreads = height / memory->renderThreadCount;
+	if (tileRows > maxRowsForThreads)
+	{
+		tileRows = maxRowsForThreads;
+	}
+	int32 minRowsForArray = (height + MAX_RENDER_TILES - 1) / MAX_RENDER_TILES;
+	if (tileRows < minRowsForArray)
+	{
+		tileRows = minRowsForArray;
+	}
+	tileRows = ((tileRows + rowsPerCacheLine - 1) / rowsPerCacheLine) * rowsPerCacheLine;
+
+	tile_render_work works[MAX_RENDER_TILES];
+	int32 workCount = 0;
+	for (int32 minY = 0;
+		minY < height;
+		minY += tileRows)
+	{
+		int32 maxY = minY + tileRows;
+		if (maxY > height)
+		{
+			maxY = height;
+		}
+		hm_assert(workCount < MAX_RENDER_TILES);
+
+		tile_render_work& work = works[workCount++];
+		work.tile = *pixelBuffer;
+		work.tile.texturePixels = (uint8*)pixelBuffer->texturePixels + minY * pitch;
+		work.tile.bitmapHeight = maxY - minY;
+		work.tileMinY = minY;
+		work.renderTile = renderTile;
+		work.context = context;
+
+		memory->addWorkEntry(memory->renderQueue, doTileRenderWork, &work);
+	}
+
+	memory->completeAllWork(memory->renderQueue);
+}
+
+RENDER_TILE(renderBlackScreenTile)
+{
+	renderBlackScreen(tile);
+}
+
+RENDER_TILE(renderWeirdGradientTile)
+{
+	weird_gradient_offsets *offsets = (weird_gradient_offsets*)context;
+	// Gradient depends on y, so continue from where this tile is
+	renderWeirdGradient(tile, offsets->xOffset, offsets->yOffset + tileMinY);
+}
+
+void renderBlackScreen(game_pixel_buffer* pixelBuffer)
+{
+	// NOTE: memset only uses the lowest byte of the value, so it
+	// would write 0x00000000 and lose the alpha.
 	uint32 black = 0xFF000000;
-	memset(texturePixels, black, texturePitch * height);
+	fillBuffer(pixelBuffer, black);
+}
+
+// FILL
+
+FILL_ROW(fillRowScalar)
+{
+	for (int32 x = 0;
+		x < count;
+		x++)
+	{
+		*pixel++ = color;
+	}
+}
+
+FILL_ROW(fillRowStreamSSE2)
+{
+	// Stream stores need 16 byte alignment, do the start one by one
+	int32 x = 0;
+	while (x < count && ((uintptr_t)pixel & 15) != 0)
+	{
+		*pixel++ = color;
+		x++;
+	}
+
+	__m128i colorLanes = _mm_set1_epi32(color);
+	for (;
+		x + 4 <= count;
+		x += 4)
+	{
+		_mm_stream_si128((__m128i*)pixel, colorLanes);
+		pixel += 4;
+	}
+
+	fillRowScalar(pixel, count - x, color);
+}
+
+__attribute__((target("avx2")))
+FILL_ROW(fillRowStreamAVX2)
+{
+	// 32 byte alignment, one full cache line every two stores
+	int32 x = 0;
+	while (x < count && ((uintptr_t)pixel & 31) != 0)
+	{
+		*pixel++ = color;
+		x++;
+	}
+
+	__m256i colorLanes = _mm256_set1_epi32(color);
+	for (;
+		x + 8 <= count;
+		x += 8)
+	{
+		_mm256_stream_si256((__m256i*)pixel, colorLanes);
+		pixel += 8;
+	}
+
+	fillRowScalar(pixel, count - x, color);
+}
+
+global_variable fill_row *fillRowKernel;
+
+fill_row* getFillRowKernel()
+{
+	if (fillRowKernel == NULL)
+	{
+		fillRowKernel = fillRowStreamSSE2;
+		if (__builtin_cpu_supports("avx2"))
+		{
+			fillRowKernel = fillRowStreamAVX2;
+		}
+	}
+	return fillRowKernel;
+}
+
+internal inline int32
+clampFillCoordinate(int32 value, int32 max)
+{
+	int32 result = value;
+	if (result < 0)
+	{
+		result = 0;
+	}
+	else if (result > max)
+	{
+		result = max;
+	}
+	return result;
+}
+
+void fillRectangleWith(fill_row* rowKernel, game_pixel_buffer* pixelBuffer,
+	int32 minX, int32 minY, int32 maxX, int32 maxY, uint32 color)
+{
+	if (pixelBuffer->texturePixels == NULL)
+	{
+		return;
+	}
+	minX = clampFillCoordinate(minX, pixelBuffer->bitmapWidth);
+	maxX = clampFillCoordinate(maxX, pixelBuffer->bitmapWidth);
+	minY = clampFillCoordinate(minY, pixelBuffer->bitmapHeight);
+	maxY = clampFillCoordinate(maxY, pixelBuffer->bitmapHeight);
+	if (minX >= maxX || minY >= maxY)
+	{
+		return;
+	}
+
+	int32 width = maxX - minX;
+	int32 pitch = pixelBuffer->texturePitch;
+	uint8* row = (uint8*)pixelBuffer->texturePixels + minY * pitch + minX * 4;
+
+	// Whole rows without gaps can be filled as one long row
+	if (width == pitch / 4)
+	{
+		rowKernel((uint32*)row, width * (maxY - minY), color);
+	}
+	else
+	{
+		for (int32 y = minY;
+			y < maxY;
+			y++)
+		{
+			rowKernel((uint32*)row, width, color);
+			row += pitch;
+		}
+	}
+
+	// Streaming stores are weakly ordered, make them visible 
+	// before the buffer is handed on
+	_mm_sfence();
+}
+
+void fillRectangle(game_pixel_buffer* pixelBuffer, int32 minX, int32 minY, int32 maxX, int32 maxY, uint32 color)
+{
+	fill_row* rowKernel = fillRowScalar;
+	int64 bytes = (int64)(maxX - minX) * (int64)(maxY - minY) * 4;
+	if (bytes >= FILL_STREAM_MIN_BYTES)
+	{
+		rowKernel = getFillRowKernel();
+	}
+	fillRectangleWith(rowKernel, pixelBuffer, minX, minY, maxX, maxY, color);
+}
+
+void fillBuffer(game_pixel_buffer* pixelBuffer, uint32 color)
+{
+	fillRectangle(pixelBuffer, 0, 0, pixelBuffer->bitmapWidth, pixelBuffer->bitmapHeight, color);
 }
 
 
+// Gradient row kernels. Each one writes width pixels starting from pixel,
+// blue is the (unwrapped) blue value of the first pixel and green is
+// already shifted into place. All of them must produce the same bytes.
+
+RENDER_GRADIENT_ROW(renderGradientRowScalar)
+{
+	for (int32 x = 0;
+		x < width;
+		x++)
+	{
+		uint8 blueByte = (uint8)(blue + x);
+		*pixel = (green | blueByte);
+		pixel++;
+	}
+}
+
+RENDER_GRADIENT_ROW(renderGradientRowSSE2)
+{
+	// 4 pixels per iteration, blue wraps by masking with 0xFF
+	__m128i blueLanes = _mm_add_epi32(_mm_set1_epi32(blue), _mm_setr_epi32(0, 1, 2, 3));
+	__m128i four = _mm_set1_epi32(4);
+	__m128i byteMask = _mm_set1_epi32(0xFF);
+	__m128i greenLanes = _mm_set1_epi32(green);
+
+	int32 x = 0;
+	for (;
+		x + 4 <= width;
+		x += 4)
+	{
+		__m128i color = _mm_or_si128(_mm_and_si128(blueLanes, byteMask), greenLanes);
+		_mm_storeu_si128((__m128i*)pixel, color);
+		blueLanes = _mm_add_epi32(blueLanes, four);
+		pixel += 4;
+	}
+
+	renderGradientRowScalar(pixel, width - x, blue + x, green);
+}
+
+__attribute__((target("avx2")))
+RENDER_GRADIENT_ROW(renderGradientRowAVX2)
+{
+	// 8 pixels per iteration
+	__m256i blueLanes = _mm256_add_epi32(_mm256_set1_epi32(blue), 
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256i eight = _mm256_set1_epi32(8);
+	__m256i byteMask = _mm256_set1_epi32(0xFF);
+	__m256i greenLanes = _mm256_set1_epi32(green);
+
+	int32 x = 0;
+	for (;
+		x + 8 <= width;
+		x += 8)
+	{
+		__m256i color = _mm256_or_si256(_mm256_and_si256(blueLanes, byteMask), greenLanes);
+		_mm256_storeu_si256((__m256i*)pixel, color);
+		blueLanes = _mm256_add_epi32(blueLanes, eight);
+		pixel += 8;
+	}
+
+	renderGradientRowScalar(pixel, width - x, blue + x, green);
+}
+
+// Picked once when the library is loaded, see getGradientRowKernel()
+global_variable render_gradient_row *gradientRowKernel;
+
+render_gradient_row* getGradientRowKernel()
+{
+	if (gradientRowKernel == NULL)
+	{
+		// SSE2 is always there on x86-64
+		gradientRowKernel = renderGradientRowSSE2;
+		if (__builtin_cpu_supports("avx2"))
+		{
+			gradientRowKernel = renderGradientRowAVX2;
+		}
+	}
+	return gradientRowKernel;
+}
+
 void renderWeirdGradient(game_pixel_buffer *pixelBuffer, int32 xOffset, int32 yOffset)
+{
+	renderWeirdGradientWith(getGradientRowKernel(), pixelBuffer, xOffset, yOffset);
+}
+
+void renderWeirdGradientWith(render_gradient_row *rowKernel, game_pixel_buffer *pixelBuffer, int32 xOffset, int32 yOffset)
 {
 
 	// Modify the pixels
@@ -129,25 +562,16 @@ void renderWeirdGradient(game_pixel_buffer *pixelBuffer, int32 xOffset, int32 yO
 
 		so writing to second actually writes to GG
 	*/
-	// Write each byte separately
+	// Blue comes from x and green from y, 
 	// uint8 will wrap around automatically
 	uint8 *row = (uint8 *)texturePixels;
 	
-	for(int y = 9;
+	for(int y = 0;
 		y < height;
 		y++)
 	{
-		uint32* pixel = (uint32*)row;
-		for (int x = 0;
-			x < width;
-			x++)
-		{
-			uint8 blue = (x + xOffset);
-			uint8 green = (y + yOffset);
-
-			*pixel = ((green << 8) | blue);
-			pixel++;
-		}
+		uint8 green = (y + yOffset);
+		rowKernel((uint32*)row, width, xOffset, (uint32)green << 8);
 
 		// advance a row of bytes
 		// pitch might not be width * pixels, because of padding
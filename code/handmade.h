@@ -106,6 +106,59 @@ safeTruncateUint64(uint64 value)
 }
 
 
+// Work queue that the platform runs on its worker threads.
+// The game adds entries and then waits for all of them to complete.
+// Entries can run in any order on any thread.
+struct platform_work_queue;
+
+#define PLATFORM_WORK_QUEUE_CALLBACK(name) void name(platform_work_queue *queue, void *data)
+typedef PLATFORM_WORK_QUEUE_CALLBACK(platform_work_queue_callback);
+
+#define PLATFORM_ADD_WORK_ENTRY(name) void name(platform_work_queue *queue, platform_work_queue_callback *callback, void *data)
+typedef PLATFORM_ADD_WORK_ENTRY(platform_add_work_entry);
+
+#define PLATFORM_COMPLETE_ALL_WORK(name) void name(platform_work_queue *queue)
+typedef PLATFORM_COMPLETE_ALL_WORK(platform_complete_all_work);
+
+// Asset loading that does not block the frame.
+// The platform loads the requests on its own I/O thread, highest 
+// priority first. The game owns the request and the destination memory,
+// and must not touch either until the state is Loaded or Failed.
+struct platform_asset_queue;
+
+enum asset_load_state
+{
+	AssetLoad_Unloaded,
+	AssetLoad_Queued,
+	AssetLoad_Loaded,
+	AssetLoad_Failed
+};
+
+struct asset_load_request
+{
+	const char* fileName; // file to read, NULL to copy from the asset archive
+	uint64 sourceOffset;
+	uint64 size;
+	void* destination; // at least size bytes
+	int32 priority; // larger is loaded first
+
+	// Only the platform writes these
+	uint32 sequence; // keeps requests of same priority in order
+	volatile uint32 state; // asset_load_state
+};
+
+// Returns false if the queue is full, then the request stays Unloaded
+#define PLATFORM_QUEUE_ASSET_LOAD(name) bool32 name(platform_asset_queue *queue, asset_load_request *request)
+typedef PLATFORM_QUEUE_ASSET_LOAD(platform_queue_asset_load);
+
+// Acquire pairs with the release store of the I/O thread, the data 
+// is all there when the state says Loaded
+inline uint32
+getAssetLoadState(asset_load_request *request)
+{
+	return __atomic_load_n(&request->state, __ATOMIC_ACQUIRE);
+}
+
 // All of the memory used by the game
 struct game_memory
 {
@@ -122,7 +175,30 @@ struct game_memory
 		permanentStoragePointer = NULL;
 		transientStorageSize = 0;
 		transientStoragePointer = NULL;
+		renderQueue = NULL;
+		addWorkEntry = NULL;
+		completeAllWork = NULL;
+		renderThreadCount = 1;
+		assetArchiveMemory = NULL;
+		assetArchiveSize = 0;
+		assetQueue = NULL;
+		queueAssetLoad = NULL;
 	}
+
+	// When renderQueue is NULL everything is rendered on the calling thread
+	platform_work_queue *renderQueue;
+	platform_add_work_entry *addWorkEntry;
+	platform_complete_all_work *completeAllWork;
+	int32 renderThreadCount; // worker threads + the thread that completes work
+
+	// Packed asset archive mapped read only by the platform, see handmade_asset.h
+	// NULL if there is no archive.
+	void* assetArchiveMemory;
+	uint64 assetArchiveSize;
+
+	// When assetQueue is NULL assets are loaded on the calling thread
+	platform_asset_queue *assetQueue;
+	platform_queue_asset_load *queueAssetLoad;
 	
 	#if HANDMADE_INTERNAL
 	debug_platform_free_file_memory *debug_free_memory;
@@ -132,12 +208,169 @@ struct game_memory
 	
 };
 
+// MEMORY ARENAS
+/*
+	The game gets all of its memory from game_memory and never calls
+	malloc. An arena hands out a block by moving a pointer forward and
+	nothing is freed alone. Temporary memory remembers where the arena
+	was and puts it back in one step, which is how scratch memory for a
+	frame is released. Pushed memory is not cleared.
+*/
+
+static const uint64 DEFAULT_ARENA_ALIGNMENT = 16; // enough for SSE
+
+struct memory_arena
+{
+	uint8* base;
+	uint64 size;
+	uint64 used;
+	uint64 highWater; // most that was used at any time
+	int32 temporaryCount; // open temporary memory scopes
+};
+
+struct temporary_memory
+{
+	memory_arena* arena;
+	uint64 used;
+};
+
+inline void
+initializeArena(memory_arena* arena, void* base, uint64 size)
+{
+	arena->base = (uint8*)base;
+	arena->size = size;
+	arena->used = 0;
+	arena->highWater = 0;
+	arena->temporaryCount = 0;
+}
+
+// Alignment must be a power of two
+inline uint64
+getAlignmentOffset(memory_arena* arena, uint64 alignment)
+{
+	uint64 next = (uint64)(arena->base + arena->used);
+	return ((next + alignment - 1) & ~(alignment - 1)) - next;
+}
+
+inline bool32
+arenaHasRoomFor(memory_arena* arena, uint64 size, uint64 alignment = DEFAULT_ARENA_ALIGNMENT)
+{
+	return arena->used + getAlignmentOffset(arena, alignment) + size <= arena->size;
+}
+
+// NULL if it does not fit, which asserts in slow builds
+inline void*
+pushSize(memory_arena* arena, uint64 size, uint64 alignment = DEFAULT_ARENA_ALIGNMENT)
+{
+	uint64 offset = getAlignmentOffset(arena, alignment);
+	hm_assert(arena->used + offset + size <= arena->size);
+	if (arena->used + offset + size > arena->size)
+	{
+		return NULL;
+	}
+
+	void* result = arena->base + arena->used + offset;
+	arena->used += offset + size;
+	if (arena->used > arena->highWater)
+	{
+		arena->highWater = arena->used;
+	}
+	return result;
+}
+
+#define pushStruct(arena, type) (type*)pushSize(arena, sizeof(type))
+#define pushArray(arena, count, type) (type*)pushSize(arena, (count) * sizeof(type))
+
+// Arena of its own inside another one, e.g. for a system that resets
+// its memory without touching anyone else's
+inline void
+subArena(memory_arena* result, memory_arena* arena, uint64 size, uint64 alignment = DEFAULT_ARENA_ALIGNMENT)
+{
+	initializeArena(result, pushSize(arena, size, alignment), size);
+}
+
+inline temporary_memory
+beginTemporaryMemory(memory_arena* arena)
+{
+	temporary_memory result;
+	result.arena = arena;
+	result.used = arena->used;
+	arena->temporaryCount++;
+	return result;
+}
+
+inline void
+endTemporaryMemory(temporary_memory temporary)
+{
+	memory_arena* arena = temporary.arena;
+	hm_assert(arena->used >= temporary.used);
+	hm_assert(arena->temporaryCount > 0);
+	arena->used = temporary.used;
+	arena->temporaryCount--;
+}
+
+// Call at the end of a frame, every scope must be closed by then
+inline void
+checkArena(memory_arena* arena)
+{
+	hm_assert(arena->temporaryCount == 0);
+}
+
+// SIMULATION
+// The game simulates in fixed ticks, whatever the frame rate is. A frame
+// runs the ticks that fit in the time since the last frame, maybe none,
+// and draws between the last two ticks by how far it is into the next.
+static const real32 SIMULATION_TICK_SECONDS = 1.0f / 120.0f;
+// A frame that needs more drops the rest of the time, so that a slow
+// frame does not make the next one slower still
+static const uint32 MAX_SIMULATION_TICKS_PER_FRAME = 8;
+
+struct game_simulation
+{
+	real32 x; // pixels from the center of the buffer
+	real32 y;
+};
+
+// Lives at the start of permanent storage
 struct game_state
 {
 	int32 toneHz;
-	int32 xOffset;
-	int32 yOffset;
 	real32 tSine;
+
+	// Last two ticks, frames draw between them
+	game_simulation previousSimulation;
+	game_simulation simulation;
+	real32 secondsToSimulate; // less than a tick after every frame
+	uint64 simulationTickCount;
+	uint64 droppedTickCount;
+
+	// Rest of permanent storage, base is NULL until the game sets it up
+	memory_arena arena;
+};
+
+// Lives at the start of transient storage
+struct render_group;
+struct game_assets;
+struct asset_stream;
+struct audio_state;
+struct playing_sound;
+struct sound_stream;
+static const uint32 RENDER_GROUP_MEMORY_SIZE = SizeMegaBytes(4);
+
+struct transient_state
+{
+	bool32 isInitialized;
+	// Rest of transient storage. Per frame scratch is temporary memory
+	// on top of what is allocated at initialization.
+	memory_arena arena;
+
+	render_group* renderGroup;
+	game_assets* assets;
+	asset_stream* assetStream;
+
+	audio_state* audio;
+	playing_sound* music;
+	sound_stream* musicStream;
 };
 /*
 	Services that the game provides to the platform layer
@@ -147,6 +380,17 @@ struct game_state
 	sound buffer to use
 */
 
+// Max values are exclusive
+struct game_rect
+{
+	int32 minX;
+	int32 minY;
+	int32 maxX;
+	int32 maxY;
+};
+
+static const int32 MAX_DIRTY_RECTS = 8;
+
 struct game_pixel_buffer
 {
 	// NOTE: Pixels are always 32-bits wide, Memory order BB GG RR XX
@@ -156,6 +400,16 @@ struct game_pixel_buffer
 	int32 bitmapHeight;
 	int32 bytesPerPixel;
 
+	// Set by the platform: pixels are still the ones the game rendered 
+	// last frame, so only the changed parts need to be rendered again.
+	bool32 keepsContents;
+
+	// Set by the game: the parts that changed this frame. The platform 
+	// only uploads these, zero rects means nothing changed.
+	// The platform sets this to the whole buffer before calling the game.
+	game_rect dirtyRects[MAX_DIRTY_RECTS];
+	int32 dirtyRectCount;
+
 	game_pixel_buffer()
 	{
 		texturePixels = NULL;
@@ -163,21 +417,24 @@ struct game_pixel_buffer
 		bitmapWidth = 0;
 		bitmapHeight = 0;
 		bytesPerPixel = 0;
+		keepsContents = false;
+		dirtyRectCount = 0;
 	}
 };
 
 struct game_audioConfig
 {
 	int32 samplesPerSecond;
+	int32 gameSamplesPerSecond; // game mixes at this rate, resampled to samplesPerSecond
 	int32 bytesPerSample;
 	uint32 runningSampleIndex;
 
 	// For measuring latency 
 	int32 currentLatencyBytes; // How much latency we have currently
-	int32 currentLatencySeconds; // How much latency seconds we have currently
+	real32 currentLatencySeconds; // How much latency seconds we have currently
 	
 	// For sound syncing 
-	int32 safetyBytes;
+	int32 safetyBytes; // calibrated while the game runs
 	int32 expectedSoundBytesPerFrame;
 	int32 expectedFrameBoundaryByte;
 	uint32 gameUpdateHz;
@@ -206,10 +463,13 @@ struct game_sound_buffer
 	void* samples;
 	uint32 samplesToWrite;
 
+	uint32 samplesPerSecond;
+
 	game_sound_buffer()
 	{
 		samples = NULL;
 		samplesToWrite = 0;
+		samplesPerSecond = 48000;
 	}
 	
 	// For sine wave output, copied from audioConfig
@@ -303,23 +563,27 @@ struct game_input_state
 typedef GAME_UPDATE_AND_RENDER(game_update_and_render);
 extern "C"
 {
-	extern GAME_UPDATE_AND_RENDER(gameUpdateAndRenderStub)
+	// inline so that every file of the game library can include this
+	inline GAME_UPDATE_AND_RENDER(gameUpdateAndRenderStub)
 	{
 		// nop
 	}
 	extern GAME_UPDATE_AND_RENDER(gameUpdateAndRender);
 }
 
-// This needs to be fast, about a millisecond to keep sound in sync
+// This needs to be fast, about a millisecond to keep sound in sync.
+// Samples may point straight into the platform's ring buffer with old
+// sound in it, so every one of samplesToWrite must be written.
 
 #define GAME_GET_SOUND_SAMPLES(name) void name(game_memory *memory, game_sound_buffer* buffer)
 typedef GAME_GET_SOUND_SAMPLES(game_get_sound_samples);
 
 extern "C"
 {
-	extern GAME_GET_SOUND_SAMPLES(gameGetSoundSamplesStub)
+	inline GAME_GET_SOUND_SAMPLES(gameGetSoundSamplesStub)
 	{
-		// nop
+		// Silence, the buffer is not cleared before
+		memset(buffer->samples, 0, buffer->samplesToWrite * 2 * sizeof(int16));
 	}
 
 	extern GAME_GET_SOUND_SAMPLES(gameGetSoundSamples);
@@ -337,9 +601,73 @@ writeSineWave(game_sound_buffer* buffer);
 void 
 renderWeirdGradient(game_pixel_buffer* buffer, int32 xOffset, int32 yOffset);
 
+// Writes one row of the weird gradient, there is a version for each 
+// instruction set. renderWeirdGradient() uses the best one the cpu supports.
+#define RENDER_GRADIENT_ROW(name) void name(uint32 *pixel, int32 width, int32 blue, uint32 green)
+typedef RENDER_GRADIENT_ROW(render_gradient_row);
+RENDER_GRADIENT_ROW(renderGradientRowScalar);
+RENDER_GRADIENT_ROW(renderGradientRowSSE2);
+RENDER_GRADIENT_ROW(renderGradientRowAVX2);
+
+render_gradient_row*
+getGradientRowKernel();
+
+void
+renderWeirdGradientWith(render_gradient_row *rowKernel, game_pixel_buffer* buffer, int32 xOffset, int32 yOffset);
+
 void
 renderBlackScreen(game_pixel_buffer* buffer);
 
+// Fill kernels. Each one writes color to count pixels starting from pixel.
+// The streaming ones use non-temporal stores that go past the cache,
+// so the caller must do _mm_sfence() before anyone else reads the pixels.
+#define FILL_ROW(name) void name(uint32 *pixel, int32 count, uint32 color)
+typedef FILL_ROW(fill_row);
+FILL_ROW(fillRowScalar);
+FILL_ROW(fillRowStreamSSE2);
+FILL_ROW(fillRowStreamAVX2);
+
+fill_row*
+getFillRowKernel();
+
+// Fills smaller than this stay in the cache, the pixels are likely
+// to be drawn over again soon.
+static const int32 FILL_STREAM_MIN_BYTES = SizeKiloBytes(64);
+
+// Max values are exclusive, the rect is clamped to the buffer
+void
+fillRectangleWith(fill_row* rowKernel, game_pixel_buffer* buffer, 
+	int32 minX, int32 minY, int32 maxX, int32 maxY, uint32 color);
+
+void
+fillRectangle(game_pixel_buffer* buffer, int32 minX, int32 minY, int32 maxX, int32 maxY, uint32 color);
+
+void
+fillBuffer(game_pixel_buffer* buffer, uint32 color);
+
+// Tiled rendering
+// The buffer is split into bands of whole rows so that each tile starts 
+// on a row and no two tiles share a cache line. Every tile is a 
+// game_pixel_buffer of its own, tileMinY tells where it is in the whole buffer.
+#define RENDER_TILE(name) void name(game_pixel_buffer *tile, int32 tileMinY, void *context)
+typedef RENDER_TILE(render_tile);
+
+static const int32 MAX_RENDER_TILES = 128;
+static const int32 RENDER_TILE_TARGET_BYTES = SizeKiloBytes(256); // about L2 size
+static const int32 CACHE_LINE_BYTES = 64;
+
+void
+renderTiled(game_memory* memory, game_pixel_buffer* buffer, render_tile *renderTile, void *context);
+
+RENDER_TILE(renderBlackScreenTile);
+RENDER_TILE(renderWeirdGradientTile);
+
+struct weird_gradient_offsets
+{
+	int32 xOffset;
+	int32 yOffset;
+};
+
 
 
 
@@ -0,0 +1,404 @@
+/* Packed asset archive: lookup for the game and packing for the tools */
+#include "handmade_asset.h"
+
+#include <stdlib.h> // qsort
+
+uint32 hashAssetName(const char* name)
+{
+	// FNV-1a
+	uint32 hash = 2166136261u;
+	for (const char* c = name; *c; c++)
+	{
+		hash ^= (uint8)*c;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+bool32 initializeAssets(game_assets* assets, void* fileMemory, uint64 fileSize)
+{
+	assets->base = NULL;
+	assets->size = 0;
+	assets->assetCount = 0;
+	assets->index = NULL;
+
+	if (fileMemory == NULL || fileSize < sizeof(hha_header))
+	{
+		return false;
+	}
+
+	hha_header* header = (hha_header*)fileMemory;
+	if (header->magicValue != HHA_MAGIC_VALUE
+		|| header->version != HHA_VERSION
+		|| header->fileSize != fileSize)
+	{
+		printf("Asset file header is not valid\n");
+		return false;
+	}
+
+	uint64 indexSize = (uint64)header->assetCount * sizeof(hha_asset);
+	if (header->indexOffset > fileSize || indexSize > fileSize - header->indexOffset)
+	{
+		printf("Asset file index does not fit in the file\n");
+		return false;
+	}
+
+	// Payloads are only checked here once, lookups trust them after this
+	hha_asset* index = (hha_asset*)((uint8*)fileMemory + header->indexOffset);
+	for (uint32 assetIndex = 0;
+		assetIndex < header->assetCount;
+		assetIndex++)
+	{
+		hha_asset& asset = index[assetIndex];
+		if (asset.dataOffset > fileSize || asset.dataSize > fileSize - asset.dataOffset)
+		{
+			printf("Asset %u data does not fit in the file\n", assetIndex);
+			return false;
+		}
+
+		if (asset.name[HHA_MAX_NAME_LENGTH - 1] != 0)
+		{
+			printf("Asset %u name is not terminated\n", assetIndex);
+			return false;
+		}
+
+		// The game reads this many bytes from what the type says
+		uint64 neededSize = 0;
+		bool32 isValidType = true;
+		switch (asset.type)
+		{
+			case AssetType_Bitmap:
+			{
+				neededSize = (uint64)asset.bitmap.width * asset.bitmap.height * 4;
+			} break;
+			case AssetType_Sound:
+			{
+				isValidType = (asset.sound.channelCount == 1 || asset.sound.channelCount == 2);
+				neededSize = (uint64)asset.sound.sampleCount * asset.sound.channelCount * sizeof(int16);
+			} break;
+			case AssetType_Font:
+			{
+				uint64 rowCount = (asset.font.glyphCount + HHA_FONT_GLYPHS_PER_ROW - 1) / HHA_FONT_GLYPHS_PER_ROW;
+				neededSize = (uint64)asset.font.glyphWidth * HHA_FONT_GLYPHS_PER_ROW
+					* asset.font.glyphHeight * rowCount * 4;
+			} break;
+			default:
+			{
+				isValidType = false;
+			} break;
+		}
+		if (!isValidType || neededSize > asset.dataSize)
+		{
+			printf("Asset %u does not match its data\n", assetIndex);
+			return false;
+		}
+	}
+
+	assets->base = (uint8*)fileMemory;
+	assets->size = fileSize;
+	assets->assetCount = header->assetCount;
+	assets->index = index;
+	return true;
+}
+
+hha_asset* findAsset(game_assets* assets, asset_type type, const char* name)
+{
+	uint32 nameHash = hashAssetName(name);
+
+	// Index is sorted by type and then by hash
+	uint32 first = 0;
+	uint32 onePastLast = assets->assetCount;
+	while (first < onePastLast)
+	{
+		uint32 middle = first + (onePastLast - first) / 2;
+		hha_asset* asset = assets->index + middle;
+		if (asset->type == (uint32)type && asset->nameHash == nameHash)
+		{
+			// Packing rejects two names with the same hash, so there is
+			// no other asset to look for if this one has another name
+			return (strcmp(asset->name, name) == 0) ? asset : NULL;
+		}
+
+		if (asset->type < (uint32)type
+			|| (asset->type == (uint32)type && asset->nameHash < nameHash))
+		{
+			first = middle + 1;
+		}
+		else
+		{
+			onePastLast = middle;
+		}
+	}
+	return NULL;
+}
+
+void* getAssetData(game_assets* assets, hha_asset* asset)
+{
+	return assets->base + asset->dataOffset;
+}
+
+bool32 getBitmapAsset(game_assets* assets, const char* name, loaded_bitmap* bitmap)
+{
+	hha_asset* asset = findAsset(assets, AssetType_Bitmap, name);
+	if (asset == NULL)
+	{
+		return false;
+	}
+
+	bitmap->memory = getAssetData(assets, asset);
+	bitmap->width = asset->bitmap.width;
+	bitmap->height = asset->bitmap.height;
+	bitmap->pitch = asset->bitmap.width * 4;
+	return true;
+}
+
+// STREAMING
+
+void initializeAssetStream(asset_stream* stream, memory_arena* arena, uint64 memorySize)
+{
+	subArena(&stream->memory, arena, memorySize, HHA_PAYLOAD_ALIGNMENT);
+	stream->slotCount = 0;
+}
+
+internal asset_stream_slot*
+findStreamSlot(asset_stream* stream, hha_asset* asset)
+{
+	for (uint32 slotIndex = 0;
+		slotIndex < stream->slotCount;
+		slotIndex++)
+	{
+		if (stream->slots[slotIndex].asset == asset)
+		{
+			return stream->slots + slotIndex;
+		}
+	}
+	return NULL;
+}
+
+// The I/O thread may still write to a queued slot, so it is not free
+// until the load has finished
+internal bool32
+isStreamSlotFree(asset_stream_slot* slot)
+{
+	return slot->isReleased && getAssetLoadState(&slot->request) != AssetLoad_Queued;
+}
+
+// Smallest free slot that can hold size bytes
+internal asset_stream_slot*
+findFreeStreamSlot(asset_stream* stream, uint64 size)
+{
+	asset_stream_slot* result = NULL;
+	for (uint32 slotIndex = 0;
+		slotIndex < stream->slotCount;
+		slotIndex++)
+	{
+		asset_stream_slot* slot = stream->slots + slotIndex;
+		if (isStreamSlotFree(slot) && slot->capacity >= size
+			&& (result == NULL || slot->capacity < result->capacity))
+		{
+			result = slot;
+		}
+	}
+	return result;
+}
+
+// Free slots at the end give their memory back to the arena
+internal void
+trimStreamSlots(asset_stream* stream)
+{
+	while (stream->slotCount > 0
+		&& isStreamSlotFree(stream->slots + stream->slotCount - 1))
+	{
+		asset_stream_slot* slot = stream->slots + --stream->slotCount;
+		stream->memory.used = (uint8*)slot->request.destination - stream->memory.base;
+	}
+}
+
+asset_stream_slot* requestAsset(game_memory* memory, game_assets* assets, asset_stream* stream,
+	asset_type type, const char* name, int32 priority)
+{
+	hha_asset* asset = findAsset(assets, type, name);
+	if (asset == NULL)
+	{
+		return NULL;
+	}
+
+	asset_stream_slot* slot = findStreamSlot(stream, asset);
+	if (slot == NULL)
+	{
+		slot = findFreeStreamSlot(stream, asset->dataSize);
+		if (slot == NULL)
+		{
+			trimStreamSlots(stream);
+			if (stream->slotCount == MAX_STREAMED_ASSETS 
+				|| !arenaHasRoomFor(&stream->memory, asset->dataSize, HHA_PAYLOAD_ALIGNMENT))
+			{
+				return NULL;
+			}
+
+			slot = stream->slots + stream->slotCount++;
+			slot->request.destination = pushSize(&stream->memory, asset->dataSize, HHA_PAYLOAD_ALIGNMENT);
+			slot->capacity = asset->dataSize;
+		}
+
+		slot->asset = asset;
+		slot->request.fileName = NULL;
+		slot->request.sourceOffset = asset->dataOffset;
+		slot->request.size = asset->dataSize;
+		slot->request.sequence = 0;
+		slot->request.state = AssetLoad_Unloaded;
+	}
+	slot->isReleased = false;
+
+	// Also retries requests that did not fit in the queue last time
+	if (getAssetLoadState(&slot->request) == AssetLoad_Unloaded)
+	{
+		slot->request.priority = priority;
+		if (memory->assetQueue)
+		{
+			memory->queueAssetLoad(memory->assetQueue, &slot->request);
+		}
+		else
+		{
+			memcpy(slot->request.destination, getAssetData(assets, asset), asset->dataSize);
+			slot->request.state = AssetLoad_Loaded;
+		}
+	}
+
+	return slot;
+}
+
+void releaseAsset(asset_stream* stream, asset_stream_slot* slot)
+{
+	hm_assert(slot >= stream->slots && slot < stream->slots + stream->slotCount);
+	slot->isReleased = true;
+}
+
+void* getStreamedAssetData(asset_stream_slot* slot)
+{
+	void* result = NULL;
+	if (getAssetLoadState(&slot->request) == AssetLoad_Loaded)
+	{
+		result = slot->request.destination;
+	}
+	return result;
+}
+
+bool32 getStreamedSound(asset_stream_slot* slot, loaded_sound* sound)
+{
+	void* data = getStreamedAssetData(slot);
+	if (data == NULL || slot->asset->type != AssetType_Sound)
+	{
+		return false;
+	}
+
+	sound->samples = (int16*)data;
+	sound->sampleCount = slot->asset->sound.sampleCount;
+	sound->channelCount = slot->asset->sound.channelCount;
+	sound->samplesPerSecond = slot->asset->sound.samplesPerSecond;
+	return true;
+}
+
+// PACKING
+
+internal uint64
+alignPayloadOffset(uint64 offset)
+{
+	return (offset + HHA_PAYLOAD_ALIGNMENT - 1) & ~(uint64)(HHA_PAYLOAD_ALIGNMENT - 1);
+}
+
+internal int
+compareAssetSources(const void* a, const void* b)
+{
+	hha_asset* assetA = &((asset_source*)a)->info;
+	hha_asset* assetB = &((asset_source*)b)->info;
+	if (assetA->type != assetB->type)
+	{
+		return (assetA->type < assetB->type) ? -1 : 1;
+	}
+	if (assetA->nameHash != assetB->nameHash)
+	{
+		return (assetA->nameHash < assetB->nameHash) ? -1 : 1;
+	}
+	return 0;
+}
+
+uint64 getAssetArchiveSize(asset_source* sources, uint32 sourceCount)
+{
+	// Every payload is padded to the alignment, so the size does not
+	// depend on the order that packing sorts the sources to
+	uint64 size = alignPayloadOffset(sizeof(hha_header) + (uint64)sourceCount * sizeof(hha_asset));
+	for (uint32 sourceIndex = 0;
+		sourceIndex < sourceCount;
+		sourceIndex++)
+	{
+		size += alignPayloadOffset(sources[sourceIndex].info.dataSize);
+	}
+	return size;
+}
+
+bool32 packAssetArchive(asset_source* sources, uint32 sourceCount, void* memory, uint64 memorySize)
+{
+	uint64 archiveSize = getAssetArchiveSize(sources, sourceCount);
+	if (memorySize < archiveSize)
+	{
+		return false;
+	}
+
+	for (uint32 sourceIndex = 0;
+		sourceIndex < sourceCount;
+		sourceIndex++)
+	{
+		asset_source& source = sources[sourceIndex];
+		if (strlen(source.name) >= HHA_MAX_NAME_LENGTH)
+		{
+			printf("Asset name %s is longer than %u characters\n", source.name, HHA_MAX_NAME_LENGTH - 1);
+			return false;
+		}
+		source.info.nameHash = hashAssetName(source.name);
+		memset(source.info.name, 0, sizeof(source.info.name));
+		strcpy(source.info.name, source.name);
+	}
+	qsort(sources, sourceCount, sizeof(asset_source), compareAssetSources);
+
+	for (uint32 sourceIndex = 1;
+		sourceIndex < sourceCount;
+		sourceIndex++)
+	{
+		if (compareAssetSources(&sources[sourceIndex - 1], &sources[sourceIndex]) == 0)
+		{
+			printf("Assets %s and %s have the same name hash\n",
+				sources[sourceIndex - 1].name, sources[sourceIndex].name);
+			return false;
+		}
+	}
+
+	uint8* base = (uint8*)memory;
+	// Padding between payloads is zeros
+	memset(base, 0, archiveSize);
+
+	hha_header* header = (hha_header*)base;
+	header->magicValue = HHA_MAGIC_VALUE;
+	header->version = HHA_VERSION;
+	header->assetCount = sourceCount;
+	header->reserved = 0;
+	header->indexOffset = sizeof(hha_header);
+	header->fileSize = archiveSize;
+
+	hha_asset* index = (hha_asset*)(base + header->indexOffset);
+	uint64 offset = header->indexOffset + (uint64)sourceCount * sizeof(hha_asset);
+	for (uint32 sourceIndex = 0;
+		sourceIndex < sourceCount;
+		sourceIndex++)
+	{
+		asset_source& source = sources[sourceIndex];
+		offset = alignPayloadOffset(offset);
+		source.info.dataOffset = offset;
+		index[sourceIndex] = source.info;
+		memcpy(base + offset, source.data, source.info.dataSize);
+		offset += source.info.dataSize;
+	}
+	hm_assert(alignPayloadOffset(offset) == archiveSize);
+
+	return true;
+}
@@ -0,0 +1,195 @@
+/* Packed asset archive that the platform maps to memory */
+
+#ifndef HANDMADE_ASSET_H
+#define HANDMADE_ASSET_H
+
+#include "handmade.h"
+#include "handmade_render_group.h"
+#include "handmade_audio.h"
+
+/*
+	All assets are in one file that the platform maps to memory once.
+	The game uses the data straight from the mapping, nothing is copied.
+
+	File layout, offsets are from the start of the file:
+		hha_header
+		hha_asset index[assetCount], sorted by type and then nameHash
+		payloads, each one starts at a multiple of HHA_PAYLOAD_ALIGNMENT
+
+	Structs are written as they are in memory, so the file is little endian
+	and must be read with the same struct layout.
+*/
+
+#define HHA_CODE(a, b, c, d) ((uint32)(a) | ((uint32)(b) << 8) | ((uint32)(c) << 16) | ((uint32)(d) << 24))
+
+static const uint32 HHA_MAGIC_VALUE = HHA_CODE('h', 'h', 'a', 'f');
+static const uint32 HHA_VERSION = 2;
+// Cache line, and enough for any SIMD loads
+static const uint32 HHA_PAYLOAD_ALIGNMENT = 64;
+static const uint32 HHA_FONT_GLYPHS_PER_ROW = 16;
+// With the terminating zero
+static const uint32 HHA_MAX_NAME_LENGTH = 32;
+
+enum asset_type
+{
+	AssetType_None,
+	AssetType_Bitmap,
+	AssetType_Sound,
+	AssetType_Font,
+
+	AssetType_Count
+};
+
+struct hha_header
+{
+	uint32 magicValue;
+	uint32 version;
+	uint32 assetCount;
+	uint32 reserved;
+	uint64 indexOffset;
+	uint64 fileSize;
+};
+
+// 32 bit pixels like game_pixel_buffer, rows top to bottom, pitch is width * 4
+struct hha_bitmap
+{
+	uint32 width;
+	uint32 height;
+};
+
+// int16 samples, channels interleaved
+struct hha_sound
+{
+	uint32 sampleCount; // per channel
+	uint32 channelCount;
+	uint32 samplesPerSecond;
+};
+
+// Bitmap of fixed size glyphs, HHA_FONT_GLYPHS_PER_ROW on each row
+struct hha_font
+{
+	uint32 firstCodepoint;
+	uint32 glyphCount;
+	uint32 glyphWidth;
+	uint32 glyphHeight;
+};
+
+struct hha_asset
+{
+	uint32 type; // asset_type
+	uint32 nameHash;
+	// Lookups compare this too, so a name that is not in the archive
+	// never finds an asset with the same hash
+	char name[HHA_MAX_NAME_LENGTH];
+	uint64 dataOffset;
+	uint64 dataSize;
+	union
+	{
+		hha_bitmap bitmap;
+		hha_sound sound;
+		hha_font font;
+	};
+};
+
+struct game_assets
+{
+	uint8* base;
+	uint64 size;
+	uint32 assetCount;
+	hha_asset* index;
+};
+
+uint32
+hashAssetName(const char* name);
+
+// Checks the header and points assets to the index in fileMemory.
+// Returns false and leaves assets empty if the file is not valid.
+bool32
+initializeAssets(game_assets* assets, void* fileMemory, uint64 fileSize);
+
+// Binary search, returns NULL when there is no such asset
+hha_asset*
+findAsset(game_assets* assets, asset_type type, const char* name);
+
+void*
+getAssetData(game_assets* assets, hha_asset* asset);
+
+// Fills bitmap to point into the archive
+bool32
+getBitmapAsset(game_assets* assets, const char* name, loaded_bitmap* bitmap);
+
+// STREAMING
+// Copies of archive assets in transient storage, loaded in the background
+// by the platform. The first touch of a mapped page can wait for the disk,
+// so the game should use streamed copies for anything it needs in a frame.
+
+static const uint32 MAX_STREAMED_ASSETS = 256;
+static const uint64 ASSET_STREAM_MEMORY_SIZE = SizeMegaBytes(64);
+
+struct asset_stream_slot
+{
+	hha_asset* asset;
+	asset_load_request request;
+	// Bytes at request.destination, stays with the slot when it is reused
+	uint64 capacity;
+	// Data stays until the slot is needed for another asset, so asking
+	// again before that does not load it again
+	bool32 isReleased;
+};
+
+struct asset_stream
+{
+	// Slot memory is pushed here in slot order. A free slot gives its
+	// memory to the next asset that fits, and free slots at the end
+	// give it back to the arena.
+	memory_arena memory;
+
+	uint32 slotCount;
+	asset_stream_slot slots[MAX_STREAMED_ASSETS];
+};
+
+// Takes memorySize from the arena for the slots
+void
+initializeAssetStream(asset_stream* stream, memory_arena* arena, uint64 memorySize);
+
+// Queues the asset to load if it is not already, call every frame that
+// needs it. Returns NULL if there is no such asset or no room for it.
+asset_stream_slot*
+requestAsset(game_memory* memory, game_assets* assets, asset_stream* stream,
+	asset_type type, const char* name, int32 priority);
+
+// The game no longer needs the asset, its slot can be reused once any
+// load that is still queued has finished
+void
+releaseAsset(asset_stream* stream, asset_stream_slot* slot);
+
+// NULL until the slot is loaded
+void*
+getStreamedAssetData(asset_stream_slot* slot);
+
+// Fills sound to point to the streamed copy, false until the slot is loaded
+bool32
+getStreamedSound(asset_stream_slot* slot, loaded_sound* sound);
+
+// PACKING
+// Used by the packer tool and the benchmark to write archives.
+
+struct asset_source
+{
+	const char* name;
+	void* data;
+	// Caller fills type, dataSize and the type specific part,
+	// packing fills the rest
+	hha_asset info;
+};
+
+uint64
+getAssetArchiveSize(asset_source* sources, uint32 sourceCount);
+
+// Writes the archive to memory, which must be getAssetArchiveSize() bytes.
+// Sorts sources to index order. Returns false if a name is too long or
+// two names of the same type have the same hash.
+bool32
+packAssetArchive(asset_source* sources, uint32 sourceCount, void* memory, uint64 memorySize);
+
+#endif
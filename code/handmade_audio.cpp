@@ -0,0 +1,960 @@
+/* Game audio: oscillators and everything that makes samples */
+#include "handmade_audio.h"
+
+#include <immintrin.h> // SSE2 and AVX2 intrinsics
+
+// OSCILLATORS
+// Every kernel does the same operations in the same order for each lane,
+// so they all give the same samples. Lane k of a block is sample k.
+
+OSCILLATOR_BLOCKS(oscillatorBlocksScalar)
+{
+	real32 sines[OSCILLATOR_BLOCK_SAMPLES];
+	real32 cosines[OSCILLATOR_BLOCK_SAMPLES];
+	for (uint32 k = 0;
+		k < OSCILLATOR_BLOCK_SAMPLES;
+		k++)
+	{
+		// sin(a + b) = sin(a)cos(b) + cos(a)sin(b)
+		// cos(a + b) = cos(a)cos(b) - sin(a)sin(b)
+		sines[k] = sine * steps->cosines[k] + cosine * steps->sines[k];
+		cosines[k] = cosine * steps->cosines[k] - sine * steps->sines[k];
+	}
+
+	for (uint32 block = 1;
+		block <= blockCount;
+		block++)
+	{
+		for (uint32 k = 0;
+			k < OSCILLATOR_BLOCK_SAMPLES;
+			k++)
+		{
+			output[k] += steps->amplitude * sines[k];
+
+			real32 s = sines[k] * steps->blockCosine + cosines[k] * steps->blockSine;
+			real32 c = cosines[k] * steps->blockCosine - sines[k] * steps->blockSine;
+			if (block % OSCILLATOR_NORMALIZE_BLOCKS == 0)
+			{
+				// One Newton step towards length one, the drift is tiny
+				// so one step is enough
+				real32 correction = 1.5f - 0.5f * (s * s + c * c);
+				s *= correction;
+				c *= correction;
+			}
+			sines[k] = s;
+			cosines[k] = c;
+		}
+		output += OSCILLATOR_BLOCK_SAMPLES;
+	}
+}
+
+OSCILLATOR_BLOCKS(oscillatorBlocksSSE2)
+{
+	const uint32 laneCount = 4;
+	const uint32 vectorCount = OSCILLATOR_BLOCK_SAMPLES / laneCount;
+
+	__m128 amplitude = _mm_set1_ps(steps->amplitude);
+	__m128 blockSine = _mm_set1_ps(steps->blockSine);
+	__m128 blockCosine = _mm_set1_ps(steps->blockCosine);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 threeHalves = _mm_set1_ps(1.5f);
+
+	__m128 sines[vectorCount];
+	__m128 cosines[vectorCount];
+	__m128 startSine = _mm_set1_ps(sine);
+	__m128 startCosine = _mm_set1_ps(cosine);
+	for (uint32 v = 0;
+		v < vectorCount;
+		v++)
+	{
+		__m128 stepSines = _mm_loadu_ps(steps->sines + v * laneCount);
+		__m128 stepCosines = _mm_loadu_ps(steps->cosines + v * laneCount);
+		sines[v] = _mm_add_ps(_mm_mul_ps(startSine, stepCosines), _mm_mul_ps(startCosine, stepSines));
+		cosines[v] = _mm_sub_ps(_mm_mul_ps(startCosine, stepCosines), _mm_mul_ps(startSine, stepSines));
+	}
+
+	for (uint32 block = 1;
+		block <= blockCount;
+		block++)
+	{
+		for (uint32 v = 0;
+			v < vectorCount;
+			v++)
+		{
+			real32* out = output + v * laneCount;
+			_mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(amplitude, sines[v])));
+
+			__m128 s = _mm_add_ps(_mm_mul_ps(sines[v], blockCosine), _mm_mul_ps(cosines[v], blockSine));
+			__m128 c = _mm_sub_ps(_mm_mul_ps(cosines[v], blockCosine), _mm_mul_ps(sines[v], blockSine));
+			if (block % OSCILLATOR_NORMALIZE_BLOCKS == 0)
+			{
+				__m128 lengthSquared = _mm_add_ps(_mm_mul_ps(s, s), _mm_mul_ps(c, c));
+				__m128 correction = _mm_sub_ps(threeHalves, _mm_mul_ps(half, lengthSquared));
+				s = _mm_mul_ps(s, correction);
+				c = _mm_mul_ps(c, correction);
+			}
+			sines[v] = s;
+			cosines[v] = c;
+		}
+		output += OSCILLATOR_BLOCK_SAMPLES;
+	}
+}
+
+__attribute__((target("avx2")))
+OSCILLATOR_BLOCKS(oscillatorBlocksAVX2)
+{
+	const uint32 laneCount = 8;
+	const uint32 vectorCount = OSCILLATOR_BLOCK_SAMPLES / laneCount;
+
+	__m256 amplitude = _mm256_set1_ps(steps->amplitude);
+	__m256 blockSine = _mm256_set1_ps(steps->blockSine);
+	__m256 blockCosine = _mm256_set1_ps(steps->blockCosine);
+	__m256 half = _mm256_set1_ps(0.5f);
+	__m256 threeHalves = _mm256_set1_ps(1.5f);
+
+	__m256 sines[vectorCount];
+	__m256 cosines[vectorCount];
+	__m256 startSine = _mm256_set1_ps(sine);
+	__m256 startCosine = _mm256_set1_ps(cosine);
+	for (uint32 v = 0;
+		v < vectorCount;
+		v++)
+	{
+		__m256 stepSines = _mm256_loadu_ps(steps->sines + v * laneCount);
+		__m256 stepCosines = _mm256_loadu_ps(steps->cosines + v * laneCount);
+		sines[v] = _mm256_add_ps(_mm256_mul_ps(startSine, stepCosines), _mm256_mul_ps(startCosine, stepSines));
+		cosines[v] = _mm256_sub_ps(_mm256_mul_ps(startCosine, stepCosines), _mm256_mul_ps(startSine, stepSines));
+	}
+
+	for (uint32 block = 1;
+		block <= blockCount;
+		block++)
+	{
+		for (uint32 v = 0;
+			v < vectorCount;
+			v++)
+		{
+			real32* out = output + v * laneCount;
+			_mm256_storeu_ps(out, _mm256_add_ps(_mm256_loadu_ps(out), _mm256_mul_ps(amplitude, sines[v])));
+
+			__m256 s = _mm256_add_ps(_mm256_mul_ps(sines[v], blockCosine), _mm256_mul_ps(cosines[v], blockSine));
+			__m256 c = _mm256_sub_ps(_mm256_mul_ps(cosines[v], blockCosine), _mm256_mul_ps(sines[v], blockSine));
+			if (block % OSCILLATOR_NORMALIZE_BLOCKS == 0)
+			{
+				__m256 lengthSquared = _mm256_add_ps(_mm256_mul_ps(s, s), _mm256_mul_ps(c, c));
+				__m256 correction = _mm256_sub_ps(threeHalves, _mm256_mul_ps(half, lengthSquared));
+				s = _mm256_mul_ps(s, correction);
+				c = _mm256_mul_ps(c, correction);
+			}
+			sines[v] = s;
+			cosines[v] = c;
+		}
+		output += OSCILLATOR_BLOCK_SAMPLES;
+	}
+}
+
+global_variable oscillator_blocks* oscillatorBlocksKernel;
+
+oscillator_blocks* getOscillatorBlocksKernel()
+{
+	if (oscillatorBlocksKernel == NULL)
+	{
+		oscillatorBlocksKernel = oscillatorBlocksSSE2;
+		if (__builtin_cpu_supports("avx2"))
+		{
+			oscillatorBlocksKernel = oscillatorBlocksAVX2;
+		}
+	}
+	return oscillatorBlocksKernel;
+}
+
+oscillator_voice* addOscillatorVoice(oscillator_bank* bank, real32 hz, real32 samplesPerSecond, real32 volume)
+{
+	if (bank->voiceCount == MAX_OSCILLATOR_VOICES)
+	{
+		return NULL;
+	}
+
+	oscillator_voice* voice = bank->voices + bank->voiceCount++;
+	voice->phase = 0.0f;
+	voice->phaseStep = 2.0f * PI32 * hz / samplesPerSecond;
+	voice->volume = volume;
+	return voice;
+}
+
+void renderOscillatorBankWith(oscillator_blocks* kernel, oscillator_bank* bank, real32* mix, uint32 sampleCount)
+{
+	uint32 blockCount = (sampleCount + OSCILLATOR_BLOCK_SAMPLES - 1) / OSCILLATOR_BLOCK_SAMPLES;
+	memset(mix, 0, blockCount * OSCILLATOR_BLOCK_SAMPLES * sizeof(real32));
+
+	for (uint32 voiceIndex = 0;
+		voiceIndex < bank->voiceCount;
+		voiceIndex++)
+	{
+		oscillator_voice& voice = bank->voices[voiceIndex];
+
+		// A few sinf calls per voice and render, not per sample
+		oscillator_steps steps;
+		for (uint32 k = 0;
+			k < OSCILLATOR_BLOCK_SAMPLES;
+			k++)
+		{
+			steps.sines[k] = sinf((real32)k * voice.phaseStep);
+			steps.cosines[k] = cosf((real32)k * voice.phaseStep);
+		}
+		steps.blockSine = sinf(OSCILLATOR_BLOCK_SAMPLES * voice.phaseStep);
+		steps.blockCosine = cosf(OSCILLATOR_BLOCK_SAMPLES * voice.phaseStep);
+		steps.amplitude = voice.volume;
+
+		kernel(mix, blockCount, &steps, sinf(voice.phase), cosf(voice.phase));
+
+		// Next render starts from the exact phase, so the recurrence
+		// never runs longer than one render
+		real64 phase = (real64)voice.phase + (real64)sampleCount * (real64)voice.phaseStep;
+		voice.phase = (real32)fmod(phase, 2.0 * PI32);
+	}
+}
+
+void renderOscillatorBank(oscillator_bank* bank, real32* mix, uint32 sampleCount)
+{
+	renderOscillatorBankWith(getOscillatorBlocksKernel(), bank, mix, sampleCount);
+}
+
+void writeMixToStereo(real32* mix, int16* output, uint32 sampleCount)
+{
+	// Clamp as floats, converting a float that does not fit in int32
+	// gives 0x80000000 whatever the sign was
+	__m128 minValue = _mm_set1_ps(-32768.0f);
+	__m128 maxValue = _mm_set1_ps(32767.0f);
+
+	uint32 sampleIndex = 0;
+	for (;
+		sampleIndex + 8 <= sampleCount;
+		sampleIndex += 8)
+	{
+		__m128 mix0 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(mix + sampleIndex), minValue), maxValue);
+		__m128 mix1 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(mix + sampleIndex + 4), minValue), maxValue);
+		__m128i mono = _mm_packs_epi32(_mm_cvtps_epi32(mix0), _mm_cvtps_epi32(mix1));
+
+		// Each sample twice, left and right
+		_mm_storeu_si128((__m128i*)(output + 2 * sampleIndex), _mm_unpacklo_epi16(mono, mono));
+		_mm_storeu_si128((__m128i*)(output + 2 * sampleIndex + 8), _mm_unpackhi_epi16(mono, mono));
+	}
+
+	for (;
+		sampleIndex < sampleCount;
+		sampleIndex++)
+	{
+		__m128 value = _mm_min_ss(_mm_max_ss(_mm_set_ss(mix[sampleIndex]), minValue), maxValue);
+		int16 sample = (int16)_mm_cvtss_si32(value);
+		output[2 * sampleIndex] = sample;
+		output[2 * sampleIndex + 1] = sample;
+	}
+}
+
+void writeChannelsToStereo(real32* left, real32* right, int16* output, uint32 sampleCount)
+{
+	__m128 minValue = _mm_set1_ps(-32768.0f);
+	__m128 maxValue = _mm_set1_ps(32767.0f);
+
+	uint32 sampleIndex = 0;
+	for (;
+		sampleIndex + 8 <= sampleCount;
+		sampleIndex += 8)
+	{
+		__m128 left0 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(left + sampleIndex), minValue), maxValue);
+		__m128 left1 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(left + sampleIndex + 4), minValue), maxValue);
+		__m128 right0 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(right + sampleIndex), minValue), maxValue);
+		__m128 right1 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(right + sampleIndex + 4), minValue), maxValue);
+		__m128i left16 = _mm_packs_epi32(_mm_cvtps_epi32(left0), _mm_cvtps_epi32(left1));
+		__m128i right16 = _mm_packs_epi32(_mm_cvtps_epi32(right0), _mm_cvtps_epi32(right1));
+
+		_mm_storeu_si128((__m128i*)(output + 2 * sampleIndex), _mm_unpacklo_epi16(left16, right16));
+		_mm_storeu_si128((__m128i*)(output + 2 * sampleIndex + 8), _mm_unpackhi_epi16(left16, right16));
+	}
+
+	for (;
+		sampleIndex < sampleCount;
+		sampleIndex++)
+	{
+		__m128 leftValue = _mm_min_ss(_mm_max_ss(_mm_set_ss(left[sampleIndex]), minValue), maxValue);
+		__m128 rightValue = _mm_min_ss(_mm_max_ss(_mm_set_ss(right[sampleIndex]), minValue), maxValue);
+		output[2 * sampleIndex] = (int16)_mm_cvtss_si32(leftValue);
+		output[2 * sampleIndex + 1] = (int16)_mm_cvtss_si32(rightValue);
+	}
+}
+
+// MIXER
+
+void initializeAudioState(audio_state* audio)
+{
+	audio->firstPlayingSound = NULL;
+	audio->firstFreePlayingSound = NULL;
+	audio->playingSoundCount = 0;
+	for (uint32 soundIndex = 0;
+		soundIndex < MAX_PLAYING_SOUNDS;
+		soundIndex++)
+	{
+		audio->sounds[soundIndex].next = audio->firstFreePlayingSound;
+		audio->firstFreePlayingSound = audio->sounds + soundIndex;
+	}
+	audio->tones.voiceCount = 0;
+}
+
+playing_sound* playSound(audio_state* audio, loaded_sound* sound, bool32 isLooping)
+{
+	playing_sound* result = audio->firstFreePlayingSound;
+	if (result == NULL)
+	{
+		return NULL;
+	}
+	audio->firstFreePlayingSound = result->next;
+
+	result->sound = *sound;
+	result->isLooping = isLooping;
+	result->stopAtTarget = false;
+	result->samplesPlayed = 0.0;
+	result->pitch = 1.0f;
+	changeVolume(result, 0.0f, 1.0f, 0.0f);
+
+	result->next = audio->firstPlayingSound;
+	audio->firstPlayingSound = result;
+	audio->playingSoundCount++;
+	return result;
+}
+
+void changeVolume(playing_sound* sound, real32 fadeSeconds, real32 volume, real32 pan)
+{
+	if (pan < -1.0f)
+	{
+		pan = -1.0f;
+	}
+	else if (pan > 1.0f)
+	{
+		pan = 1.0f;
+	}
+	real32 angle = (pan + 1.0f) * 0.25f * PI32;
+	sound->targetVolume[0] = volume * cosf(angle);
+	sound->targetVolume[1] = volume * sinf(angle);
+
+	for (uint32 channel = 0;
+		channel < 2;
+		channel++)
+	{
+		if (fadeSeconds <= 0.0f)
+		{
+			sound->currentVolume[channel] = sound->targetVolume[channel];
+			sound->dCurrentVolume[channel] = 0.0f;
+		}
+		else
+		{
+			sound->dCurrentVolume[channel] = (sound->targetVolume[channel] - sound->currentVolume[channel]) / fadeSeconds;
+		}
+	}
+}
+
+void changePitch(playing_sound* sound, real32 pitch)
+{
+	// Sounds only play forward
+	sound->pitch = (pitch > 0.001f) ? pitch : 0.001f;
+}
+
+void stopSound(playing_sound* sound, real32 fadeSeconds)
+{
+	for (uint32 channel = 0;
+		channel < 2;
+		channel++)
+	{
+		sound->targetVolume[channel] = 0.0f;
+		if (fadeSeconds <= 0.0f)
+		{
+			sound->currentVolume[channel] = 0.0f;
+			sound->dCurrentVolume[channel] = 0.0f;
+		}
+		else
+		{
+			sound->dCurrentVolume[channel] = -sound->currentVolume[channel] / fadeSeconds;
+		}
+	}
+	sound->stopAtTarget = true;
+}
+
+// Samples are loaded one lane at a time in every kernel, there is no
+// gather for int16. Lane offset is whole source samples from firstIndex.
+internal inline void
+loadSegmentSamples(sound_mix_segment* segment, uint32 offset,
+	real32* left0, real32* left1, real32* right0, real32* right1)
+{
+	uint32 index0 = segment->firstIndex + offset;
+	if (index0 >= segment->sampleCount)
+	{
+		// Only happens from rounding on the very last sample
+		index0 = segment->sampleCount - 1;
+	}
+	uint32 index1 = index0 + 1;
+	if (index1 == segment->sampleCount)
+	{
+		index1 = segment->isLooping ? 0 : index0;
+	}
+
+	// Mono sounds play the same sample on both sides
+	int16* sample0 = segment->samples + index0 * segment->channelCount;
+	int16* sample1 = segment->samples + index1 * segment->channelCount;
+	uint32 rightChannel = segment->channelCount - 1;
+	*left0 = sample0[0];
+	*left1 = sample1[0];
+	*right0 = sample0[rightChannel];
+	*right1 = sample1[rightChannel];
+}
+
+// One output sample, the SIMD kernels use this for the last few
+internal inline void
+mixSegmentSample(sound_mix_segment* segment, real32* left, real32* right, uint32 n)
+{
+	real32 lane = (real32)n;
+	real32 position = segment->firstFraction + lane * segment->dSample;
+	uint32 offset = (uint32)position;
+	real32 t = position - (real32)offset;
+
+	real32 left0, left1, right0, right1;
+	loadSegmentSamples(segment, offset, &left0, &left1, &right0, &right1);
+	real32 leftSample = left0 + t * (left1 - left0);
+	real32 rightSample = right0 + t * (right1 - right0);
+
+	real32 leftVolume = segment->volume[0] + lane * segment->dVolume[0];
+	real32 rightVolume = segment->volume[1] + lane * segment->dVolume[1];
+	left[n] += leftVolume * leftSample;
+	right[n] += rightVolume * rightSample;
+}
+
+MIX_SOUND_SEGMENT(mixSoundSegmentScalar)
+{
+	for (uint32 n = 0;
+		n < count;
+		n++)
+	{
+		mixSegmentSample(segment, left, right, n);
+	}
+}
+
+MIX_SOUND_SEGMENT(mixSoundSegmentSSE2)
+{
+	const uint32 laneCount = 4;
+	__m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	__m128 firstFraction = _mm_set1_ps(segment->firstFraction);
+	__m128 dSample = _mm_set1_ps(segment->dSample);
+	__m128 leftVolume = _mm_set1_ps(segment->volume[0]);
+	__m128 rightVolume = _mm_set1_ps(segment->volume[1]);
+	__m128 dLeftVolume = _mm_set1_ps(segment->dVolume[0]);
+	__m128 dRightVolume = _mm_set1_ps(segment->dVolume[1]);
+
+	uint32 n = 0;
+	for (;
+		n + laneCount <= count;
+		n += laneCount)
+	{
+		__m128 lanes = _mm_add_ps(_mm_set1_ps((real32)n), laneOffsets);
+		__m128 position = _mm_add_ps(firstFraction, _mm_mul_ps(lanes, dSample));
+		__m128i offsets = _mm_cvttps_epi32(position);
+		__m128 t = _mm_sub_ps(position, _mm_cvtepi32_ps(offsets));
+
+		uint32 laneOffset[4];
+		real32 left0[4], left1[4], right0[4], right1[4];
+		_mm_storeu_si128((__m128i*)laneOffset, offsets);
+		for (uint32 lane = 0; lane < laneCount; lane++)
+		{
+			loadSegmentSamples(segment, laneOffset[lane], left0 + lane, left1 + lane, right0 + lane, right1 + lane);
+		}
+
+		__m128 leftStart = _mm_loadu_ps(left0);
+		__m128 rightStart = _mm_loadu_ps(right0);
+		__m128 leftSample = _mm_add_ps(leftStart, _mm_mul_ps(t, _mm_sub_ps(_mm_loadu_ps(left1), leftStart)));
+		__m128 rightSample = _mm_add_ps(rightStart, _mm_mul_ps(t, _mm_sub_ps(_mm_loadu_ps(right1), rightStart)));
+
+		__m128 leftGain = _mm_add_ps(leftVolume, _mm_mul_ps(lanes, dLeftVolume));
+		__m128 rightGain = _mm_add_ps(rightVolume, _mm_mul_ps(lanes, dRightVolume));
+		_mm_storeu_ps(left + n, _mm_add_ps(_mm_loadu_ps(left + n), _mm_mul_ps(leftGain, leftSample)));
+		_mm_storeu_ps(right + n, _mm_add_ps(_mm_loadu_ps(right + n), _mm_mul_ps(rightGain, rightSample)));
+	}
+
+	for (;
+		n < count;
+		n++)
+	{
+		mixSegmentSample(segment, left, right, n);
+	}
+}
+
+__attribute__((target("avx2")))
+MIX_SOUND_SEGMENT(mixSoundSegmentAVX2)
+{
+	const uint32 laneCount = 8;
+	__m256 laneOffsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+	__m256 firstFraction = _mm256_set1_ps(segment->firstFraction);
+	__m256 dSample = _mm256_set1_ps(segment->dSample);
+	__m256 leftVolume = _mm256_set1_ps(segment->volume[0]);
+	__m256 rightVolume = _mm256_set1_ps(segment->volume[1]);
+	__m256 dLeftVolume = _mm256_set1_ps(segment->dVolume[0]);
+	__m256 dRightVolume = _mm256_set1_ps(segment->dVolume[1]);
+
+	uint32 n = 0;
+	for (;
+		n + laneCount <= count;
+		n += laneCount)
+	{
+		__m256 lanes = _mm256_add_ps(_mm256_set1_ps((real32)n), laneOffsets);
+		__m256 position = _mm256_add_ps(firstFraction, _mm256_mul_ps(lanes, dSample));
+		__m256i offsets = _mm256_cvttps_epi32(position);
+		__m256 t = _mm256_sub_ps(position, _mm256_cvtepi32_ps(offsets));
+
+		uint32 laneOffset[8];
+		real32 left0[8], left1[8], right0[8], right1[8];
+		_mm256_storeu_si256((__m256i*)laneOffset, offsets);
+		for (uint32 lane = 0; lane < laneCount; lane++)
+		{
+			loadSegmentSamples(segment, laneOffset[lane], left0 + lane, left1 + lane, right0 + lane, right1 + lane);
+		}
+
+		__m256 leftStart = _mm256_loadu_ps(left0);
+		__m256 rightStart = _mm256_loadu_ps(right0);
+		__m256 leftSample = _mm256_add_ps(leftStart, _mm256_mul_ps(t, _mm256_sub_ps(_mm256_loadu_ps(left1), leftStart)));
+		__m256 rightSample = _mm256_add_ps(rightStart, _mm256_mul_ps(t, _mm256_sub_ps(_mm256_loadu_ps(right1), rightStart)));
+
+		__m256 leftGain = _mm256_add_ps(leftVolume, _mm256_mul_ps(lanes, dLeftVolume));
+		__m256 rightGain = _mm256_add_ps(rightVolume, _mm256_mul_ps(lanes, dRightVolume));
+		_mm256_storeu_ps(left + n, _mm256_add_ps(_mm256_loadu_ps(left + n), _mm256_mul_ps(leftGain, leftSample)));
+		_mm256_storeu_ps(right + n, _mm256_add_ps(_mm256_loadu_ps(right + n), _mm256_mul_ps(rightGain, rightSample)));
+	}
+
+	for (;
+		n < count;
+		n++)
+	{
+		mixSegmentSample(segment, left, right, n);
+	}
+}
+
+global_variable mix_sound_segment* mixSoundSegmentKernel;
+
+mix_sound_segment* getMixSoundSegmentKernel()
+{
+	if (mixSoundSegmentKernel == NULL)
+	{
+		mixSoundSegmentKernel = mixSoundSegmentSSE2;
+		if (__builtin_cpu_supports("avx2"))
+		{
+			mixSoundSegmentKernel = mixSoundSegmentAVX2;
+		}
+	}
+	return mixSoundSegmentKernel;
+}
+
+void mixPlayingSounds(mix_sound_segment* kernel, audio_state* audio,
+	real32* left, real32* right, uint32 sampleCount, uint32 samplesPerSecond)
+{
+	real32 secondsPerSample = 1.0f / (real32)samplesPerSecond;
+
+	playing_sound** soundPointer = &audio->firstPlayingSound;
+	while (*soundPointer)
+	{
+		playing_sound* sound = *soundPointer;
+		loaded_sound& source = sound->sound;
+		real64 dSample = (real64)sound->pitch * (real64)source.samplesPerSecond / (real64)samplesPerSecond;
+
+		bool32 isFinished = (source.sampleCount == 0 || source.channelCount == 0);
+		uint32 samplesMixed = 0;
+		while (samplesMixed < sampleCount && !isFinished)
+		{
+			if (sound->stopAtTarget
+				&& sound->dCurrentVolume[0] == 0.0f && sound->dCurrentVolume[1] == 0.0f)
+			{
+				isFinished = true;
+				break;
+			}
+
+			// Segment ends where the output, the sound or a volume ramp ends
+			uint32 segmentCount = sampleCount - samplesMixed;
+			real64 samplesLeft = (real64)source.sampleCount - sound->samplesPlayed;
+			uint32 samplesToEnd = (uint32)ceil(samplesLeft / dSample);
+			if (samplesToEnd < segmentCount)
+			{
+				segmentCount = samplesToEnd;
+			}
+
+			sound_mix_segment segment;
+			uint32 samplesToTarget[2];
+			for (uint32 channel = 0;
+				channel < 2;
+				channel++)
+			{
+				segment.volume[channel] = sound->currentVolume[channel];
+				segment.dVolume[channel] = sound->dCurrentVolume[channel] * secondsPerSample;
+				samplesToTarget[channel] = UINT32_MAX;
+				if (segment.dVolume[channel] != 0.0f)
+				{
+					real32 volumeLeft = sound->targetVolume[channel] - sound->currentVolume[channel];
+					real32 samples = volumeLeft / segment.dVolume[channel];
+					samplesToTarget[channel] = (samples > 0.0f) ? (uint32)ceilf(samples) : 0;
+					if (samplesToTarget[channel] < segmentCount)
+					{
+						segmentCount = samplesToTarget[channel];
+					}
+				}
+			}
+
+			segment.samples = source.samples;
+			segment.sampleCount = source.sampleCount;
+			segment.channelCount = source.channelCount;
+			segment.isLooping = sound->isLooping;
+			segment.firstIndex = (uint32)sound->samplesPlayed;
+			segment.firstFraction = (real32)(sound->samplesPlayed - (real64)segment.firstIndex);
+			segment.dSample = (real32)dSample;
+			kernel(left + samplesMixed, right + samplesMixed, segmentCount, &segment);
+
+			for (uint32 channel = 0;
+				channel < 2;
+				channel++)
+			{
+				if (samplesToTarget[channel] <= segmentCount)
+				{
+					sound->currentVolume[channel] = sound->targetVolume[channel];
+					sound->dCurrentVolume[channel] = 0.0f;
+				}
+				else
+				{
+					sound->currentVolume[channel] += segment.dVolume[channel] * (real32)segmentCount;
+				}
+			}
+
+			sound->samplesPlayed += (real64)segmentCount * dSample;
+			if (sound->samplesPlayed >= (real64)source.sampleCount)
+			{
+				if (sound->isLooping)
+				{
+					sound->samplesPlayed = fmod(sound->samplesPlayed, (real64)source.sampleCount);
+				}
+				else
+				{
+					isFinished = true;
+				}
+			}
+			samplesMixed += segmentCount;
+		}
+
+		if (isFinished)
+		{
+			*soundPointer = sound->next;
+			sound->next = audio->firstFreePlayingSound;
+			audio->firstFreePlayingSound = sound;
+			audio->playingSoundCount--;
+		}
+		else
+		{
+			soundPointer = &sound->next;
+		}
+	}
+}
+
+void outputPlayingSounds(audio_state* audio, game_sound_buffer* buffer,
+	void* mixMemory, uint64 mixMemorySize)
+{
+	// Two channels, whole oscillator blocks so that tones fit too
+	uint32 chunkSamples = (uint32)(mixMemorySize / (2 * sizeof(real32)));
+	chunkSamples -= chunkSamples % OSCILLATOR_BLOCK_SAMPLES;
+	real32* left = (real32*)mixMemory;
+	real32* right = left + chunkSamples;
+
+	mix_sound_segment* kernel = getMixSoundSegmentKernel();
+	int16* output = (int16*)buffer->samples;
+	uint32 samplesLeft = buffer->samplesToWrite;
+	while (samplesLeft > 0)
+	{
+		uint32 samples = (samplesLeft < chunkSamples) ? samplesLeft : chunkSamples;
+
+		// Tones clear the mix
+		renderOscillatorBank(&audio->tones, left, samples);
+		memcpy(right, left, samples * sizeof(real32));
+		mixPlayingSounds(kernel, audio, left, right, samples, buffer->samplesPerSecond);
+
+		// The only place where the mix is clipped
+		writeChannelsToStereo(left, right, output, samples);
+
+		output += 2 * samples;
+		samplesLeft -= samples;
+	}
+	buffer->runningSampleIndex += buffer->samplesToWrite;
+}
+
+// STREAMING
+
+internal uint32
+readLittleEndian32(uint8* bytes)
+{
+	return (uint32)bytes[0] | ((uint32)bytes[1] << 8) | ((uint32)bytes[2] << 16) | ((uint32)bytes[3] << 24);
+}
+
+internal uint16
+readLittleEndian16(uint8* bytes)
+{
+	return (uint16)(bytes[0] | (bytes[1] << 8));
+}
+
+internal void
+setStreamRead(sound_stream* stream, asset_load_request* read, uint64 offset, uint64 size, void* destination)
+{
+	read->fileName = stream->fileName;
+	read->sourceOffset = offset;
+	read->size = size;
+	read->destination = destination;
+	read->priority = SOUND_STREAM_PRIORITY;
+	read->sequence = 0;
+	read->state = AssetLoad_Unloaded;
+}
+
+// Reads that did not fit in the queue stay Unloaded and are tried again
+internal void
+queueStreamRead(game_memory* memory, asset_load_request* read)
+{
+	if (getAssetLoadState(read) == AssetLoad_Unloaded)
+	{
+		memory->queueAssetLoad(memory->assetQueue, read);
+	}
+}
+
+internal bool32
+isStreamReadDone(asset_load_request* read)
+{
+	uint32 state = getAssetLoadState(read);
+	return state == AssetLoad_Loaded || state == AssetLoad_Failed;
+}
+
+// Finds the format and where the samples are
+internal bool32
+parseWaveHeader(sound_stream* stream, uint32 headerSize)
+{
+	uint8* header = stream->header;
+	stream->channelCount = 0;
+	bool32 foundData = false;
+
+	uint32 at = 12;
+	while (at + 8 <= headerSize && !foundData)
+	{
+		uint32 chunkSize = readLittleEndian32(header + at + 4);
+		uint8* chunk = header + at + 8;
+		if (memcmp(header + at, "fmt ", 4) == 0)
+		{
+			if (chunkSize < 16 || at + 8 + 16 > headerSize)
+			{
+				break;
+			}
+			uint16 format = readLittleEndian16(chunk);
+			uint16 bitsPerSample = readLittleEndian16(chunk + 14);
+			if (format != 1 || bitsPerSample != 16)
+			{
+				printf("Only 16 bit PCM sounds can be streamed\n");
+				return false;
+			}
+			stream->channelCount = readLittleEndian16(chunk + 2);
+			stream->samplesPerSecond = readLittleEndian32(chunk + 4);
+		}
+		else if (memcmp(header + at, "data", 4) == 0)
+		{
+			stream->dataOffset = at + 8;
+			foundData = true;
+			if (stream->channelCount != 0)
+			{
+				stream->sampleCount = chunkSize / (2 * stream->channelCount);
+			}
+		}
+		// Chunks are padded to even size
+		at += 8 + ((chunkSize + 1) & ~1u);
+	}
+
+	return foundData
+		&& (stream->channelCount == 1 || stream->channelCount == 2)
+		&& stream->samplesPerSecond > 0
+		&& stream->sampleCount > 0;
+}
+
+// Slot must not have reads in flight
+internal void
+queueStreamChunk(game_memory* memory, sound_stream* stream, uint32 slot, uint64 trackChunk)
+{
+	sound_stream_chunk* chunk = stream->chunks + slot;
+	chunk->trackChunk = trackChunk;
+	chunk->readCount = 0;
+
+	uint32 sampleBytes = 2 * stream->channelCount;
+	uint8* destination = (uint8*)(stream->samples + (uint64)slot * SOUND_STREAM_CHUNK_SAMPLES * stream->channelCount);
+	// Plays silence until the read is done, and after the end of a track
+	memset(destination, 0, SOUND_STREAM_CHUNK_SAMPLES * sampleBytes);
+
+	uint64 first = trackChunk * SOUND_STREAM_CHUNK_SAMPLES;
+	if (stream->isLooping)
+	{
+		first %= stream->sampleCount;
+	}
+	uint64 samplesLeft = SOUND_STREAM_CHUNK_SAMPLES;
+	while (samplesLeft > 0 && first < stream->sampleCount && chunk->readCount < ArrayCount(chunk->reads))
+	{
+		uint64 samples = stream->sampleCount - first;
+		if (samples > samplesLeft)
+		{
+			samples = samplesLeft;
+		}
+		asset_load_request* read = chunk->reads + chunk->readCount++;
+		setStreamRead(stream, read, stream->dataOffset + first * sampleBytes, samples * sampleBytes, destination);
+		queueStreamRead(memory, read);
+
+		destination += samples * sampleBytes;
+		samplesLeft -= samples;
+		first = stream->isLooping ? 0 : stream->sampleCount;
+	}
+}
+
+void initializeSoundStream(sound_stream* stream, void* memory, const char* fileName, bool32 isLooping)
+{
+	strncpy(stream->fileName, fileName, sizeof(stream->fileName) - 1);
+	stream->fileName[sizeof(stream->fileName) - 1] = 0;
+	stream->isLooping = isLooping;
+	stream->state = SoundStream_ReadingRiff;
+	stream->header = (uint8*)memory;
+	stream->samples = (int16*)(stream->header + SOUND_STREAM_HEADER_BYTES);
+	stream->sound = NULL;
+	for (uint32 slot = 0; slot < SOUND_STREAM_CHUNKS; slot++)
+	{
+		stream->chunks[slot].readCount = 0;
+	}
+
+	// RIFF header first, it has the file size for the second read
+	setStreamRead(stream, &stream->headerRead, 0, 12, stream->header);
+}
+
+void updateSoundStream(game_memory* memory, audio_state* audio, sound_stream* stream)
+{
+	if (memory->assetQueue == NULL && stream->state != SoundStream_Failed)
+	{
+		printf("Can not stream %s without the I/O thread\n", stream->fileName);
+		stream->state = SoundStream_Failed;
+	}
+
+	if (stream->state == SoundStream_ReadingRiff || stream->state == SoundStream_ReadingHeader)
+	{
+		queueStreamRead(memory, &stream->headerRead);
+		uint32 readState = getAssetLoadState(&stream->headerRead);
+		if (readState == AssetLoad_Failed)
+		{
+			printf("Could not read %s\n", stream->fileName);
+			stream->state = SoundStream_Failed;
+		}
+		else if (readState == AssetLoad_Loaded && stream->state == SoundStream_ReadingRiff)
+		{
+			if (memcmp(stream->header, "RIFF", 4) != 0 || memcmp(stream->header + 8, "WAVE", 4) != 0)
+			{
+				printf("%s is not a .wav file\n", stream->fileName);
+				stream->state = SoundStream_Failed;
+			}
+			else
+			{
+				uint64 fileSize = (uint64)readLittleEndian32(stream->header + 4) + 8;
+				uint64 headerSize = (fileSize < SOUND_STREAM_HEADER_BYTES) ? fileSize : SOUND_STREAM_HEADER_BYTES;
+				setStreamRead(stream, &stream->headerRead, 0, headerSize, stream->header);
+				stream->state = SoundStream_ReadingHeader;
+			}
+		}
+		else if (readState == AssetLoad_Loaded)
+		{
+			if (!parseWaveHeader(stream, (uint32)stream->headerRead.size))
+			{
+				printf("Can not stream %s\n", stream->fileName);
+				stream->state = SoundStream_Failed;
+			}
+			else if (stream->isLooping && stream->sampleCount < SOUND_STREAM_CHUNK_SAMPLES)
+			{
+				// Would need more than two reads per chunk, load it whole instead
+				printf("%s is too short to stream\n", stream->fileName);
+				stream->state = SoundStream_Failed;
+			}
+			else
+			{
+				for (uint32 slot = 0; slot < SOUND_STREAM_CHUNKS; slot++)
+				{
+					queueStreamChunk(memory, stream, slot, slot);
+				}
+				stream->samplesPlayed = 0.0;
+				stream->ringSamplesPlayed = 0.0;
+				stream->state = SoundStream_Streaming;
+			}
+		}
+	}
+
+	if (stream->state != SoundStream_Streaming)
+	{
+		return;
+	}
+
+	for (uint32 slot = 0; slot < SOUND_STREAM_CHUNKS; slot++)
+	{
+		sound_stream_chunk* chunk = stream->chunks + slot;
+		for (uint32 readIndex = 0; readIndex < chunk->readCount; readIndex++)
+		{
+			queueStreamRead(memory, chunk->reads + readIndex);
+		}
+	}
+
+	uint32 ringSampleCount = SOUND_STREAM_CHUNKS * SOUND_STREAM_CHUNK_SAMPLES;
+	if (stream->sound == NULL)
+	{
+		sound_stream_chunk* first = stream->chunks;
+		bool32 isFirstLoaded = true;
+		for (uint32 readIndex = 0; readIndex < first->readCount; readIndex++)
+		{
+			isFirstLoaded &= isStreamReadDone(first->reads + readIndex);
+		}
+		if (isFirstLoaded)
+		{
+			// The mixer loops the ring, the track ends where the stream says
+			loaded_sound ring;
+			ring.samples = stream->samples;
+			ring.sampleCount = ringSampleCount;
+			ring.channelCount = stream->channelCount;
+			ring.samplesPerSecond = stream->samplesPerSecond;
+			stream->sound = playSound(audio, &ring, true);
+		}
+		return;
+	}
+
+	// Mixer has moved on since the last update, by less than the ring
+	real64 ringSamplesPlayed = stream->sound->samplesPlayed;
+	real64 samplesMoved = ringSamplesPlayed - stream->ringSamplesPlayed;
+	if (samplesMoved < 0.0)
+	{
+		samplesMoved += (real64)ringSampleCount;
+	}
+	stream->ringSamplesPlayed = ringSamplesPlayed;
+	stream->samplesPlayed += samplesMoved;
+
+	if (!stream->isLooping && stream->samplesPlayed >= (real64)stream->sampleCount)
+	{
+		stopSound(stream->sound, 0.0f);
+		stream->sound = NULL;
+		stream->state = SoundStream_Finished;
+		return;
+	}
+
+	// Chunks before the one that is playing are free for the ones after
+	uint64 playingChunk = (uint64)stream->samplesPlayed / SOUND_STREAM_CHUNK_SAMPLES;
+	for (uint32 slot = 0; slot < SOUND_STREAM_CHUNKS; slot++)
+	{
+		sound_stream_chunk* chunk = stream->chunks + slot;
+		bool32 isDone = true;
+		for (uint32 readIndex = 0; readIndex < chunk->readCount; readIndex++)
+		{
+			isDone &= isStreamReadDone(chunk->reads + readIndex);
+		}
+		if (chunk->trackChunk < playingChunk && isDone)
+		{
+			queueStreamChunk(memory, stream, slot, chunk->trackChunk + SOUND_STREAM_CHUNKS);
+		}
+	}
+}
@@ -0,0 +1,263 @@
+/* Game audio: oscillators and everything that makes samples */
+
+#ifndef HANDMADE_AUDIO_H
+#define HANDMADE_AUDIO_H
+
+#include "handmade.h"
+
+/*
+	Oscillators do not call sinf for every sample. A sine is a point going
+	around a circle, so a sample some steps later is the current (sin, cos)
+	pair rotated by that many phase steps. Each lane of a block keeps its
+	own pair and all lanes rotate by one block at a time, so a block is a
+	few multiplies and adds with no dependency between the lanes.
+
+	The rotation drifts slowly, so the pairs are pulled back to length one
+	every few blocks and restarted from the real phase on every render.
+
+	Samples are summed as real32 into a mix buffer and converted to
+	int16 at the end, so voices can be added without clipping in between.
+*/
+
+static const uint32 OSCILLATOR_BLOCK_SAMPLES = 16;
+static const uint32 OSCILLATOR_NORMALIZE_BLOCKS = 8;
+static const uint32 MAX_OSCILLATOR_VOICES = 64;
+
+// Rotations for one voice
+struct oscillator_steps
+{
+	real32 sines[OSCILLATOR_BLOCK_SAMPLES];		// sin(k * phaseStep)
+	real32 cosines[OSCILLATOR_BLOCK_SAMPLES];	// cos(k * phaseStep)
+	real32 blockSine;	// sin(OSCILLATOR_BLOCK_SAMPLES * phaseStep)
+	real32 blockCosine;
+	real32 amplitude;
+};
+
+// Adds blockCount * OSCILLATOR_BLOCK_SAMPLES samples of one voice to output.
+// sine and cosine are the phase of the first sample. All kernels give
+// exactly the same samples.
+#define OSCILLATOR_BLOCKS(name) void name(real32 *output, uint32 blockCount, oscillator_steps *steps, real32 sine, real32 cosine)
+typedef OSCILLATOR_BLOCKS(oscillator_blocks);
+OSCILLATOR_BLOCKS(oscillatorBlocksScalar);
+OSCILLATOR_BLOCKS(oscillatorBlocksSSE2);
+OSCILLATOR_BLOCKS(oscillatorBlocksAVX2);
+
+// Best kernel the cpu supports
+oscillator_blocks*
+getOscillatorBlocksKernel();
+
+struct oscillator_voice
+{
+	real32 phase;		// [0, 2PI)
+	real32 phaseStep;	// 2PI * hz / samplesPerSecond
+	real32 volume;		// in int16 units
+};
+
+struct oscillator_bank
+{
+	uint32 voiceCount;
+	oscillator_voice voices[MAX_OSCILLATOR_VOICES];
+};
+
+// Returns NULL when the bank is full
+oscillator_voice*
+addOscillatorVoice(oscillator_bank* bank, real32 hz, real32 samplesPerSecond, real32 volume);
+
+// Mix must have room for sampleCount rounded up to OSCILLATOR_BLOCK_SAMPLES.
+// Overwrites mix with the sum of all voices and advances their phases.
+void
+renderOscillatorBank(oscillator_bank* bank, real32* mix, uint32 sampleCount);
+
+void
+renderOscillatorBankWith(oscillator_blocks* kernel, oscillator_bank* bank, real32* mix, uint32 sampleCount);
+
+// Clamps to int16 and writes the same value to left and right
+void
+writeMixToStereo(real32* mix, int16* output, uint32 sampleCount);
+
+// Clamps to int16 and interleaves the channels
+void
+writeChannelsToStereo(real32* left, real32* right, int16* output, uint32 sampleCount);
+
+// MIXER
+/*
+	Playing sounds are mixed to two real32 channels in the scratch memory
+	the caller gives, and clipped to int16 only once at the end.
+
+	Volumes are in [0, 1] of the sound's own int16 samples. A volume change
+	ramps linearly over the fade time so that there is no click, and the
+	mixer splits the output at the sample where a ramp ends. Pitch changes
+	the playback rate, samples between source samples are interpolated
+	linearly.
+*/
+
+static const uint32 MAX_PLAYING_SOUNDS = 256;
+static const uint64 AUDIO_MIX_MEMORY_SIZE = SizeKiloBytes(256);
+
+// int16 samples, channels interleaved, like hha_sound
+struct loaded_sound
+{
+	int16* samples;
+	uint32 sampleCount; // per channel
+	uint32 channelCount;
+	uint32 samplesPerSecond;
+};
+
+struct playing_sound
+{
+	loaded_sound sound;
+	bool32 isLooping;
+	bool32 stopAtTarget; // Removed when the volume ramp ends
+
+	real64 samplesPlayed; // source samples, fraction is between two samples
+	real32 pitch;
+
+	real32 currentVolume[2];
+	real32 dCurrentVolume[2]; // per second
+	real32 targetVolume[2];
+
+	playing_sound* next;
+};
+
+struct audio_state
+{
+	playing_sound* firstPlayingSound;
+	playing_sound* firstFreePlayingSound;
+	uint32 playingSoundCount;
+	playing_sound sounds[MAX_PLAYING_SOUNDS];
+
+	// Mixed in under the sounds
+	oscillator_bank tones;
+};
+
+void
+initializeAudioState(audio_state* audio);
+
+// Starts at full volume, centered, normal pitch.
+// Returns NULL when all MAX_PLAYING_SOUNDS are playing.
+playing_sound*
+playSound(audio_state* audio, loaded_sound* sound, bool32 isLooping);
+
+// pan is from -1 (left) to 1 (right), equal power so that the sound
+// is as loud everywhere
+void
+changeVolume(playing_sound* sound, real32 fadeSeconds, real32 volume, real32 pan);
+
+// 1 is the sound's own rate, 2 an octave up
+void
+changePitch(playing_sound* sound, real32 pitch);
+
+// Fades out and then removes the sound
+void
+stopSound(playing_sound* sound, real32 fadeSeconds);
+
+// A piece of one playing sound, volume changes linearly through it
+struct sound_mix_segment
+{
+	int16* samples;
+	uint32 sampleCount;
+	uint32 channelCount;
+	bool32 isLooping;
+
+	uint32 firstIndex;		// source sample of the first output sample
+	real32 firstFraction;	// and how far it is towards the next one
+	real32 dSample;			// source samples per output sample
+
+	real32 volume[2];
+	real32 dVolume[2];		// per output sample
+};
+
+// Adds count output samples of the segment to left and right.
+// All kernels give exactly the same samples.
+#define MIX_SOUND_SEGMENT(name) void name(real32 *left, real32 *right, uint32 count, sound_mix_segment *segment)
+typedef MIX_SOUND_SEGMENT(mix_sound_segment);
+MIX_SOUND_SEGMENT(mixSoundSegmentScalar);
+MIX_SOUND_SEGMENT(mixSoundSegmentSSE2);
+MIX_SOUND_SEGMENT(mixSoundSegmentAVX2);
+
+mix_sound_segment*
+getMixSoundSegmentKernel();
+
+// Adds sampleCount samples of every playing sound to left and right,
+// advances them and removes the ones that finished
+void
+mixPlayingSounds(mix_sound_segment* kernel, audio_state* audio,
+	real32* left, real32* right, uint32 sampleCount, uint32 samplesPerSecond);
+
+// Tones and sounds to the stereo buffer, in pieces that fit the scratch memory
+void
+outputPlayingSounds(audio_state* audio, game_sound_buffer* buffer,
+	void* mixMemory, uint64 mixMemorySize);
+
+// STREAMING
+/*
+	Long tracks are not loaded whole. The platform's I/O thread reads the
+	file a chunk at a time to a small ring, and the ring plays as a looping
+	sound. Chunks the mixer has passed are read again with the next part
+	of the track, so there is always about a second read ahead of it.
+	Memory use is the same for a track of any length.
+
+	Only 16 bit PCM .wav, like the packer. The samples in the file are
+	what the mixer plays, so decoding is just the read.
+*/
+
+static const uint32 SOUND_STREAM_CHUNK_SAMPLES = 16384; // per channel
+static const uint32 SOUND_STREAM_CHUNKS = 4;
+static const uint32 SOUND_STREAM_HEADER_BYTES = 4096; // fmt and data chunks must start in this
+static const int32 SOUND_STREAM_PRIORITY = 1000; // before any other asset loads
+static const uint64 SOUND_STREAM_MEMORY_SIZE = SOUND_STREAM_HEADER_BYTES
+	+ SOUND_STREAM_CHUNKS * SOUND_STREAM_CHUNK_SAMPLES * 2 * sizeof(int16);
+
+enum sound_stream_state
+{
+	SoundStream_ReadingRiff,
+	SoundStream_ReadingHeader,
+	SoundStream_Streaming,
+	SoundStream_Finished,
+	SoundStream_Failed
+};
+
+struct sound_stream_chunk
+{
+	uint64 trackChunk; // which chunk of the track is in here
+	// Where a looping track ends, the chunk continues from the start
+	// of the track, which is a second read
+	uint32 readCount;
+	asset_load_request reads[2];
+};
+
+struct sound_stream
+{
+	// A copy, the I/O thread still reads it after the game code is reloaded
+	char fileName[256];
+	bool32 isLooping;
+	sound_stream_state state;
+
+	asset_load_request headerRead;
+	uint8* header; // SOUND_STREAM_HEADER_BYTES
+
+	uint64 dataOffset; // of the first sample in the file
+	uint64 sampleCount; // per channel
+	uint32 channelCount;
+	uint32 samplesPerSecond;
+
+	// SOUND_STREAM_CHUNKS chunks of SOUND_STREAM_CHUNK_SAMPLES, channels interleaved
+	int16* samples;
+	sound_stream_chunk chunks[SOUND_STREAM_CHUNKS];
+
+	// NULL until the first chunk is there
+	playing_sound* sound;
+	real64 ringSamplesPlayed; // sound->samplesPlayed at the last update
+	real64 samplesPlayed; // from the start of the track, loops keep counting
+};
+
+// Memory must be SOUND_STREAM_MEMORY_SIZE, reading starts on the first update
+void
+initializeSoundStream(sound_stream* stream, void* memory, const char* fileName, bool32 isLooping);
+
+// Call every frame. Queues the reads, starts the sound when the first
+// chunk is there and refills the chunks the mixer has passed.
+void
+updateSoundStream(game_memory* memory, audio_state* audio, sound_stream* stream);
+
+#endif
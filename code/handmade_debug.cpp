@@ -0,0 +1,337 @@
+/* Debug overlay: bitmap font text and frame history graphs */
+#include "handmade_debug.h"
+
+// One byte per row, bit 4 is the leftmost pixel
+global_variable uint8 debugFontGlyphs[64][DEBUG_GLYPH_HEIGHT] =
+{
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // ' '
+	{0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}, // '!'
+	{0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00}, // '"'
+	{0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A}, // '#'
+	{0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04}, // '$'
+	{0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}, // '%'
+	{0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D}, // '&'
+	{0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00}, // "'"
+	{0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, // '('
+	{0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, // ')'
+	{0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00}, // '*'
+	{0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00}, // '+'
+	{0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08}, // ','
+	{0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}, // '-'
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C}, // '.'
+	{0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}, // '/'
+	{0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, // '0'
+	{0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E}, // '1'
+	{0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, // '2'
+	{0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E}, // '3'
+	{0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, // '4'
+	{0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E}, // '5'
+	{0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, // '6'
+	{0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // '7'
+	{0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, // '8'
+	{0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}, // '9'
+	{0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00}, // ':'
+	{0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08}, // ';'
+	{0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}, // '<'
+	{0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00}, // '='
+	{0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}, // '>'
+	{0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04}, // '?'
+	{0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E}, // '@'
+	{0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, // 'A'
+	{0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E}, // 'B'
+	{0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}, // 'C'
+	{0x1E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1E}, // 'D'
+	{0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}, // 'E'
+	{0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10}, // 'F'
+	{0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}, // 'G'
+	{0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, // 'H'
+	{0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, // 'I'
+	{0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C}, // 'J'
+	{0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, // 'K'
+	{0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F}, // 'L'
+	{0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}, // 'M'
+	{0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, // 'N'
+	{0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // 'O'
+	{0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10}, // 'P'
+	{0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}, // 'Q'
+	{0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11}, // 'R'
+	{0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}, // 'S'
+	{0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // 'T'
+	{0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // 'U'
+	{0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04}, // 'V'
+	{0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}, // 'W'
+	{0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11}, // 'X'
+	{0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04}, // 'Y'
+	{0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F}, // 'Z'
+	{0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E}, // '['
+	{0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00}, // '\\'
+	{0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E}, // ']'
+	{0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00}, // '^'
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F}, // '_'
+};
+
+// TEXT
+
+void beginDebugText(debug_text* text)
+{
+	text->length = 0;
+	text->characters[0] = 0;
+}
+
+internal void
+appendDebugCharacter(debug_text* text, char c)
+{
+	// Leave room for the terminating zero
+	if (text->length + 1 < (int32)sizeof(text->characters))
+	{
+		text->characters[text->length++] = c;
+		text->characters[text->length] = 0;
+	}
+}
+
+void appendDebugText(debug_text* text, const char* string)
+{
+	for (const char* c = string; *c; c++)
+	{
+		appendDebugCharacter(text, *c);
+	}
+}
+
+void appendDebugUint(debug_text* text, uint64 value)
+{
+	// Digits come out last first
+	char digits[20];
+	int32 digitCount = 0;
+	do
+	{
+		digits[digitCount++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value > 0);
+
+	while (digitCount > 0)
+	{
+		appendDebugCharacter(text, digits[--digitCount]);
+	}
+}
+
+void appendDebugReal(debug_text* text, real32 value, int32 decimals)
+{
+	if (value < 0.0f)
+	{
+		appendDebugCharacter(text, '-');
+		value = -value;
+	}
+
+	uint64 scale = 1;
+	for (int32 i = 0; i < decimals; i++)
+	{
+		scale *= 10;
+	}
+	uint64 scaled = (uint64)((real64)value * (real64)scale + 0.5);
+
+	appendDebugUint(text, scaled / scale);
+	if (decimals > 0)
+	{
+		appendDebugCharacter(text, '.');
+		uint64 fraction = scaled % scale;
+		for (uint64 divisor = scale / 10; divisor > 0; divisor /= 10)
+		{
+			appendDebugCharacter(text, (char)('0' + (fraction / divisor) % 10));
+		}
+	}
+}
+
+internal void
+plotDebugBlock(game_pixel_buffer* buffer, int32 x, int32 y, int32 size, uint32 color)
+{
+	for (int32 py = y; py < y + size; py++)
+	{
+		if (py < 0 || py >= buffer->bitmapHeight)
+		{
+			continue;
+		}
+		uint32* row = (uint32*)((uint8*)buffer->texturePixels + py * buffer->texturePitch);
+		for (int32 px = x; px < x + size; px++)
+		{
+			if (px >= 0 && px < buffer->bitmapWidth)
+			{
+				row[px] = color;
+			}
+		}
+	}
+}
+
+int32 drawDebugText(game_pixel_buffer* buffer, int32 x, int32 y, const char* text, uint32 color, int32 maxX)
+{
+	for (const char* c = text; *c && x + DEBUG_GLYPH_WIDTH * DEBUG_TEXT_SCALE <= maxX; c++)
+	{
+		int32 character = *c;
+		if (character >= 'a' && character <= 'z')
+		{
+			character -= 'a' - 'A';
+		}
+		if (character >= 32 && character < 32 + (int32)ArrayCount(debugFontGlyphs))
+		{
+			uint8* glyph = debugFontGlyphs[character - 32];
+			for (int32 row = 0; row < DEBUG_GLYPH_HEIGHT; row++)
+			{
+				for (int32 column = 0; column < DEBUG_GLYPH_WIDTH; column++)
+				{
+					if (glyph[row] & (1 << (DEBUG_GLYPH_WIDTH - 1 - column)))
+					{
+						plotDebugBlock(buffer, x + column * DEBUG_TEXT_SCALE,
+							y + row * DEBUG_TEXT_SCALE, DEBUG_TEXT_SCALE, color);
+					}
+				}
+			}
+		}
+		x += (DEBUG_GLYPH_WIDTH + 1) * DEBUG_TEXT_SCALE;
+	}
+	return x;
+}
+
+// FRAME HISTORY
+
+void recordDebugFrame(debug_overlay* overlay, debug_frame_record* record)
+{
+	overlay->history[overlay->nextRecordIndex] = *record;
+	overlay->nextRecordIndex = (overlay->nextRecordIndex + 1) % DEBUG_HISTORY_LENGTH;
+	if (overlay->recordCount < DEBUG_HISTORY_LENGTH)
+	{
+		overlay->recordCount++;
+	}
+}
+
+internal real32
+getRecordValue(debug_frame_record* record, int32 graphIndex)
+{
+	real32 result = record->msPerFrame;
+	if (graphIndex == 1)
+	{
+		result = record->megaCyclesPerFrame;
+	}
+	else if (graphIndex == 2)
+	{
+		result = record->audioLatencyMs;
+	}
+	return result;
+}
+
+game_rect drawDebugOverlay(debug_overlay* overlay, game_pixel_buffer* buffer, int32 x, int32 y)
+{
+	game_rect area = {x, y, x, y};
+	if (buffer->texturePixels == NULL || overlay->recordCount == 0)
+	{
+		return area;
+	}
+
+	uint32 backgroundColor = 0xFF202020;
+	uint32 textColor = 0xFFFFFFFF;
+	uint32 barColor = 0xFF40C040;
+	uint32 slowBarColor = 0xFFE04040;
+	uint32 targetColor = 0xFFFFFF00;
+
+	const char* graphNames[DEBUG_OVERLAY_GRAPH_COUNT] = {"ms/f ", "Mcy/f ", "audio ms "};
+	int32 graphWidth = DEBUG_HISTORY_LENGTH * DEBUG_BAR_WIDTH;
+
+	area.maxX = x + DEBUG_OVERLAY_WIDTH;
+	area.maxY = y + DEBUG_OVERLAY_HEIGHT;
+	fillRectangle(buffer, area.minX, area.minY, area.maxX, area.maxY, backgroundColor);
+
+	int32 newestIndex = (overlay->nextRecordIndex + DEBUG_HISTORY_LENGTH - 1) % DEBUG_HISTORY_LENGTH;
+	debug_frame_record* newest = overlay->history + newestIndex;
+	int32 oldestIndex = (overlay->nextRecordIndex + DEBUG_HISTORY_LENGTH - overlay->recordCount) % DEBUG_HISTORY_LENGTH;
+
+	int32 left = x + DEBUG_PADDING;
+	int32 right = area.maxX - DEBUG_PADDING;
+	int32 top = y + DEBUG_PADDING;
+
+	// Stage times of the newest frame on the first line
+	debug_text text;
+	beginDebugText(&text);
+	appendDebugText(&text, "in ");
+	appendDebugReal(&text, newest->inputMs, 1);
+	appendDebugText(&text, " sim ");
+	appendDebugReal(&text, newest->simulateMs, 1);
+	appendDebugText(&text, " upl ");
+	appendDebugReal(&text, newest->uploadMs, 1);
+	appendDebugText(&text, " wait ");
+	appendDebugReal(&text, newest->waitMs, 1);
+	appendDebugText(&text, " pre ");
+	appendDebugReal(&text, newest->presentMs, 1);
+	drawDebugText(buffer, left, top, text.characters, textColor, right);
+	top += DEBUG_LINE_HEIGHT;
+
+	for (int32 graphIndex = 0; graphIndex < DEBUG_OVERLAY_GRAPH_COUNT; graphIndex++)
+	{
+		// Frame time is scaled so that the target is in the middle,
+		// others to the largest value in the history
+		real32 maxValue = 2.0f * overlay->targetMsPerFrame;
+		if (graphIndex != 0 || maxValue <= 0.0f)
+		{
+			maxValue = 0.0f;
+			for (int32 i = 0; i < overlay->recordCount; i++)
+			{
+				real32 value = getRecordValue(overlay->history + i, graphIndex);
+				if (value > maxValue)
+				{
+					maxValue = value;
+				}
+			}
+		}
+
+		beginDebugText(&text);
+		appendDebugText(&text, graphNames[graphIndex]);
+		appendDebugReal(&text, getRecordValue(newest, graphIndex), 2);
+		if (graphIndex == 0)
+		{
+			appendDebugText(&text, " target ");
+			appendDebugReal(&text, overlay->targetMsPerFrame, 2);
+		}
+		else if (graphIndex == 2)
+		{
+			// Line is too short for the max too
+			appendDebugText(&text, " safe ");
+			appendDebugReal(&text, newest->audioSafetyMs, 2);
+			appendDebugText(&text, " xrun ");
+			appendDebugUint(&text, newest->audioUnderrunCount);
+		}
+		else
+		{
+			appendDebugText(&text, " max ");
+			appendDebugReal(&text, maxValue, 2);
+		}
+		drawDebugText(buffer, left, top, text.characters, textColor, right);
+		top += DEBUG_LINE_HEIGHT;
+
+		int32 bottom = top + DEBUG_GRAPH_HEIGHT;
+		for (int32 i = 0; i < overlay->recordCount; i++)
+		{
+			// Oldest on the left
+			debug_frame_record* record = overlay->history + (oldestIndex + i) % DEBUG_HISTORY_LENGTH;
+			real32 value = getRecordValue(record, graphIndex);
+			int32 barHeight = DEBUG_GRAPH_HEIGHT;
+			if (maxValue > 0.0f && value < maxValue)
+			{
+				barHeight = (int32)((value / maxValue) * (real32)DEBUG_GRAPH_HEIGHT);
+			}
+
+			uint32 color = barColor;
+			if (graphIndex == 0 && record->msPerFrame > overlay->targetMsPerFrame * 1.05f)
+			{
+				color = slowBarColor;
+			}
+			int32 barX = left + i * DEBUG_BAR_WIDTH;
+			fillRectangle(buffer, barX, bottom - barHeight, barX + DEBUG_BAR_WIDTH, bottom, color);
+		}
+
+		if (graphIndex == 0)
+		{
+			int32 targetY = bottom - DEBUG_GRAPH_HEIGHT / 2;
+			fillRectangle(buffer, left, targetY, left + graphWidth, targetY + 1, targetColor);
+		}
+		top = bottom + DEBUG_PADDING;
+	}
+
+	return area;
+}
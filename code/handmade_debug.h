@@ -0,0 +1,89 @@
+/* Debug overlay: bitmap font text and frame history graphs */
+
+#ifndef HANDMADE_DEBUG_H
+#define HANDMADE_DEBUG_H
+
+#include "handmade.h"
+
+/*
+	Everything here draws straight into a game_pixel_buffer.
+	Nothing allocates or calls the OS, so the overlay can be drawn every
+	frame without disturbing the timing it shows.
+*/
+
+// Font has 5x7 glyphs for ASCII 32-95, lower case is drawn as upper case
+static const int32 DEBUG_GLYPH_WIDTH = 5;
+static const int32 DEBUG_GLYPH_HEIGHT = 7;
+static const int32 DEBUG_TEXT_SCALE = 2;
+static const int32 DEBUG_LINE_HEIGHT = (DEBUG_GLYPH_HEIGHT + 2) * DEBUG_TEXT_SCALE;
+
+// Text is built in a fixed buffer instead of with snprintf
+struct debug_text
+{
+	char characters[128];
+	int32 length;
+};
+
+void
+beginDebugText(debug_text* text);
+
+void
+appendDebugText(debug_text* text, const char* string);
+
+void
+appendDebugUint(debug_text* text, uint64 value);
+
+void
+appendDebugReal(debug_text* text, real32 value, int32 decimals);
+
+// Glyphs that would cross maxX are not drawn. Returns x after the last glyph.
+int32
+drawDebugText(game_pixel_buffer* buffer, int32 x, int32 y, const char* text, uint32 color, int32 maxX);
+
+// FRAME HISTORY
+
+static const int32 DEBUG_HISTORY_LENGTH = 120;
+
+struct debug_frame_record
+{
+	real32 msPerFrame;
+	real32 megaCyclesPerFrame;
+	real32 audioLatencyMs;
+	real32 audioSafetyMs;
+	uint32 audioUnderrunCount;
+
+	// Where the frame time went
+	real32 inputMs;
+	real32 simulateMs;
+	real32 uploadMs;
+	real32 waitMs;
+	real32 presentMs;
+};
+
+struct debug_overlay
+{
+	debug_frame_record history[DEBUG_HISTORY_LENGTH];
+	int32 nextRecordIndex;
+	int32 recordCount;
+	real32 targetMsPerFrame;
+};
+
+void
+recordDebugFrame(debug_overlay* overlay, debug_frame_record* record);
+
+static const int32 DEBUG_GRAPH_HEIGHT = 32;
+static const int32 DEBUG_BAR_WIDTH = 4;
+static const int32 DEBUG_PADDING = 4;
+static const int32 DEBUG_OVERLAY_GRAPH_COUNT = 3; // ms, cycles and audio latency
+
+// Size of what drawDebugOverlay draws
+static const int32 DEBUG_OVERLAY_WIDTH = DEBUG_HISTORY_LENGTH * DEBUG_BAR_WIDTH + 2 * DEBUG_PADDING;
+static const int32 DEBUG_OVERLAY_HEIGHT = DEBUG_PADDING + DEBUG_LINE_HEIGHT
+	+ DEBUG_OVERLAY_GRAPH_COUNT * (DEBUG_LINE_HEIGHT + DEBUG_GRAPH_HEIGHT + DEBUG_PADDING);
+
+// Draws the newest values and a graph of each. Returns the area drawn
+// over so that the caller can add it to the dirty rects.
+game_rect
+drawDebugOverlay(debug_overlay* overlay, game_pixel_buffer* buffer, int32 x, int32 y);
+
+#endif
@@ -0,0 +1,329 @@
+/* Asset packer tool: converts source files to one packed asset archive
+
+	Usage: handmade_packer <output.hha> [<type> <name> <file>]...
+	type is one of
+		bitmap	uncompressed 24 or 32 bit .bmp
+		sound	16 bit PCM .wav
+		font	.bmp of ASCII 32-127, 16 glyphs on each of 6 rows
+
+	The game finds the assets by type and name.
+*/
+#include "handmade_asset.h"
+
+#include <stdlib.h>
+
+struct source_file
+{
+	uint8* contents;
+	uint32 size;
+};
+
+internal source_file
+readSourceFile(const char* fileName)
+{
+	source_file result = {};
+	FILE* file = fopen(fileName, "rb");
+	if (file == NULL)
+	{
+		printf("Could not open %s\n", fileName);
+		return result;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (size > 0)
+	{
+		result.contents = (uint8*)malloc(size);
+		if (result.contents && fread(result.contents, 1, size, file) == (size_t)size)
+		{
+			result.size = (uint32)size;
+		}
+		else
+		{
+			free(result.contents);
+			result.contents = NULL;
+		}
+	}
+	fclose(file);
+	return result;
+}
+
+// Files are little endian and not aligned, so read them byte by byte
+internal uint16
+readUint16(uint8* at)
+{
+	return (uint16)(at[0] | (at[1] << 8));
+}
+
+internal uint32
+readUint32(uint8* at)
+{
+	return (uint32)at[0] | ((uint32)at[1] << 8) | ((uint32)at[2] << 16) | ((uint32)at[3] << 24);
+}
+
+internal uint32
+maskShift(uint32 mask)
+{
+	uint32 shift = 0;
+	while (mask && (mask & 1) == 0)
+	{
+		mask >>= 1;
+		shift++;
+	}
+	return shift;
+}
+
+// Converts to 0xAARRGGBB pixels, top row first
+internal bool32
+loadBMP(source_file& file, asset_source* source)
+{
+	if (file.size < 54 || file.contents[0] != 'B' || file.contents[1] != 'M')
+	{
+		return false;
+	}
+
+	uint32 pixelOffset = readUint32(file.contents + 10);
+	uint32 headerSize = readUint32(file.contents + 14);
+	int32 width = (int32)readUint32(file.contents + 18);
+	int32 height = (int32)readUint32(file.contents + 22);
+	uint16 bitsPerPixel = readUint16(file.contents + 28);
+	uint32 compression = readUint32(file.contents + 30);
+
+	// Negative height means rows are already top to bottom
+	bool32 topDown = height < 0;
+	if (topDown)
+	{
+		height = -height;
+	}
+
+	uint32 redMask = 0x00FF0000;
+	uint32 greenMask = 0x0000FF00;
+	uint32 blueMask = 0x000000FF;
+	uint32 alphaMask = 0;
+	if (compression == 3 && bitsPerPixel == 32 && file.size >= 14 + 40 + 12)
+	{
+		// BI_BITFIELDS, masks follow the 40 byte header
+		redMask = readUint32(file.contents + 54);
+		greenMask = readUint32(file.contents + 58);
+		blueMask = readUint32(file.contents + 62);
+		if (headerSize >= 56)
+		{
+			alphaMask = readUint32(file.contents + 66);
+		}
+	}
+	else if (compression != 0 || (bitsPerPixel != 24 && bitsPerPixel != 32))
+	{
+		printf("Only uncompressed 24 and 32 bit bitmaps are supported\n");
+		return false;
+	}
+
+	uint32 bytesPerPixel = bitsPerPixel / 8;
+	// Rows are padded to 4 bytes
+	uint32 sourcePitch = (width * bytesPerPixel + 3) & ~3;
+	if (width <= 0 || pixelOffset + (uint64)sourcePitch * height > file.size)
+	{
+		printf("Bitmap is truncated\n");
+		return false;
+	}
+
+	uint32* pixels = (uint32*)malloc((uint64)width * height * 4);
+	if (pixels == NULL)
+	{
+		return false;
+	}
+
+	uint32 redShift = maskShift(redMask);
+	uint32 greenShift = maskShift(greenMask);
+	uint32 blueShift = maskShift(blueMask);
+	uint32 alphaShift = maskShift(alphaMask);
+
+	uint32* dest = pixels;
+	for (int32 y = 0; y < height; y++)
+	{
+		int32 sourceY = topDown ? y : (height - 1 - y);
+		uint8* sourceRow = file.contents + pixelOffset + sourceY * sourcePitch;
+		for (int32 x = 0; x < width; x++)
+		{
+			uint8* source = sourceRow + x * bytesPerPixel;
+			uint32 value = (bytesPerPixel == 4) ? readUint32(source)
+				: (uint32)(source[0] | (source[1] << 8) | (source[2] << 16));
+
+			uint32 red = (value & redMask) >> redShift;
+			uint32 green = (value & greenMask) >> greenShift;
+			uint32 blue = (value & blueMask) >> blueShift;
+			uint32 alpha = alphaMask ? ((value & alphaMask) >> alphaShift) : 0xFF;
+			*dest++ = (alpha << 24) | (red << 16) | (green << 8) | blue;
+		}
+	}
+
+	source->data = pixels;
+	source->info.type = AssetType_Bitmap;
+	source->info.dataSize = (uint64)width * height * 4;
+	source->info.bitmap.width = width;
+	source->info.bitmap.height = height;
+	return true;
+}
+
+internal bool32
+loadWAV(source_file& file, asset_source* source)
+{
+	if (file.size < 12
+		|| readUint32(file.contents) != HHA_CODE('R', 'I', 'F', 'F')
+		|| readUint32(file.contents + 8) != HHA_CODE('W', 'A', 'V', 'E'))
+	{
+		return false;
+	}
+
+	uint32 channelCount = 0;
+	uint32 samplesPerSecond = 0;
+	uint8* samples = NULL;
+	uint32 sampleBytes = 0;
+
+	uint32 at = 12;
+	while (at + 8 <= file.size)
+	{
+		uint32 chunkId = readUint32(file.contents + at);
+		uint32 chunkSize = readUint32(file.contents + at + 4);
+		uint8* chunk = file.contents + at + 8;
+		if (chunkSize > file.size - at - 8)
+		{
+			break;
+		}
+
+		if (chunkId == HHA_CODE('f', 'm', 't', ' ') && chunkSize >= 16)
+		{
+			uint16 format = readUint16(chunk);
+			channelCount = readUint16(chunk + 2);
+			samplesPerSecond = readUint32(chunk + 4);
+			uint16 bitsPerSample = readUint16(chunk + 14);
+			if (format != 1 || bitsPerSample != 16)
+			{
+				printf("Only 16 bit PCM sounds are supported\n");
+				return false;
+			}
+		}
+		else if (chunkId == HHA_CODE('d', 'a', 't', 'a'))
+		{
+			samples = chunk;
+			sampleBytes = chunkSize;
+		}
+		// Chunks are padded to even size
+		at += 8 + ((chunkSize + 1) & ~1);
+	}
+
+	if (channelCount == 0 || samples == NULL)
+	{
+		return false;
+	}
+
+	source->data = samples;
+	source->info.type = AssetType_Sound;
+	source->info.dataSize = sampleBytes;
+	source->info.sound.channelCount = channelCount;
+	source->info.sound.samplesPerSecond = samplesPerSecond;
+	source->info.sound.sampleCount = sampleBytes / (2 * channelCount);
+	return true;
+}
+
+internal bool32
+loadFont(source_file& file, asset_source* source)
+{
+	if (!loadBMP(file, source))
+	{
+		return false;
+	}
+
+	uint32 rowCount = 6;
+	hha_bitmap atlas = source->info.bitmap;
+	if (atlas.width % HHA_FONT_GLYPHS_PER_ROW != 0 || atlas.height % rowCount != 0)
+	{
+		printf("Font bitmap must be %u glyphs wide and %u glyphs high\n",
+			HHA_FONT_GLYPHS_PER_ROW, rowCount);
+		return false;
+	}
+
+	source->info.type = AssetType_Font;
+	source->info.font.firstCodepoint = 32;
+	source->info.font.glyphCount = HHA_FONT_GLYPHS_PER_ROW * rowCount;
+	source->info.font.glyphWidth = atlas.width / HHA_FONT_GLYPHS_PER_ROW;
+	source->info.font.glyphHeight = atlas.height / rowCount;
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2 || (argc - 2) % 3 != 0)
+	{
+		printf("Usage: %s <output.hha> [<bitmap|sound|font> <name> <file>]...\n", argv[0]);
+		return 1;
+	}
+
+	const char* outputName = argv[1];
+	uint32 sourceCount = (argc - 2) / 3;
+	asset_source* sources = (asset_source*)calloc(sourceCount + 1, sizeof(asset_source));
+
+	for (uint32 sourceIndex = 0;
+		sourceIndex < sourceCount;
+		sourceIndex++)
+	{
+		const char* typeName = argv[2 + sourceIndex * 3];
+		const char* name = argv[3 + sourceIndex * 3];
+		const char* fileName = argv[4 + sourceIndex * 3];
+
+		asset_source* source = sources + sourceIndex;
+		source->name = name;
+
+		// Source files stay in memory until the archive is written,
+		// sounds point straight into them
+		source_file file = readSourceFile(fileName);
+		bool32 loaded = false;
+		if (file.contents)
+		{
+			if (strcmp(typeName, "bitmap") == 0)
+			{
+				loaded = loadBMP(file, source);
+			}
+			else if (strcmp(typeName, "sound") == 0)
+			{
+				loaded = loadWAV(file, source);
+			}
+			else if (strcmp(typeName, "font") == 0)
+			{
+				loaded = loadFont(file, source);
+			}
+			else
+			{
+				printf("Unknown asset type %s\n", typeName);
+			}
+		}
+
+		if (!loaded)
+		{
+			printf("Could not load %s %s from %s\n", typeName, name, fileName);
+			return 1;
+		}
+		printf("%s %s: %lu bytes\n", typeName, name, (unsigned long)source->info.dataSize);
+	}
+
+	uint64 archiveSize = getAssetArchiveSize(sources, sourceCount);
+	void* archive = malloc(archiveSize);
+	if (archive == NULL || !packAssetArchive(sources, sourceCount, archive, archiveSize))
+	{
+		printf("Could not pack the assets\n");
+		return 1;
+	}
+
+	FILE* output = fopen(outputName, "wb");
+	if (output == NULL || fwrite(archive, 1, archiveSize, output) != archiveSize)
+	{
+		printf("Could not write %s\n", outputName);
+		return 1;
+	}
+	fclose(output);
+
+	printf("Wrote %u assets, %lu bytes to %s\n", sourceCount, (unsigned long)archiveSize, outputName);
+
+	// Tool exits here, the OS frees the rest
+	return 0;
+}
@@ -0,0 +1,443 @@
+/* Render group: push buffer of render commands and the renderer for it */
+#include "handmade_render_group.h"
+
+render_group* allocateRenderGroup(void* memory, uint32 memorySize)
+{
+	hm_assert(memorySize > sizeof(render_group));
+
+	render_group* group = (render_group*)memory;
+	group->pushBufferBase = (uint8*)memory + sizeof(render_group);
+	group->maxPushBufferSize = memorySize - sizeof(render_group);
+	clearRenderGroup(group);
+	group->lastFrameHash = 0;
+	group->lastFramePushBufferSize = 0;
+	group->lastFrameWidth = 0;
+	group->lastFrameHeight = 0;
+	group->lastFrameRectCount = 0;
+
+	return group;
+}
+
+void clearRenderGroup(render_group* group)
+{
+	group->pushBufferSize = 0;
+	group->entryCount = 0;
+	group->firstVisibleEntryOffset = 0;
+}
+
+// Returns pointer to the entry after the header, or NULL when the buffer is full
+internal void*
+pushRenderEntry(render_group* group, render_entry_type type, uint32 entrySize)
+{
+	void* result = NULL;
+	// Keep every header and entry 8 byte aligned, entries can have pointers
+	uint32 sizeBytes = (sizeof(render_entry_header) + entrySize + 7) & ~7;
+	if (group->pushBufferSize + sizeBytes <= group->maxPushBufferSize)
+	{
+		render_entry_header* header = (render_entry_header*)(group->pushBufferBase + group->pushBufferSize);
+		header->type = type;
+		header->sizeBytes = sizeBytes;
+		result = header + 1;
+
+		group->pushBufferSize += sizeBytes;
+		group->entryCount++;
+	}
+	else
+	{
+		hm_assert(!"Render group push buffer is full");
+	}
+	return result;
+}
+
+#define PushRenderEntry(group, type, entryType) (type*)pushRenderEntry(group, entryType, sizeof(type))
+
+void pushClear(render_group* group, uint32 color)
+{
+	uint32 entryOffset = group->pushBufferSize;
+	render_entry_clear* entry = PushRenderEntry(group, render_entry_clear, RenderEntryType_Clear);
+	if (entry)
+	{
+		entry->color = color;
+		group->firstVisibleEntryOffset = entryOffset;
+	}
+}
+
+void pushRectangle(render_group* group, int32 minX, int32 minY, int32 maxX, int32 maxY, uint32 color)
+{
+	render_entry_rectangle* entry = PushRenderEntry(group, render_entry_rectangle, RenderEntryType_Rectangle);
+	if (entry)
+	{
+		entry->minX = minX;
+		entry->minY = minY;
+		entry->maxX = maxX;
+		entry->maxY = maxY;
+		entry->color = color;
+	}
+}
+
+void pushBitmap(render_group* group, loaded_bitmap* bitmap, int32 x, int32 y)
+{
+	render_entry_bitmap* entry = PushRenderEntry(group, render_entry_bitmap, RenderEntryType_Bitmap);
+	if (entry)
+	{
+		entry->bitmap = bitmap;
+		entry->x = x;
+		entry->y = y;
+	}
+}
+
+void pushLine(render_group* group, int32 x0, int32 y0, int32 x1, int32 y1, uint32 color)
+{
+	render_entry_line* entry = PushRenderEntry(group, render_entry_line, RenderEntryType_Line);
+	if (entry)
+	{
+		entry->x0 = x0;
+		entry->y0 = y0;
+		entry->x1 = x1;
+		entry->y1 = y1;
+		entry->color = color;
+	}
+}
+
+void pushWeirdGradient(render_group* group, int32 xOffset, int32 yOffset)
+{
+	render_entry_weird_gradient* entry = PushRenderEntry(group, render_entry_weird_gradient, RenderEntryType_WeirdGradient);
+	if (entry)
+	{
+		entry->xOffset = xOffset;
+		entry->yOffset = yOffset;
+	}
+}
+
+// RENDERER
+// Everything below draws into one tile. Coordinates are for the whole
+// buffer and tileMinY moves them to the tile.
+
+internal inline int32
+clampInt32(int32 min, int32 value, int32 max)
+{
+	int32 result = value;
+	if (result < min)
+	{
+		result = min;
+	}
+	else if (result > max)
+	{
+		result = max;
+	}
+	return result;
+}
+
+internal void
+drawRectangle(game_pixel_buffer* tile, int32 tileMinY,
+	int32 minX, int32 minY, int32 maxX, int32 maxY, uint32 color)
+{
+	// Clamp to the tile first so that the size tells if streaming pays off
+	minX = clampInt32(0, minX, tile->bitmapWidth);
+	maxX = clampInt32(0, maxX, tile->bitmapWidth);
+	minY = clampInt32(0, minY - tileMinY, tile->bitmapHeight);
+	maxY = clampInt32(0, maxY - tileMinY, tile->bitmapHeight);
+
+	fillRectangle(tile, minX, minY, maxX, maxY, color);
+}
+
+internal void
+drawBitmap(game_pixel_buffer* tile, int32 tileMinY, loaded_bitmap* bitmap, int32 x, int32 y)
+{
+	// Opaque copy, no blending yet
+	int32 minX = clampInt32(0, x, tile->bitmapWidth);
+	int32 maxX = clampInt32(0, x + bitmap->width, tile->bitmapWidth);
+	int32 minY = clampInt32(0, y - tileMinY, tile->bitmapHeight);
+	int32 maxY = clampInt32(0, y + bitmap->height - tileMinY, tile->bitmapHeight);
+	if (minX >= maxX || minY >= maxY)
+	{
+		return;
+	}
+
+	int32 sourceX = minX - x;
+	int32 sourceY = minY + tileMinY - y;
+	uint8* sourceRow = (uint8*)bitmap->memory + sourceY * bitmap->pitch + sourceX * 4;
+	uint8* destRow = (uint8*)tile->texturePixels + minY * tile->texturePitch + minX * 4;
+	for (int32 row = minY;
+		row < maxY;
+		row++)
+	{
+		memcpy(destRow, sourceRow, (maxX - minX) * 4);
+		sourceRow += bitmap->pitch;
+		destRow += tile->texturePitch;
+	}
+}
+
+internal void
+drawLine(game_pixel_buffer* tile, int32 tileMinY,
+	int32 x0, int32 y0, int32 x1, int32 y1, uint32 color)
+{
+	// Bresenham, every point is checked against the tile
+	// This is for debug drawing so it does not need to be fast
+	int32 dx = (x1 > x0) ? (x1 - x0) : (x0 - x1);
+	int32 dy = (y1 > y0) ? (y0 - y1) : (y1 - y0);
+	int32 stepX = (x0 < x1) ? 1 : -1;
+	int32 stepY = (y0 < y1) ? 1 : -1;
+	int32 error = dx + dy;
+
+	int32 tileMaxY = tileMinY + tile->bitmapHeight;
+	for (;;)
+	{
+		if (x0 >= 0 && x0 < tile->bitmapWidth
+			&& y0 >= tileMinY && y0 < tileMaxY)
+		{
+			uint8* row = (uint8*)tile->texturePixels + (y0 - tileMinY) * tile->texturePitch;
+			((uint32*)row)[x0] = color;
+		}
+
+		if (x0 == x1 && y0 == y1)
+		{
+			break;
+		}
+		int32 error2 = 2 * error;
+		if (error2 >= dy)
+		{
+			error += dy;
+			x0 += stepX;
+		}
+		if (error2 <= dx)
+		{
+			error += dx;
+			y0 += stepY;
+		}
+	}
+}
+
+RENDER_TILE(renderGroupTile)
+{
+	render_group* group = (render_group*)context;
+
+	for (uint32 baseAddress = group->firstVisibleEntryOffset;
+		baseAddress < group->pushBufferSize;
+		)
+	{
+		render_entry_header* header = (render_entry_header*)(group->pushBufferBase + baseAddress);
+		void* data = header + 1;
+		switch (header->type)
+		{
+			case RenderEntryType_Clear:
+			{
+				render_entry_clear* entry = (render_entry_clear*)data;
+				drawRectangle(tile, tileMinY, 0, tileMinY,
+					tile->bitmapWidth, tileMinY + tile->bitmapHeight, entry->color);
+			} break;
+
+			case RenderEntryType_Rectangle:
+			{
+				render_entry_rectangle* entry = (render_entry_rectangle*)data;
+				drawRectangle(tile, tileMinY, entry->minX, entry->minY,
+					entry->maxX, entry->maxY, entry->color);
+			} break;
+
+			case RenderEntryType_Bitmap:
+			{
+				render_entry_bitmap* entry = (render_entry_bitmap*)data;
+				drawBitmap(tile, tileMinY, entry->bitmap, entry->x, entry->y);
+			} break;
+
+			case RenderEntryType_Line:
+			{
+				render_entry_line* entry = (render_entry_line*)data;
+				drawLine(tile, tileMinY, entry->x0, entry->y0,
+					entry->x1, entry->y1, entry->color);
+			} break;
+
+			case RenderEntryType_WeirdGradient:
+			{
+				render_entry_weird_gradient* entry = (render_entry_weird_gradient*)data;
+				renderWeirdGradient(tile, entry->xOffset, entry->yOffset + tileMinY);
+			} break;
+
+			default:
+			{
+				hm_assert(!"Unknown render entry type");
+			} break;
+		}
+
+		baseAddress += header->sizeBytes;
+	}
+}
+
+// DIRTY RECTANGLES
+
+internal inline game_rect
+makeRect(int32 minX, int32 minY, int32 maxX, int32 maxY)
+{
+	game_rect result = {minX, minY, maxX, maxY};
+	return result;
+}
+
+internal inline bool32
+rectsOverlap(game_rect a, game_rect b)
+{
+	return (a.minX < b.maxX && b.minX < a.maxX
+		&& a.minY < b.maxY && b.minY < a.maxY);
+}
+
+internal inline game_rect
+rectUnion(game_rect a, game_rect b)
+{
+	game_rect result;
+	result.minX = (a.minX < b.minX) ? a.minX : b.minX;
+	result.minY = (a.minY < b.minY) ? a.minY : b.minY;
+	result.maxX = (a.maxX > b.maxX) ? a.maxX : b.maxX;
+	result.maxY = (a.maxY > b.maxY) ? a.maxY : b.maxY;
+	return result;
+}
+
+void addDirtyRect(game_rect* rects, int32* rectCount, game_rect rect)
+{
+	if (rect.minX >= rect.maxX || rect.minY >= rect.maxY)
+	{
+		return;
+	}
+
+	for (int32 rectIndex = 0;
+		rectIndex < *rectCount;
+		rectIndex++)
+	{
+		if (rectsOverlap(rects[rectIndex], rect))
+		{
+			rects[rectIndex] = rectUnion(rects[rectIndex], rect);
+			return;
+		}
+	}
+
+	if (*rectCount < MAX_DIRTY_RECTS)
+	{
+		rects[(*rectCount)++] = rect;
+	}
+	else
+	{
+		rects[*rectCount - 1] = rectUnion(rects[*rectCount - 1], rect);
+	}
+}
+
+// FNV-1a over the commands
+internal uint64
+hashPushBuffer(render_group* group)
+{
+	uint64 hash = 14695981039346656037ULL;
+	uint8* at = group->pushBufferBase + group->firstVisibleEntryOffset;
+	uint8* end = group->pushBufferBase + group->pushBufferSize;
+	while (at < end)
+	{
+		hash ^= *at++;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Area that the visible commands touch, clipped to the buffer
+internal int32
+getRenderGroupRects(render_group* group, int32 width, int32 height, game_rect* rects)
+{
+	int32 rectCount = 0;
+	game_rect wholeBuffer = makeRect(0, 0, width, height);
+
+	for (uint32 baseAddress = group->firstVisibleEntryOffset;
+		baseAddress < group->pushBufferSize;
+		)
+	{
+		render_entry_header* header = (render_entry_header*)(group->pushBufferBase + baseAddress);
+		void* data = header + 1;
+		game_rect rect = wholeBuffer;
+		switch (header->type)
+		{
+			case RenderEntryType_Rectangle:
+			{
+				render_entry_rectangle* entry = (render_entry_rectangle*)data;
+				rect = makeRect(entry->minX, entry->minY, entry->maxX, entry->maxY);
+			} break;
+
+			case RenderEntryType_Bitmap:
+			{
+				render_entry_bitmap* entry = (render_entry_bitmap*)data;
+				rect = makeRect(entry->x, entry->y, 
+					entry->x + entry->bitmap->width, entry->y + entry->bitmap->height);
+			} break;
+
+			case RenderEntryType_Line:
+			{
+				render_entry_line* entry = (render_entry_line*)data;
+				rect = rectUnion(makeRect(entry->x0, entry->y0, entry->x0 + 1, entry->y0 + 1),
+					makeRect(entry->x1, entry->y1, entry->x1 + 1, entry->y1 + 1));
+			} break;
+
+			default:
+			{
+				// Clear and gradient cover everything
+			} break;
+		}
+
+		rect.minX = clampInt32(0, rect.minX, width);
+		rect.maxX = clampInt32(0, rect.maxX, width);
+		rect.minY = clampInt32(0, rect.minY, height);
+		rect.maxY = clampInt32(0, rect.maxY, height);
+		addDirtyRect(rects, &rectCount, rect);
+
+		baseAddress += header->sizeBytes;
+	}
+	return rectCount;
+}
+
+void renderGroupToOutput(game_memory* memory, render_group* group, game_pixel_buffer* pixelBuffer)
+{
+	int32 width = pixelBuffer->bitmapWidth;
+	int32 height = pixelBuffer->bitmapHeight;
+
+	uint64 frameHash = hashPushBuffer(group);
+	uint32 frameSize = group->pushBufferSize - group->firstVisibleEntryOffset;
+	game_rect frameRects[MAX_DIRTY_RECTS];
+	int32 frameRectCount = getRenderGroupRects(group, width, height, frameRects);
+
+	bool32 sameSize = (width == group->lastFrameWidth && height == group->lastFrameHeight);
+	bool32 canReuse = pixelBuffer->keepsContents && sameSize;
+
+	if (canReuse 
+		&& frameHash == group->lastFrameHash 
+		&& frameSize == group->lastFramePushBufferSize)
+	{
+		// Same commands on top of the same pixels, nothing to do
+		pixelBuffer->dirtyRectCount = 0;
+	}
+	else
+	{
+		renderTiled(memory, pixelBuffer, renderGroupTile, group);
+
+		if (canReuse)
+		{
+			// What is drawn now and what was drawn last frame, which 
+			// might not be drawn over anymore.
+			pixelBuffer->dirtyRectCount = 0;
+			for (int32 rectIndex = 0; rectIndex < frameRectCount; rectIndex++)
+			{
+				addDirtyRect(pixelBuffer->dirtyRects, &pixelBuffer->dirtyRectCount, frameRects[rectIndex]);
+			}
+			for (int32 rectIndex = 0; rectIndex < group->lastFrameRectCount; rectIndex++)
+			{
+				addDirtyRect(pixelBuffer->dirtyRects, &pixelBuffer->dirtyRectCount, group->lastFrameRects[rectIndex]);
+			}
+		}
+		else
+		{
+			pixelBuffer->dirtyRects[0] = makeRect(0, 0, width, height);
+			pixelBuffer->dirtyRectCount = 1;
+		}
+	}
+
+	group->lastFrameHash = frameHash;
+	group->lastFramePushBufferSize = frameSize;
+	group->lastFrameWidth = width;
+	group->lastFrameHeight = height;
+	group->lastFrameRectCount = frameRectCount;
+	for (int32 rectIndex = 0; rectIndex < frameRectCount; rectIndex++)
+	{
+		group->lastFrameRects[rectIndex] = frameRects[rectIndex];
+	}
+}
@@ -0,0 +1,134 @@
+/* Render commands that the game pushes and the renderer executes later */
+
+#ifndef HANDMADE_RENDER_GROUP_H
+#define HANDMADE_RENDER_GROUP_H
+
+#include "handmade.h"
+
+/*
+	The game does not draw to pixels directly. It pushes compact commands
+	to a push buffer and the renderer executes them all at once
+	into the game_pixel_buffer, in the order they were pushed.
+
+	Each command is a render_entry_header followed by the entry struct.
+	Coordinates are in pixels of the whole buffer, max values are exclusive.
+*/
+
+// NOTE: Pixels are 32 bits, same as game_pixel_buffer
+struct loaded_bitmap
+{
+	void* memory;
+	int32 width;
+	int32 height;
+	int32 pitch;
+};
+
+enum render_entry_type
+{
+	RenderEntryType_Clear,
+	RenderEntryType_Rectangle,
+	RenderEntryType_Bitmap,
+	RenderEntryType_Line,
+	RenderEntryType_WeirdGradient
+};
+
+struct render_entry_header
+{
+	render_entry_type type;
+	uint32 sizeBytes; // header included
+};
+
+struct render_entry_clear
+{
+	uint32 color;
+};
+
+struct render_entry_rectangle
+{
+	int32 minX;
+	int32 minY;
+	int32 maxX;
+	int32 maxY;
+	uint32 color;
+};
+
+struct render_entry_bitmap
+{
+	loaded_bitmap* bitmap;
+	int32 x;
+	int32 y;
+};
+
+struct render_entry_line
+{
+	int32 x0;
+	int32 y0;
+	int32 x1;
+	int32 y1;
+	uint32 color;
+};
+
+struct render_entry_weird_gradient
+{
+	int32 xOffset;
+	int32 yOffset;
+};
+
+struct render_group
+{
+	uint8* pushBufferBase;
+	uint32 pushBufferSize;
+	uint32 maxPushBufferSize;
+	uint32 entryCount;
+
+	// Where execution starts, commands before the last clear
+	// would be overwritten anyway.
+	uint32 firstVisibleEntryOffset;
+
+	// What was drawn last frame, for finding out what changed.
+	// NOTE: Bitmaps are compared by pointer, so their pixels must not 
+	// change while they are being pushed.
+	uint64 lastFrameHash;
+	uint32 lastFramePushBufferSize;
+	int32 lastFrameWidth;
+	int32 lastFrameHeight;
+	game_rect lastFrameRects[MAX_DIRTY_RECTS];
+	int32 lastFrameRectCount;
+};
+
+// Places the group and its push buffer in the given memory
+render_group*
+allocateRenderGroup(void* memory, uint32 memorySize);
+
+void
+clearRenderGroup(render_group* group);
+
+void
+pushClear(render_group* group, uint32 color);
+
+void
+pushRectangle(render_group* group, int32 minX, int32 minY, int32 maxX, int32 maxY, uint32 color);
+
+void
+pushBitmap(render_group* group, loaded_bitmap* bitmap, int32 x, int32 y);
+
+void
+pushLine(render_group* group, int32 x0, int32 y0, int32 x1, int32 y1, uint32 color);
+
+void
+pushWeirdGradient(render_group* group, int32 xOffset, int32 yOffset);
+
+// Executes all commands, tiled on the render queue if there is one.
+// Fills the dirty rects of pixelBuffer, and does not render at all if the 
+// commands are the same as last frame and the buffer kept its contents.
+void
+renderGroupToOutput(game_memory* memory, render_group* group, game_pixel_buffer* pixelBuffer);
+
+RENDER_TILE(renderGroupTile);
+
+// Adds rect to the list, merging it with one that it overlaps.
+// When the list is full the rect is merged with the last one.
+void
+addDirtyRect(game_rect* rects, int32* rectCount, game_rect rect);
+
+#endif
@@ -35,12 +35,16 @@ pushd ../build
 #rm sdl_handmade
 
 #Library
-c++  $Internal_Debug -c -fpic ../code/handmade.cpp -g $CommonFlags $NoWarnings
-c++ -shared -o ../data/libhandmade.so handmade.o
+c++  $Internal_Debug -c -fpic ../code/handmade.cpp ../code/handmade_render_group.cpp ../code/handmade_asset.cpp ../code/handmade_debug.cpp ../code/handmade_audio.cpp -g $CommonFlags $NoWarnings
+c++ -shared -o ../data/libhandmade.so handmade.o handmade_render_group.o handmade_asset.o handmade_debug.o handmade_audio.o
 
 c++  $Internal_Debug -c ../code/sdl_handmade.cpp -g $CommonFlags $NoWarnings
 
 c++  $Internal_Debug sdl_handmade.o -o sdl_handmade $LinkDynamicLinker $LinkHandmade -g $CommonFlags $NoWarnings
+
+#Asset packer tool, does not need SDL or the game library
+# ./handmade_packer ../data/assets.hha bitmap <name> <file.bmp> ...
+c++  $Internal_Debug ../code/handmade_packer.cpp ../code/handmade_asset.cpp -o handmade_packer -g -fno-rtti -fno-exceptions -Wall -Wextra $NoWarnings
 popd
 
 
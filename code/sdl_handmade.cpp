@@ -13,11 +13,19 @@
 #include <sys/mman.h>
 
 #include <dlfcn.h> // Load shared library, dlopen
+#include <sys/inotify.h> // Reload game code when it changes
+#include <poll.h>
+#include <time.h> // clock_nanosleep for frame pacing
+#include <errno.h>
+#include <sys/prctl.h> // PR_SET_TIMERSLACK
 
 #include "immintrin.h" // Cpu cycle counter, official place
 #include "x86intrin.h" // GCC place for cycle counter
 
 #include "handmade.h"
+#include "handmade_asset.h"
+#include "handmade_debug.h"
+#include "handmade_audio.h"
 #include "sdl_handmade.h"
 
 global_variable game_audioConfig audioConfig;
@@ -25,29 +33,56 @@ global_variable game_audioConfig audioConfig;
 
 // static variables are initialized to 0
 global_variable bool32 running;
-global_variable bool32 globalPause;
+// Main thread toggles it, the game thread reads it
+global_variable SDL_atomic_t globalPause;
 
 
 // ** RENDERING **
 
 // According to SDL documentation
 // we should use LockTexture for frequently changing 
-// textures
+// textures.
+// But then the texture has to be updated whole every frame. With our own
+// bitmap memory the pixels stay between frames and we can upload only
+// the dirty rectangles the game reports.
 static bool getUseSDLTextureLock()
 {
-	return true;
+	return false;
 }
 
 global_variable WindowBuffer *gWindowBuffer;
 
 internal void handleWindowResizeEvent(SDL_Event* event);
 internal void sdlResizeWindowTexture(WindowBuffer *buffer, SDL_Renderer *renderer, int32 width, int32 height);
+internal void sdlUpdatePresentRect(WindowBuffer *buffer, int32 windowWidth, int32 windowHeight);
 internal void sdlUpdateWindow(WindowBuffer *buffer, SDL_Renderer *renderer);
 internal game_pixel_buffer preparePixelBuffer(WindowBuffer* buffer);
-internal void renderPixelBuffer(WindowBuffer* buffer);
+internal void renderPixelBuffer(WindowBuffer* buffer, game_pixel_buffer* pixelBuffer);
 internal WindowDimensions getWindowDimensions(uint32 windowID);
 internal SDL_Renderer* getRenderer(uint32 windowID);
 
+// ** THREADS **
+// Worker threads for the game, see platform_work_queue in handmade.h
+
+global_variable platform_work_queue renderQueue;
+
+internal void sdlMakeWorkQueue(platform_work_queue *queue, uint32 threadCount);
+internal PLATFORM_ADD_WORK_ENTRY(sdlAddWorkEntry);
+internal PLATFORM_COMPLETE_ALL_WORK(sdlCompleteAllWork);
+internal bool32 sdlDoNextWorkEntry(platform_work_queue *queue);
+internal int sdlWorkerThread(void *data);
+
+// One low priority thread that does all asset I/O, so that page faults
+// and reads never stall the game thread
+global_variable platform_asset_queue assetQueue;
+
+internal void sdlStartAssetQueue(platform_asset_queue *queue, void *archiveMemory, uint64 archiveSize);
+internal void sdlStopAssetQueue(platform_asset_queue *queue);
+internal PLATFORM_QUEUE_ASSET_LOAD(sdlQueueAssetLoad);
+internal PLATFORM_QUEUE_ASSET_LOAD(sdlLoadAssetNow);
+internal bool32 sdlLoadAsset(platform_asset_queue *queue, asset_load_request *request);
+internal int sdlAssetThread(void *data);
+
 // ** INPUT **
 // 
 struct controllerState
@@ -99,13 +134,27 @@ static const uint32 SDL_SAMPLES_PER_CALLBACK = 1024;
 
 SDL_AudioDeviceID audioDevice; 
 
+// Single producer, single consumer ring: the game writes samples and the
+// audio callback plays them. Both counters only grow, the place in data
+// is counter % sizeBytes. Each side writes only its own counter, so there
+// is no lock and neither side ever waits for the other.
+// Bytes from playedBytes to writtenBytes are ready to play, playedBytes
+// never passes writtenBytes.
 struct ringBufferInfo
 {
 	uint32 sizeBytes;
-	uint32 writeCursorBytes;
-	uint32 playCursorBytes;
 	void* data;
-	bool updateNeeded;
+	// data is mapped twice in a row, so sizeBytes from any place
+	// in the ring can be written without wrapping
+	bool32 isMirrored;
+
+	// Only the game writes this, with release after the samples are written
+	uint64 writtenBytes;
+	// Only the audio callback writes these, with release after the samples are read
+	uint64 playedBytes;
+	// Silence played because nothing was written. The device has played
+	// playedBytes + underrunBytes in all.
+	uint64 underrunBytes;
 };
 
 struct dualBuffer
@@ -124,20 +173,60 @@ struct dualBuffer
 	}
 };
 
+// Game writes here when it can not write straight to the ring
 void* gameInputSoundData;
 
 global_variable ringBufferInfo ringBuffer;
 
-// Audio debug
-global_variable	sdl_audio_debug_marker* timeMarkersPointer;
+// Audio debug, written and drawn by the thread that runs the game
+global_variable sdl_audio_debug_marker timeMarkers[AUDIO_DEBUG_MARKERS];
+
+#if HANDMADE_INTERNAL
+// Frame times drawn on top of the game instead of printed,
+// printing every frame would disturb the timing
+global_variable debug_overlay debugOverlay;
+#endif
 global_variable uint32 timeMarkerIndex = 0;
 
 internal void initAudio(int32 samplesPerSecond, uint32 gameUpdateHz);
 internal void audioCallback(void *userData, uint8 *buffer, int32 length);
 internal void clearRingBuffer();
+internal bool32 allocateRingBuffer(ringBufferInfo* ring, uint32 minimumBytes);
+internal void freeRingBuffer(ringBufferInfo* ring);
+internal uint32 ringBufferConsume(ringBufferInfo* ring, uint8* output, uint32 bytes);
+internal uint32 getRingBufferFreeBytes(ringBufferInfo* ring);
+internal void commitRingBufferWrite(ringBufferInfo* ring, uint32 bytes);
+internal uint32 getRingPlayCursor(ringBufferInfo* ring);
+internal uint32 getRingWriteCursor(ringBufferInfo* ring);
 internal dualBuffer prepareSoundBuffer();
 internal void writeSoundBuffer(game_sound_buffer& gameInputBuffer, dualBuffer& requiredBuffer);
 
+// ** AUDIO LATENCY CALIBRATION
+global_variable sdl_audio_calibration audioCalibration;
+
+internal void addJitterSample(sdl_jitter_histogram* histogram, real32 seconds);
+internal void decayJitterHistogram(sdl_jitter_histogram* histogram);
+internal real32 getJitterPercentile(sdl_jitter_histogram* histogram, real32 fraction);
+internal void recordAudioCallback(sdl_audio_calibration* calibration, uint64 time);
+internal void calibrateAudioLatency(sdl_audio_calibration* calibration, uint64 writeTime);
+
+// ** RESAMPLING
+// Game mixes at a fixed rate, this converts to whatever the device gave
+global_variable sdl_resampler audioResampler;
+
+#define RESAMPLE_FRAMES(name) void name(sdl_resampler* resampler, int16* output, uint32 outputCount)
+typedef RESAMPLE_FRAMES(resample_frames);
+internal RESAMPLE_FRAMES(resampleFramesScalar);
+internal RESAMPLE_FRAMES(resampleFramesSSE2);
+internal RESAMPLE_FRAMES(resampleFramesAVX2);
+
+internal bool32 initResampler(sdl_resampler* resampler, uint32 inputRate, uint32 outputRate, uint32 maxOutputFrames);
+internal void freeResampler(sdl_resampler* resampler);
+internal uint32 getResamplerInputFrames(sdl_resampler* resampler, uint32 outputFrames);
+internal void resampleAudio(resample_frames* kernel, sdl_resampler* resampler, 
+	int16* input, uint32 inputFrames, int16* output, uint32 outputFrames);
+internal resample_frames* getResampleFramesKernel();
+
 internal void handleEvent(SDL_Event*);
 internal void handleKey(SDL_Keycode, bool wasDown);
 
@@ -147,9 +236,31 @@ internal void handleKey(SDL_Keycode, bool wasDown);
 #include <sys/stat.h>  // for fstat()
 #include <unistd.h>    // for fstat() and close()
 #include <fcntl.h>		 // for fstat() and open()
+
+// ** ASSETS
+// Whole archive is mapped once and the game reads it from the mapping
+internal bool32 sdlMapAssetArchive(const char* fileName, game_memory* gameMemory);
+internal void sdlUnmapAssetArchive(game_memory* gameMemory);
+
 // ** Game API
 
-internal void updateGame(WindowBuffer* windowBuffer, game_input_state& inputState, game_memory& gameMemory);
+internal void updateGame(game_pixel_buffer* pixelBuffer, game_input_state& inputState, game_memory& gameMemory,
+	sdl_flip_info& flip);
+
+// ** FRAME PIPELINE
+// Game thread renders frame N+1 while main thread presents frame N.
+// Started with --pipeline=2 or --pipeline=3, the number of backbuffers.
+
+global_variable sdl_frame_pipeline framePipeline;
+
+internal int32 getPipelineDepthArgument(int argc, char *argv[]);
+internal sdl_page_mode getPageModeArgument(int argc, char *argv[]);
+internal bool32 getPrefaultArgument(int argc, char *argv[]);
+internal void* sdlAllocateGameMemory(void* baseAddress, uint64 size, sdl_page_mode* mode, bool32 prefault);
+internal void sdlStartFramePipeline(sdl_frame_pipeline* pipeline, int32 depth, game_memory* gameMemory);
+internal void sdlStopFramePipeline(sdl_frame_pipeline* pipeline);
+internal int sdlGameThread(void* data);
+internal game_pixel_buffer prepareBackbuffer(sdl_backbuffer* backbuffer, int32 width, int32 height);
 
 // ** Loading game code from a shader library
 //internal void sld_loadGameCode(void);
@@ -160,14 +271,56 @@ internal int32 SDLGetWindowRefreshRate(SDL_Window* window);
 inline uint64 getWallClock();
 inline real32 getSecondsElapsed(uint64 start, uint64 end);
 
+// Frame pacing, see sdl_frame_pacer
+internal uint64 getClockNs(clockid_t clock);
+internal void startFramePacer(sdl_frame_pacer* pacer, real32 secondsPerFrame);
+internal void waitForFrameDeadline(sdl_frame_pacer* pacer);
+internal void recordFrameWake(sdl_frame_pacer* pacer, uint64 wakeNs, bool32 isMissed);
+internal void printFramePacerStats(sdl_frame_pacer* pacer, const char* name);
+
+// Presentation, see sdl_presentation
+internal sdl_present_mode getPresentModeArgument(int argc, char *argv[]);
+internal void choosePresentation(sdl_presentation* presentation, sdl_present_mode mode, uint32 monitorRefreshHz);
+internal void sdlCheckVsync(sdl_presentation* presentation, sdl_frame_pacer* pacer);
+
 global_variable uint64 gPerformanceCounterFrequency;
 
+// ** BENCHMARKS
+// Run with --bench, prints results and exits without opening a window
+#if HANDMADE_INTERNAL
+internal void sdlRunBenchmarks();
+internal void benchmarkGradient();
+internal void benchmarkTiledRender();
+internal void benchmarkFill();
+internal void benchmarkAssetLoad();
+internal void benchmarkAssetStreaming();
+internal void benchmarkAudioRing();
+internal void benchmarkOscillators();
+internal void benchmarkMixer();
+internal void benchmarkResampler();
+internal void benchmarkSoundStream();
+internal void benchmarkGameMemory();
+internal void benchmarkFramePacing();
+
+// ** OFFLINE AUDIO
+// Run with --render-audio=<file.wav> [--seconds=<n>], writes what the
+// game's sound function outputs as fast as it can, without a window or
+// a sound card. Same game code and assets give the same file every time.
+internal int sdlRenderAudioOffline(const char* fileName, real32 seconds);
+#endif
+
 
 internal void
-SDLDebugSyncDisplay(WindowBuffer* buffer, uint32 arrayCount
+SDLDebugSyncDisplay(game_pixel_buffer& writebuffer, uint32 arrayCount
 	, sdl_audio_debug_marker* timeMarkers, int currentMarkerIndex, ringBufferInfo& ringBufferInfo);
 
 
+// Game code is never loaded from the file the compiler writes, but from
+// a copy of it. The compiler can then write the library again while the
+// game runs, and a half written library is never loaded.
+#define GAME_CODE_FILE_NAME "libhandmade.so"
+#define GAME_CODE_PATH "./" GAME_CODE_FILE_NAME
+
 struct sdl_game_code
 {
 	void* libraryHandle;
@@ -175,16 +328,54 @@ struct sdl_game_code
 	game_get_sound_samples *getSoundSamples;
 	
 	bool32 isValid;
+
+	// The copy that is loaded, removed when the code is unloaded
+	char copyPath[64];
+};
+
+// dlopen of a new library takes milliseconds, so a thread waits for the
+// library to change and loads it. The game thread only swaps the loaded
+// code in before a frame, and the thread closes the old one after that.
+enum sdl_game_code_load_state
+{
+	GameCodeLoad_Idle,		// loader thread waits for a change
+	GameCodeLoad_Ready,		// loadedCode can be swapped in
+	GameCodeLoad_Retired	// retiredCode can be closed
+};
+
+struct sdl_game_code_loader
+{
+	// inotify tells when the library has been written again, without it
+	// the modification time is checked a few times a second
+	int inotifyHandle; // -1 when not in use
+	struct timespec lastWriteTime;
+	uint32 copyCount;
+
+	SDL_Thread* thread;
+	SDL_atomic_t quit;
+	SDL_atomic_t state; // sdl_game_code_load_state
+
+	// The thread the state gives them to owns these
+	sdl_game_code loadedCode;
+	sdl_game_code retiredCode;
+	real32 loadSeconds;
+
+	// Only the game thread writes these
+	uint32 swapCount;
+	real32 maxSwapSeconds;
 };
 
 internal sdl_game_code gameCodeHandles;
+global_variable sdl_game_code_loader gameCodeLoader;
 
-internal sdl_game_code sdl_loadGameCode(void)
+internal sdl_game_code sdl_loadGameCode(const char* path)
 {
 	sdl_game_code result = {};
 	result.isValid = false;
 	
-	result.libraryHandle = dlopen("./libhandmade.so", RTLD_NOW);
+	// Without DEEPBIND the copy would call functions in the library the
+	// platform is linked against instead of its own
+	result.libraryHandle = dlopen(path, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND);
 	if (result.libraryHandle != NULL)
 	{
 		// dlsym() returns NULL if function is not found from library
@@ -243,6 +434,11 @@ sdl_unloadGameCode(sdl_game_code *gameCode)
 		dlclose(gameCode->libraryHandle);
 		gameCode->libraryHandle = NULL;
 	}
+	if (gameCode->copyPath[0] != 0)
+	{
+		unlink(gameCode->copyPath);
+		gameCode->copyPath[0] = 0;
+	}
 	gameCode->isValid = false;
 	{
 		gameCode->updateAndRender = gameUpdateAndRenderStub;
@@ -250,6 +446,262 @@ sdl_unloadGameCode(sdl_game_code *gameCode)
 	}
 }
 
+// Every copy has a new name. dlopen returns the library that is already
+// loaded if the name is the same, and the old copy can still be mapped.
+internal bool32
+sdlCopyGameCode(sdl_game_code_loader* loader, char* copyPath, uint32 copyPathSize)
+{
+	snprintf(copyPath, copyPathSize, "./libhandmade_%d_%u.so", (int)getpid(), loader->copyCount++);
+
+	int sourceHandle = open(GAME_CODE_PATH, O_RDONLY);
+	if (sourceHandle == -1)
+	{
+		return false;
+	}
+	int copyHandle = open(copyPath, O_WRONLY | O_CREAT | O_TRUNC, 0700);
+	if (copyHandle == -1)
+	{
+		close(sourceHandle);
+		return false;
+	}
+
+	bool32 isCopied = true;
+	uint8 block[SizeKiloBytes(64)];
+	for (;;)
+	{
+		ssize_t bytesRead = read(sourceHandle, block, sizeof(block));
+		if (bytesRead <= 0)
+		{
+			isCopied = (bytesRead == 0);
+			break;
+		}
+		if (write(copyHandle, block, bytesRead) != bytesRead)
+		{
+			isCopied = false;
+			break;
+		}
+	}
+	close(sourceHandle);
+	isCopied &= (close(copyHandle) == 0);
+
+	if (!isCopied)
+	{
+		unlink(copyPath);
+	}
+	return isCopied;
+}
+
+internal sdl_game_code
+sdlLoadGameCodeCopy(sdl_game_code_loader* loader)
+{
+	sdl_game_code result = {};
+	char copyPath[sizeof(result.copyPath)];
+	if (sdlCopyGameCode(loader, copyPath, sizeof(copyPath)))
+	{
+		result = sdl_loadGameCode(copyPath);
+		memcpy(result.copyPath, copyPath, sizeof(copyPath));
+		if (!result.isValid)
+		{
+			unlink(copyPath);
+			result.copyPath[0] = 0;
+		}
+	}
+	else
+	{
+		printf("Could not copy %s to load it\n", GAME_CODE_PATH);
+		result.updateAndRender = gameUpdateAndRenderStub;
+		result.getSoundSamples = gameGetSoundSamplesStub;
+	}
+	return result;
+}
+
+internal bool32
+getGameCodeWriteTime(struct timespec* writeTime)
+{
+	struct stat fileStatus;
+	if (stat(GAME_CODE_PATH, &fileStatus) != 0)
+	{
+		return false;
+	}
+	*writeTime = fileStatus.st_mtim;
+	return true;
+}
+
+// True once after the library has been written and closed. Waits at
+// most timeoutMs for it, so that the thread sees quit.
+internal bool32
+sdlWaitForGameCodeChange(sdl_game_code_loader* loader, int32 timeoutMs)
+{
+	bool32 hasChanged = false;
+	if (loader->inotifyHandle != -1)
+	{
+		struct pollfd pollHandle = {loader->inotifyHandle, POLLIN, 0};
+		if (poll(&pollHandle, 1, timeoutMs) <= 0)
+		{
+			return false;
+		}
+
+		uint8 events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		ssize_t bytesRead;
+		while ((bytesRead = read(loader->inotifyHandle, events, sizeof(events))) > 0)
+		{
+			for (uint8* at = events;
+				at < events + bytesRead;
+				at += sizeof(struct inotify_event) + ((struct inotify_event*)at)->len)
+			{
+				struct inotify_event* event = (struct inotify_event*)at;
+				if (event->len > 0 && strcmp(event->name, GAME_CODE_FILE_NAME) == 0)
+				{
+					hasChanged = true;
+				}
+			}
+		}
+	}
+	else
+	{
+		SDL_Delay(timeoutMs);
+		struct timespec writeTime;
+		if (getGameCodeWriteTime(&writeTime)
+			&& (writeTime.tv_sec != loader->lastWriteTime.tv_sec
+				|| writeTime.tv_nsec != loader->lastWriteTime.tv_nsec))
+		{
+			loader->lastWriteTime = writeTime;
+			hasChanged = true;
+		}
+	}
+	return hasChanged;
+}
+
+internal int
+sdlGameCodeLoaderThread(void* data)
+{
+	sdl_game_code_loader* loader = (sdl_game_code_loader*)data;
+	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+	while (!SDL_AtomicGet(&loader->quit))
+	{
+		int state = SDL_AtomicGet(&loader->state);
+		if (state == GameCodeLoad_Retired)
+		{
+			SDL_MemoryBarrierAcquire();
+			sdl_unloadGameCode(&loader->retiredCode);
+			SDL_AtomicSet(&loader->state, GameCodeLoad_Idle);
+		}
+		else if (state == GameCodeLoad_Ready)
+		{
+			// Game thread swaps it in on the next frame
+			SDL_Delay(10);
+		}
+		else if (sdlWaitForGameCodeChange(loader, 100))
+		{
+			uint64 start = getWallClock();
+			sdl_game_code newCode = sdlLoadGameCodeCopy(loader);
+			if (newCode.isValid)
+			{
+				loader->loadedCode = newCode;
+				loader->loadSeconds = getSecondsElapsed(start, getWallClock());
+				SDL_MemoryBarrierRelease();
+				SDL_AtomicSet(&loader->state, GameCodeLoad_Ready);
+			}
+			else
+			{
+				// Maybe the compiler failed, the next write tries again
+				printf("Game code did not load, keeping the old one\n");
+			}
+		}
+	}
+	return 0;
+}
+
+internal void
+sdlStartGameCodeLoader(sdl_game_code_loader* loader)
+{
+	getGameCodeWriteTime(&loader->lastWriteTime);
+
+	// The compiler may replace the file instead of writing it, so the
+	// directory is watched and not the file
+	loader->inotifyHandle = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (loader->inotifyHandle != -1
+		&& inotify_add_watch(loader->inotifyHandle, ".", IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
+	{
+		close(loader->inotifyHandle);
+		loader->inotifyHandle = -1;
+	}
+	if (loader->inotifyHandle == -1)
+	{
+		printf("No inotify, checking the game code modification time\n");
+	}
+
+	SDL_AtomicSet(&loader->quit, 0);
+	SDL_AtomicSet(&loader->state, GameCodeLoad_Idle);
+	loader->thread = SDL_CreateThread(sdlGameCodeLoaderThread, "HandmadeCodeLoader", loader);
+	if (loader->thread == NULL)
+	{
+		printf("Could not create game code loader thread: %s\n", SDL_GetError());
+	}
+}
+
+// Call when the game thread has stopped
+internal void
+sdlStopGameCodeLoader(sdl_game_code_loader* loader)
+{
+	if (loader->thread)
+	{
+		SDL_AtomicSet(&loader->quit, 1);
+		SDL_WaitThread(loader->thread, NULL);
+		loader->thread = NULL;
+	}
+	if (loader->inotifyHandle != -1)
+	{
+		close(loader->inotifyHandle);
+		loader->inotifyHandle = -1;
+	}
+
+	int state = SDL_AtomicGet(&loader->state);
+	if (state == GameCodeLoad_Ready)
+	{
+		sdl_unloadGameCode(&loader->loadedCode);
+	}
+	else if (state == GameCodeLoad_Retired)
+	{
+		sdl_unloadGameCode(&loader->retiredCode);
+	}
+	SDL_AtomicSet(&loader->state, GameCodeLoad_Idle);
+
+	if (loader->swapCount > 0)
+	{
+		printf("Game code reloads: %u, longest stall %.1f us\n",
+			loader->swapCount, loader->maxSwapSeconds * 1000000.0f);
+	}
+}
+
+// Called by the thread that runs the game, before updating. Only takes
+// code the loader thread has already loaded, nothing here waits.
+internal void
+sdlReloadGameCodeIfNeeded()
+{
+	if (SDL_AtomicGet(&gameCodeLoader.state) != GameCodeLoad_Ready)
+	{
+		return;
+	}
+
+	uint64 start = getWallClock();
+	SDL_MemoryBarrierAcquire();
+	gameCodeLoader.retiredCode = gameCodeHandles;
+	gameCodeHandles = gameCodeLoader.loadedCode;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&gameCodeLoader.state, GameCodeLoad_Retired);
+	real32 swapSeconds = getSecondsElapsed(start, getWallClock());
+
+	gameCodeLoader.swapCount++;
+	if (swapSeconds > gameCodeLoader.maxSwapSeconds)
+	{
+		gameCodeLoader.maxSwapSeconds = swapSeconds;
+	}
+	printf("Reloaded game code, loaded in %.3f ms on the loader thread, stall %.1f us\n",
+		gameCodeLoader.loadSeconds * 1000.0f, swapSeconds * 1000000.0f);
+}
+
 // ** SDL CODE
 
 int main(int argc, char *argv[])
@@ -259,6 +711,37 @@ int main(int argc, char *argv[])
 	{
 		printf("Argument %d: %s\n", i, argv[i]);
 	}
+
+#if HANDMADE_INTERNAL
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--bench") == 0)
+		{
+			sdlRunBenchmarks();
+			return 0;
+		}
+	}
+
+	const char* renderAudioOption = "--render-audio=";
+	const char* secondsOption = "--seconds=";
+	const char* renderAudioFile = NULL;
+	real32 renderSeconds = 60.0f;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], renderAudioOption, strlen(renderAudioOption)) == 0)
+		{
+			renderAudioFile = argv[i] + strlen(renderAudioOption);
+		}
+		else if (strncmp(argv[i], secondsOption, strlen(secondsOption)) == 0)
+		{
+			renderSeconds = (real32)atof(argv[i] + strlen(secondsOption));
+		}
+	}
+	if (renderAudioFile)
+	{
+		return sdlRenderAudioOffline(renderAudioFile, renderSeconds);
+	}
+#endif
 	
 	
 	
@@ -285,7 +768,8 @@ int main(int argc, char *argv[])
 
 	SDL_Renderer *renderer = NULL;
 	int32 autodetect = -1;
-	Uint32 flags = 0;
+	sdl_present_mode presentMode = getPresentModeArgument(argc, argv);
+	Uint32 flags = (presentMode == PresentMode_Vsync) ? SDL_RENDERER_PRESENTVSYNC : 0;
 	renderer = SDL_CreateRenderer(window, autodetect, flags);
 
 	if (renderer == NULL)
@@ -294,33 +778,61 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	SDL_RendererInfo rendererInfo;
+	if (presentMode == PresentMode_Vsync
+		&& (SDL_GetRendererInfo(renderer, &rendererInfo) != 0
+			|| (rendererInfo.flags & SDL_RENDERER_PRESENTVSYNC) == 0))
+	{
+		printf("Renderer has no vsync, pacing with the timer\n");
+		presentMode = PresentMode_Timer;
+	}
+
 	initControllers();
 
 	running = true;
-	globalPause = false;
-	// Update window to create the texture
+	SDL_AtomicSet(&globalPause, 0);
 	int32 windowWidth = 0;
 	int32 windowHeight = 0;
 	SDL_GetWindowSize(window, &windowWidth, &windowHeight);
-	
-	// backbuffer always same size
-	windowWidth = 800;
-	windowHeight = 600;
+
+	// backbuffer always same size, resizing the window only changes
+	// how much it is scaled when presented
+	int32 backbufferWidth = 800;
+	int32 backbufferHeight = 600;
+
+	// Filtering used when the backbuffer is scaled to the window.
+	// Must be set before the texture is created.
+	const char* scaleQuality = "nearest";
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--scale=linear") == 0)
+		{
+			scaleQuality = "linear";
+		}
+	}
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, scaleQuality);
 
 	// Target refresh rate for the game
 	// TODO: How do we get the actual value from the device?
 	uint32 monitorRefreshHz = SDLGetWindowRefreshRate(window);
-	printf("Monitor refresh rate: %u\n", monitorRefreshHz);
-	uint32 gameUpdateHz = 30;
+	sdl_presentation presentation;
+	choosePresentation(&presentation, presentMode, monitorRefreshHz);
+	uint32 gameUpdateHz = presentation.gameUpdateHz;
+	printf("Monitor refresh rate: %u, game runs at %u Hz, %s\n", monitorRefreshHz, gameUpdateHz,
+		(presentation.mode == PresentMode_Vsync) ? "presenting with vsync" : "paced with the timer");
 	real32 targetSecondsPerFrame = 1.0f / (real32)gameUpdateHz;
 	audioConfig.targetSecondsPerFrame = targetSecondsPerFrame;
+#if HANDMADE_INTERNAL
+	debugOverlay.targetMsPerFrame = targetSecondsPerFrame * 1000.0f;
+#endif
 
 	int32 bytesPerPixel = 4;
 	// Create buffer
 	gWindowBuffer = new WindowBuffer();
 	gWindowBuffer->bytesPerPixel = bytesPerPixel;
 					
-	sdlResizeWindowTexture(gWindowBuffer, renderer, windowWidth, windowHeight);
+	sdlResizeWindowTexture(gWindowBuffer, renderer, backbufferWidth, backbufferHeight);
+	sdlUpdatePresentRect(gWindowBuffer, windowWidth, windowHeight);
 
 	initAudio(48000, gameUpdateHz);
 	
@@ -347,45 +859,71 @@ int main(int argc, char *argv[])
 	// 32 bit cannot handle 4 gigabytes
 	gameMemory.transientStorageSize = SizeGigaBytes(1); 
 	uint64 totalMemorySize = gameMemory.permanentStorageSize + gameMemory.transientStorageSize;
-	gameMemory.permanentStoragePointer = mmap( baseAddress,  // place for memory
-		totalMemorySize, // how many bytes
-		PROT_READ | PROT_WRITE, // Protection flags to read/write
-		MAP_ANONYMOUS | MAP_PRIVATE, // not a file, only for us
-		-1, 						// no file
-		0); 				// offset into the file
-
-	gameMemory.transientStoragePointer = (uint8*)(gameMemory.permanentStoragePointer) + gameMemory.permanentStorageSize;
-
-
-	if (gameMemory.permanentStoragePointer == MAP_FAILED)
+	sdl_page_mode pageMode = getPageModeArgument(argc, argv);
+	gameMemory.permanentStoragePointer = sdlAllocateGameMemory(baseAddress, totalMemorySize,
+		&pageMode, getPrefaultArgument(argc, argv));
+	if (gameMemory.permanentStoragePointer == NULL)
 	{
 		printf("Could not allocate memory for game.\n");
 		return 1;
 	}
+	gameMemory.transientStoragePointer = (uint8*)(gameMemory.permanentStoragePointer) + gameMemory.permanentStorageSize;
 	
 	#if HANDMADE_INTERNAL
 	gameMemory.debug_free_memory = debugPlatformFreeFileMemory;
 	gameMemory.debug_read_file = debugPlatformReadEntireFile;
 	gameMemory.debug_write_file = debugPlatformWriteEntireFile;
 	#endif
-	
-	sdl_audio_debug_marker timeMarkers[gameUpdateHz / 2];
-	timeMarkersPointer = timeMarkers;
 
+	// Working directory is ../data, same as for the game library
+	if (!sdlMapAssetArchive("assets.hha", &gameMemory))
+	{
+		printf("No asset archive, running without assets\n");
+	}
+	sdlStartAssetQueue(&assetQueue, gameMemory.assetArchiveMemory, gameMemory.assetArchiveSize);
+	gameMemory.assetQueue = &assetQueue;
+	gameMemory.queueAssetLoad = sdlQueueAssetLoad;
+
+	// Main thread helps with the work when it waits for it to complete,
+	// so leave one core for it
+	int32 workerThreadCount = SDL_GetCPUCount() - 1;
+	if (workerThreadCount > 0)
+	{
+		sdlMakeWorkQueue(&renderQueue, workerThreadCount);
+		gameMemory.renderQueue = &renderQueue;
+		gameMemory.addWorkEntry = sdlAddWorkEntry;
+		gameMemory.completeAllWork = sdlCompleteAllWork;
+		gameMemory.renderThreadCount = workerThreadCount + 1;
+	}
+	printf("Render worker threads: %d\n", workerThreadCount);
+	
 	// Load game code
-	gameCodeHandles = sdl_loadGameCode();
-	int loadCounter = 0;
+	gameCodeHandles = sdlLoadGameCodeCopy(&gameCodeLoader);
+	sdlStartGameCodeLoader(&gameCodeLoader);
+
+	int32 pipelineDepth = getPipelineDepthArgument(argc, argv);
+	if (pipelineDepth > 1)
+	{
+		sdlStartFramePipeline(&framePipeline, pipelineDepth, &gameMemory);
+	}
+	else
+	{
+		framePipeline.depth = 1;
+	}
+	printf("Frame pipeline depth: %d\n", framePipeline.depth);
+
+	sdl_frame_pacer framePacer;
+	startFramePacer(&framePacer, targetSecondsPerFrame);
+	real32 lastPresentSeconds = 0.0f;
+	sdl_flip_info lastFlip = {};
+	lastFlip.wallClock = getWallClock();
 
 	while(running)
 	{
-		if (loadCounter++ > 120)
-		{
-			sdl_unloadGameCode(&gameCodeHandles);
-			gameCodeHandles = sdl_loadGameCode();
-			loadCounter = 0;
-		}
-	
-		
+		sdl_stage_timings& timings = framePipeline.lastFrame;
+		timings = sdl_stage_timings();
+		uint64 stageStart = getWallClock();
+
 		game_input_state& oldInput = *pOldInput;
 		game_input_state& newInput = *pNewInput;
 
@@ -394,7 +932,7 @@ int main(int argc, char *argv[])
 		{
 			switch(event.type)
 			{
-				
+
 				// record keyboard input here.
 				case SDL_KEYDOWN:
 				case SDL_KEYUP:
@@ -419,67 +957,133 @@ int main(int argc, char *argv[])
 
 		// updates both gamepad and keyboard input
 		handleInput(oldInput, newInput);
+		timings.input = getSecondsElapsed(stageStart, getWallClock());
 
-		if (!globalPause)
-		{
-			updateGame(gWindowBuffer, newInput, gameMemory);
-		}
-		
-		replaceOldInput(pOldInput, pNewInput);
-		// FPS calculation
+		// The frame that is uploaded and presented this time
+		game_pixel_buffer serialPixelBuffer;
+		game_pixel_buffer* framePixelBuffer = NULL;
+		bool32 gotBackbuffer = false;
 
-		uint64 frameEndCounter = getWallClock();
-		real32 secondsElapsedForFrame = getSecondsElapsed(frameStartCounter, frameEndCounter);
-		
-		if (secondsElapsedForFrame < targetSecondsPerFrame)
+		// Audio state of the frame that is presented, for the overlay
+		real32 frameAudioLatencySeconds = 0.0f;
+		real32 frameAudioSafetySeconds = 0.0f;
+		uint32 frameAudioUnderrunCount = 0;
+
+		if (framePipeline.depth > 1)
 		{
-			uint32 msToSleep = (targetSecondsPerFrame - secondsElapsedForFrame) * 1000.0f;
-			msToSleep -= 1; // Prepare that SDL_Delay takes 1 ms longer than should
-			SDL_Delay(msToSleep);
-			secondsElapsedForFrame = getSecondsElapsed(frameStartCounter, getWallClock());
-			
-			// If we have any time left after SDL_Delay, spinlock for that duration
-			while (secondsElapsedForFrame < targetSecondsPerFrame)
+			// Game thread rendered this while we presented the last one
+			stageStart = getWallClock();
+			if (SDL_SemWaitTimeout(framePipeline.readyBuffers, 100) == 0)
 			{
-			  secondsElapsedForFrame = getSecondsElapsed(frameStartCounter, getWallClock());
-			 // nop... 
+				sdl_backbuffer* backbuffer = &framePipeline.backbuffers[framePipeline.nextToPresent];
+				framePipeline.nextToPresent = (framePipeline.nextToPresent + 1) % framePipeline.depth;
+				gotBackbuffer = true;
+				timings.simulate = backbuffer->simulateSeconds;
+				frameAudioLatencySeconds = backbuffer->audioLatencySeconds;
+				frameAudioSafetySeconds = backbuffer->audioSafetySeconds;
+				frameAudioUnderrunCount = backbuffer->audioUnderrunCount;
+
+				// Window might have been resized after this was rendered
+				if (backbuffer->width == gWindowBuffer->bitmapWidth
+					&& backbuffer->height == gWindowBuffer->bitmapHeight)
+				{
+					framePixelBuffer = &backbuffer->pixelBuffer;
+				}
 			}
+			timings.wait = getSecondsElapsed(stageStart, getWallClock());
+
+			// Let the game thread start the next frame with the newest input
+			SDL_LockMutex(framePipeline.mutex);
+			framePipeline.latestInput = newInput;
+			framePipeline.latestFlip = lastFlip;
+			SDL_UnlockMutex(framePipeline.mutex);
+			SDL_SemPost(framePipeline.frameTicks);
 		}
 		else
 		{
-			//TODO: Missed framerate!!!
+			sdlReloadGameCodeIfNeeded();
+
+			serialPixelBuffer = preparePixelBuffer(gWindowBuffer);
+			if (!SDL_AtomicGet(&globalPause))
+			{
+				stageStart = getWallClock();
+				updateGame(&serialPixelBuffer, newInput, gameMemory, lastFlip);
+				timings.simulate = getSecondsElapsed(stageStart, getWallClock());
+			}
+			else
+			{
+				serialPixelBuffer.dirtyRectCount = 0;
+			}
+			framePixelBuffer = &serialPixelBuffer;
+			frameAudioLatencySeconds = audioConfig.currentLatencySeconds;
+			frameAudioSafetySeconds = audioCalibration.safetySeconds;
+			frameAudioUnderrunCount = audioCalibration.underrunCount;
+		}
+
+		replaceOldInput(pOldInput, pNewInput);
+
+		if (framePixelBuffer)
+		{
+#if HANDMADE_INTERNAL
+			// Bottom left corner, below the audio markers
+			game_rect overlayArea = drawDebugOverlay(&debugOverlay, framePixelBuffer,
+				16, framePixelBuffer->bitmapHeight - DEBUG_OVERLAY_HEIGHT - 16);
+			addDirtyRect(framePixelBuffer->dirtyRects, &framePixelBuffer->dirtyRectCount, overlayArea);
+#endif
+			stageStart = getWallClock();
+			renderPixelBuffer(gWindowBuffer, framePixelBuffer);
+			timings.upload = getSecondsElapsed(stageStart, getWallClock());
+#if HANDMADE_INTERNAL
+			// Debug lines are not part of what the game rendered
+			gWindowBuffer->contentsValid = false;
+#endif
+		}
+
+		if (gotBackbuffer)
+		{
+			SDL_SemPost(framePipeline.freeBuffers);
 		}
-		
+
+		// FPS calculation
+
+		uint64 frameEndCounter = getWallClock();
+		if (presentation.mode == PresentMode_Timer)
+		{
+			waitForFrameDeadline(&framePacer);
+		}
+		real32 secondsElapsedForFrame = getSecondsElapsed(frameStartCounter, getWallClock());
+		timings.wait += getSecondsElapsed(frameEndCounter, getWallClock());
+
 		frameStartCounter = getWallClock();
-		
+
 #if HANDMADE_INTERNAL
-		// Print FPS
+		// Record for the overlay, it is drawn on the next frame
 		uint64 endCycleCount = _rdtsc();
 		uint64 elapsedCycleCount = endCycleCount - lastCycleCount;
 		lastCycleCount = endCycleCount;
-		uint64 megaelapsedCycleCount = elapsedCycleCount / (1000 * 1000);
-
-		real32 fps = 1.0f / (secondsElapsedForFrame);
-		real32 msPerFrame = secondsElapsedForFrame * 1000.0f;
 
-		 printf("MsF: %f2.2 FpS: %f2.2 mCpF: %lu\n", msPerFrame, fps, megaelapsedCycleCount );
-
-		// Debug audio timing
-		if (!globalPause)
-		{
-			SDLDebugSyncDisplay(gWindowBuffer, ArrayCount(timeMarkers)
-			, timeMarkers, timeMarkerIndex - 1, ringBuffer);
-		}
+		debug_frame_record frameRecord;
+		frameRecord.msPerFrame = secondsElapsedForFrame * 1000.0f;
+		frameRecord.megaCyclesPerFrame = (real32)elapsedCycleCount / (1000.0f * 1000.0f);
+		frameRecord.audioLatencyMs = frameAudioLatencySeconds * 1000.0f;
+		frameRecord.audioSafetyMs = frameAudioSafetySeconds * 1000.0f;
+		frameRecord.audioUnderrunCount = frameAudioUnderrunCount;
+		frameRecord.inputMs = timings.input * 1000.0f;
+		frameRecord.simulateMs = timings.simulate * 1000.0f;
+		frameRecord.uploadMs = timings.upload * 1000.0f;
+		frameRecord.waitMs = timings.wait * 1000.0f;
+		frameRecord.presentMs = lastPresentSeconds * 1000.0f;
+		recordDebugFrame(&debugOverlay, &frameRecord);
 #endif
-		
+
 		// Calculation done wrong:
-		
+
 		// integer division returns as zero if divided is smaller
 		/// uint64 secondsElapsedInFrame = counterElapsed / performanceCounterFrequency;
 
 		// < Arithmetic exception
 		// 1 / counterElapsed -> 0 / 10000000 -> 0
-		// uint64 fps = (1 / counterElapsed) / performanceCounterFrequency; 
+		// uint64 fps = (1 / counterElapsed) / performanceCounterFrequency;
 
 		// This works because 1 000 000 000 / 65 000 000 > 0
 		// uint64 altFps = performanceCounterFrequency / counterElapsed;
@@ -487,30 +1091,102 @@ int main(int argc, char *argv[])
 
 		// Update frame at the very end
 		// Flip happens here
-		sdlUpdateWindow(gWindowBuffer, renderer);
-
-		audioConfig.flipWallClock = getWallClock();
-		
-#if HANDMADE_INTERNAL
-		timeMarkers[timeMarkerIndex].flipPlayCursor= ringBuffer.playCursorBytes;
-		timeMarkers[timeMarkerIndex].flipWriteCursor = ringBuffer.writeCursorBytes;
-		timeMarkers[timeMarkerIndex].flipCursor = audioConfig.expectedFrameBoundaryByte;
-		
-		timeMarkerIndex++;
-		if (timeMarkerIndex > ArrayCount(timeMarkers))
+		// With vsync every present waits for the next refresh
+		stageStart = getWallClock();
+		for (uint32 refresh = 0; refresh < presentation.refreshesPerFrame; refresh++)
+		{
+			sdlUpdateWindow(gWindowBuffer, renderer);
+		}
+		timings.present = getSecondsElapsed(stageStart, getWallClock());
+		if (presentation.mode == PresentMode_Vsync)
+		{
+			sdlCheckVsync(&presentation, &framePacer);
+		}
+		lastPresentSeconds = timings.present;
+
+		// The game thread gets these with the next frame
+		lastFlip.wallClock = getWallClock();
+		lastFlip.playCursor = getRingPlayCursor(&ringBuffer);
+		lastFlip.writeCursor = getRingWriteCursor(&ringBuffer);
+
+		framePipeline.total.input += timings.input;
+		framePipeline.total.simulate += timings.simulate;
+		framePipeline.total.upload += timings.upload;
+		framePipeline.total.wait += timings.wait;
+		framePipeline.total.present += timings.present;
+		framePipeline.frameCount++;
+		if (framePipeline.firstSimulateSeconds == 0.0f)
 		{
-			timeMarkerIndex = 0;
+			framePipeline.firstSimulateSeconds = timings.simulate;
 		}
+	}
 
-		sdl_unloadGameCode(&gameCodeHandles);
-#endif
+	if (framePipeline.depth > 1)
+	{
+		sdlStopFramePipeline(&framePipeline);
+	}
+
+	if (framePipeline.frameCount > 0)
+	{
+		real32 msPerFrameCount = 1000.0f / (real32)framePipeline.frameCount;
+		printf("Average ms per frame, input: %.3f simulate: %.3f upload: %.3f wait: %.3f present: %.3f\n",
+			framePipeline.total.input * msPerFrameCount,
+			framePipeline.total.simulate * msPerFrameCount,
+			framePipeline.total.upload * msPerFrameCount,
+			framePipeline.total.wait * msPerFrameCount,
+			framePipeline.total.present * msPerFrameCount);
+	}
+	if (framePipeline.frameCount > 1)
+	{
+		real32 laterSimulateSeconds = framePipeline.total.simulate - framePipeline.firstSimulateSeconds;
+		printf("Simulate ms, first frame: %.3f after that: %.3f\n",
+			framePipeline.firstSimulateSeconds * 1000.0f,
+			laterSimulateSeconds * 1000.0f / (real32)(framePipeline.frameCount - 1));
 	}
+	printFramePacerStats(&framePacer,
+		(presentation.mode == PresentMode_Vsync) ? "Frame pacing, vsync" : "Frame pacing, timer");
+	if (audioCalibration.lastWriteTime != 0)
+	{
+		printf("Audio: %u underruns (%lu bytes), safety margin %.2f ms, jitter of writes %.2f ms, callbacks %.2f ms\n",
+			audioCalibration.underrunCount, audioCalibration.underrunBytes,
+			audioCalibration.safetySeconds * 1000.0f,
+			getJitterPercentile(&audioCalibration.writeJitter, AUDIO_SAFETY_PERCENTILE) * 1000.0f,
+			getJitterPercentile(&audioCalibration.callbackJitter, AUDIO_SAFETY_PERCENTILE) * 1000.0f);
+	}
+#if HANDMADE_INTERNAL
+	// Arenas are set up by the game, zeros if it never ran
+	game_state* gameState = (game_state*)gameMemory.permanentStoragePointer;
+	transient_state* tranState = (transient_state*)gameMemory.transientStoragePointer;
+	printf("Memory used at most, permanent: %lu KB of %lu MB, transient: %lu KB of %lu MB\n",
+		gameState->arena.highWater / 1024, gameState->arena.size / (1024 * 1024),
+		tranState->arena.highWater / 1024, tranState->arena.size / (1024 * 1024));
+	if (framePipeline.frameCount > 0)
+	{
+		printf("Simulation: %lu ticks of %.2f ms, %.2f per frame, %lu dropped\n",
+			gameState->simulationTickCount, SIMULATION_TICK_SECONDS * 1000.0f,
+			(real32)gameState->simulationTickCount / (real32)framePipeline.frameCount,
+			gameState->droppedTickCount);
+	}
+	if (gWindowBuffer->bytesFullUploadTotal > 0)
+	{
+		printf("Texture upload: %lu KB of %lu KB, %u frames skipped\n",
+			gWindowBuffer->bytesUploadedTotal / 1024,
+			gWindowBuffer->bytesFullUploadTotal / 1024,
+			gWindowBuffer->framesSkipped);
+	}
+#endif
+	// I/O thread may be reading the archive
+	sdlStopAssetQueue(&assetQueue);
+	sdlUnmapAssetArchive(&gameMemory);
 	closeControllers();
 	SDL_CloseAudio();
 	SDL_Quit();
+	sdlStopGameCodeLoader(&gameCodeLoader);
+	sdl_unloadGameCode(&gameCodeHandles);
 	delete gWindowBuffer;
-	free(ringBuffer.data);
+	freeRingBuffer(&ringBuffer);
 	free(gameInputSoundData);
+	freeResampler(&audioResampler);
 	munmap(gameMemory.permanentStoragePointer, gameMemory.permanentStorageSize);
 	return(0);
 }
@@ -531,6 +1207,457 @@ real32 getSecondsElapsed(uint64 start, uint64 end)
 		return secondsElapsed;
 }
 
+uint64 getClockNs(clockid_t clock)
+{
+	struct timespec time;
+	clock_gettime(clock, &time);
+	return (uint64)time.tv_sec * 1000000000ull + (uint64)time.tv_nsec;
+}
+
+void startFramePacer(sdl_frame_pacer* pacer, real32 secondsPerFrame)
+{
+	*pacer = {};
+	pacer->periodNs = (uint64)((real64)secondsPerFrame * 1000000000.0);
+	// 1 ms until there are samples, about what SDL_Delay needs
+	pacer->spinNs = 1000000;
+	// Sleeps of this thread may end up to the timer slack late, 50 us by default
+	prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+	pacer->startNs = getClockNs(CLOCK_MONOTONIC);
+	pacer->startCpuNs = getClockNs(CLOCK_THREAD_CPUTIME_ID);
+	pacer->lastWakeNs = pacer->startNs;
+	pacer->deadlineNs = pacer->startNs + pacer->periodNs;
+}
+
+void recordFrameWake(sdl_frame_pacer* pacer, uint64 wakeNs, bool32 isMissed)
+{
+	// Frames next to a missed one are the game's fault, not the pacer's
+	if (!isMissed && !pacer->lastWasMissed && pacer->frameCount > 0)
+	{
+		real64 error = ((real64)wakeNs - (real64)pacer->lastWakeNs - (real64)pacer->periodNs) / 1000000000.0;
+		pacer->errorSum += error;
+		pacer->errorSquaredSum += error * error;
+		pacer->errorCount++;
+		if (fabs(error) > pacer->maxError)
+		{
+			pacer->maxError = fabs(error);
+		}
+	}
+	pacer->lastWasMissed = isMissed;
+	pacer->lastWakeNs = wakeNs;
+	pacer->frameCount++;
+	if (isMissed)
+	{
+		pacer->missedCount++;
+	}
+}
+
+// Like calibrateAudioLatency, old samples fade out so that the spin
+// follows the system when it gets busier or quieter
+internal void
+updateFramePacerSpin(sdl_frame_pacer* pacer, uint64 latenessNs)
+{
+	uint32 bucket = (uint32)(latenessNs / PACER_LATENESS_BUCKET_NS);
+	if (bucket >= PACER_LATENESS_BUCKETS)
+	{
+		bucket = PACER_LATENESS_BUCKETS - 1;
+	}
+	pacer->latenessCounts[bucket]++;
+	pacer->latenessTotal++;
+	if (pacer->latenessTotal >= PACER_LATENESS_DECAY_COUNT)
+	{
+		pacer->latenessTotal = 0;
+		for (bucket = 0; bucket < PACER_LATENESS_BUCKETS; bucket++)
+		{
+			pacer->latenessCounts[bucket] /= 2;
+			pacer->latenessTotal += pacer->latenessCounts[bucket];
+		}
+	}
+
+	uint32 wantedCount = (uint32)ceilf(PACER_SPIN_PERCENTILE * (real32)pacer->latenessTotal);
+	uint32 count = 0;
+	for (bucket = 0; bucket < PACER_LATENESS_BUCKETS - 1; bucket++)
+	{
+		count += pacer->latenessCounts[bucket];
+		if (count >= wantedCount)
+		{
+			break;
+		}
+	}
+	pacer->spinNs = (bucket + 1) * PACER_LATENESS_BUCKET_NS;
+}
+
+void waitForFrameDeadline(sdl_frame_pacer* pacer)
+{
+	uint64 now = getClockNs(CLOCK_MONOTONIC);
+	bool32 isMissed = (now >= pacer->deadlineNs);
+	if (isMissed)
+	{
+		// More than a frame behind, the frames after this are paced from
+		// now instead of hurrying to catch up
+		if (now - pacer->deadlineNs > pacer->periodNs)
+		{
+			pacer->deadlineNs = now;
+		}
+	}
+	else
+	{
+		if (pacer->deadlineNs - now > pacer->spinNs)
+		{
+			uint64 wakeNs = pacer->deadlineNs - pacer->spinNs;
+			struct timespec wakeTime;
+			wakeTime.tv_sec = wakeNs / 1000000000ull;
+			wakeTime.tv_nsec = wakeNs % 1000000000ull;
+			// Absolute, so a signal that wakes it up early can just sleep again
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeTime, NULL) == EINTR)
+			{
+			}
+
+			now = getClockNs(CLOCK_MONOTONIC);
+			updateFramePacerSpin(pacer, (now > wakeNs) ? now - wakeNs : 0);
+		}
+
+		uint64 spinStart = now;
+		while (now < pacer->deadlineNs)
+		{
+			_mm_pause();
+			now = getClockNs(CLOCK_MONOTONIC);
+		}
+		pacer->spinTotalNs += now - spinStart;
+	}
+
+	recordFrameWake(pacer, now, isMissed);
+	pacer->deadlineNs += pacer->periodNs;
+}
+
+void printFramePacerStats(sdl_frame_pacer* pacer, const char* name)
+{
+	if (pacer->errorCount == 0)
+	{
+		return;
+	}
+	real64 wallNs = (real64)(getClockNs(CLOCK_MONOTONIC) - pacer->startNs);
+	real64 cpuNs = (real64)(getClockNs(CLOCK_THREAD_CPUTIME_ID) - pacer->startCpuNs);
+	real64 meanError = pacer->errorSum / pacer->errorCount;
+	real64 variance = pacer->errorSquaredSum / pacer->errorCount - meanError * meanError;
+	printf("%s: %u frames, %u missed, frame time error mean %.1f us, deviation %.1f us, max %.1f us,"
+		" thread CPU %.1f%% (spinning %.1f%%), spin tail %.0f us\n",
+		name, pacer->frameCount, pacer->missedCount,
+		meanError * 1000000.0, sqrt(variance > 0.0 ? variance : 0.0) * 1000000.0,
+		pacer->maxError * 1000000.0,
+		100.0 * cpuNs / wallNs, 100.0 * (real64)pacer->spinTotalNs / wallNs,
+		(real64)pacer->spinNs / 1000.0);
+}
+
+void sdlMakeWorkQueue(platform_work_queue *queue, uint32 threadCount)
+{
+	SDL_AtomicSet(&queue->completionGoal, 0);
+	SDL_AtomicSet(&queue->completionCount, 0);
+	SDL_AtomicSet(&queue->nextEntryToWrite, 0);
+	SDL_AtomicSet(&queue->nextEntryToRead, 0);
+	queue->semaphore = SDL_CreateSemaphore(0);
+
+	for (uint32 threadIndex = 0;
+		threadIndex < threadCount;
+		threadIndex++)
+	{
+		SDL_Thread *thread = SDL_CreateThread(sdlWorkerThread, "HandmadeWorker", queue);
+		if (thread == NULL)
+		{
+			printf("Could not create worker thread: %s\n", SDL_GetError());
+			continue;
+		}
+		// Workers live as long as the program
+		SDL_DetachThread(thread);
+	}
+}
+
+// Only one thread may add entries to a queue
+PLATFORM_ADD_WORK_ENTRY(sdlAddWorkEntry)
+{
+	uint32 entryToWrite = SDL_AtomicGet(&queue->nextEntryToWrite);
+	uint32 newNextEntryToWrite = (entryToWrite + 1) % ArrayCount(queue->entries);
+	hm_assert(newNextEntryToWrite != (uint32)SDL_AtomicGet(&queue->nextEntryToRead));
+
+	sdl_work_queue_entry *entry = queue->entries + entryToWrite;
+	entry->callback = callback;
+	entry->data = data;
+	SDL_AtomicAdd(&queue->completionGoal, 1);
+
+	// Entry must be visible before the write index moves
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&queue->nextEntryToWrite, newNextEntryToWrite);
+	SDL_SemPost(queue->semaphore);
+}
+
+// Returns true when there was nothing to do
+bool32 sdlDoNextWorkEntry(platform_work_queue *queue)
+{
+	bool32 shouldSleep = false;
+
+	uint32 originalNextEntryToRead = SDL_AtomicGet(&queue->nextEntryToRead);
+	uint32 newNextEntryToRead = (originalNextEntryToRead + 1) % ArrayCount(queue->entries);
+	if (originalNextEntryToRead != (uint32)SDL_AtomicGet(&queue->nextEntryToWrite))
+	{
+		// Several threads race for the same entry, only one wins
+		if (SDL_AtomicCAS(&queue->nextEntryToRead, originalNextEntryToRead, newNextEntryToRead))
+		{
+			SDL_MemoryBarrierAcquire();
+			sdl_work_queue_entry entry = queue->entries[originalNextEntryToRead];
+			entry.callback(queue, entry.data);
+			SDL_AtomicAdd(&queue->completionCount, 1);
+		}
+	}
+	else
+	{
+		shouldSleep = true;
+	}
+
+	return shouldSleep;
+}
+
+PLATFORM_COMPLETE_ALL_WORK(sdlCompleteAllWork)
+{
+	// Help the workers instead of waiting
+	while (SDL_AtomicGet(&queue->completionGoal) != SDL_AtomicGet(&queue->completionCount))
+	{
+		sdlDoNextWorkEntry(queue);
+	}
+
+	SDL_AtomicSet(&queue->completionGoal, 0);
+	SDL_AtomicSet(&queue->completionCount, 0);
+}
+
+int sdlWorkerThread(void *data)
+{
+	platform_work_queue *queue = (platform_work_queue*)data;
+	for (;;)
+	{
+		if (sdlDoNextWorkEntry(queue))
+		{
+			SDL_SemWait(queue->semaphore);
+		}
+	}
+	return 0;
+}
+
+void sdlStartAssetQueue(platform_asset_queue *queue, void *archiveMemory, uint64 archiveSize)
+{
+	queue->mutex = SDL_CreateMutex();
+	queue->semaphore = SDL_CreateSemaphore(0);
+	queue->count = 0;
+	queue->nextSequence = 0;
+	queue->archiveMemory = archiveMemory;
+	queue->archiveSize = archiveSize;
+	queue->loadCount = 0;
+	queue->failCount = 0;
+	queue->bytesLoaded = 0;
+	queue->secondsLoading = 0.0f;
+	SDL_AtomicSet(&queue->quit, 0);
+
+	queue->thread = SDL_CreateThread(sdlAssetThread, "HandmadeAssets", queue);
+	if (queue->thread == NULL)
+	{
+		printf("Could not create asset thread: %s\n", SDL_GetError());
+	}
+}
+
+void sdlStopAssetQueue(platform_asset_queue *queue)
+{
+	// Requests still in the heap are never loaded
+	if (queue->thread)
+	{
+		SDL_AtomicSet(&queue->quit, 1);
+		SDL_SemPost(queue->semaphore);
+		SDL_WaitThread(queue->thread, NULL);
+		queue->thread = NULL;
+	}
+#if HANDMADE_INTERNAL
+	if (queue->loadCount > 0)
+	{
+		printf("Assets loaded: %u (%u failed), %lu KB in %.3f ms\n",
+			queue->loadCount, queue->failCount, queue->bytesLoaded / 1024,
+			queue->secondsLoading * 1000.0f);
+	}
+#endif
+}
+
+// True when a should be loaded before b
+internal bool32
+isAssetLoadBefore(asset_load_request *a, asset_load_request *b)
+{
+	if (a->priority != b->priority)
+	{
+		return a->priority > b->priority;
+	}
+	// Sequence wraps, compare the difference
+	return (int32)(a->sequence - b->sequence) < 0;
+}
+
+PLATFORM_QUEUE_ASSET_LOAD(sdlQueueAssetLoad)
+{
+	bool32 result = false;
+	SDL_LockMutex(queue->mutex);
+	if (queue->thread && queue->count < MAX_ASSET_LOAD_REQUESTS)
+	{
+		request->sequence = queue->nextSequence++;
+		request->state = AssetLoad_Queued;
+
+		// Sift up
+		uint32 index = queue->count++;
+		while (index > 0)
+		{
+			uint32 parent = (index - 1) / 2;
+			if (!isAssetLoadBefore(request, queue->heap[parent]))
+			{
+				break;
+			}
+			queue->heap[index] = queue->heap[parent];
+			index = parent;
+		}
+		queue->heap[index] = request;
+		result = true;
+	}
+	SDL_UnlockMutex(queue->mutex);
+
+	if (result)
+	{
+		SDL_SemPost(queue->semaphore);
+	}
+	return result;
+}
+
+// Loads on the calling thread before returning, for when the results
+// must not depend on how fast the I/O thread is
+PLATFORM_QUEUE_ASSET_LOAD(sdlLoadAssetNow)
+{
+	uint64 start = getWallClock();
+	bool32 loaded = sdlLoadAsset(queue, request);
+	queue->secondsLoading += getSecondsElapsed(start, getWallClock());
+	queue->loadCount++;
+	if (loaded)
+	{
+		queue->bytesLoaded += request->size;
+	}
+	else
+	{
+		queue->failCount++;
+	}
+	request->state = loaded ? AssetLoad_Loaded : AssetLoad_Failed;
+	return true;
+}
+
+internal asset_load_request*
+popAssetLoad(platform_asset_queue *queue)
+{
+	asset_load_request *result = NULL;
+	SDL_LockMutex(queue->mutex);
+	if (queue->count > 0)
+	{
+		result = queue->heap[0];
+
+		// Sift the last one down from the top
+		asset_load_request *last = queue->heap[--queue->count];
+		uint32 index = 0;
+		for (;;)
+		{
+			uint32 child = index * 2 + 1;
+			if (child >= queue->count)
+			{
+				break;
+			}
+			if (child + 1 < queue->count && isAssetLoadBefore(queue->heap[child + 1], queue->heap[child]))
+			{
+				child++;
+			}
+			if (!isAssetLoadBefore(queue->heap[child], last))
+			{
+				break;
+			}
+			queue->heap[index] = queue->heap[child];
+			index = child;
+		}
+		queue->heap[index] = last;
+	}
+	SDL_UnlockMutex(queue->mutex);
+	return result;
+}
+
+bool32 sdlLoadAsset(platform_asset_queue *queue, asset_load_request *request)
+{
+	if (request->fileName == NULL)
+	{
+		// From the archive. The copy is where the pages are read from
+		// the disk, so it happens here and not in the game.
+		if (queue->archiveMemory == NULL
+			|| request->sourceOffset > queue->archiveSize
+			|| request->size > queue->archiveSize - request->sourceOffset)
+		{
+			return false;
+		}
+		memcpy(request->destination, (uint8*)queue->archiveMemory + request->sourceOffset, request->size);
+		return true;
+	}
+
+	int fileDescriptor = open(request->fileName, O_RDONLY);
+	if (fileDescriptor == -1)
+	{
+		return false;
+	}
+
+	uint64 bytesRead = 0;
+	while (bytesRead < request->size)
+	{
+		ssize_t result = pread(fileDescriptor, (uint8*)request->destination + bytesRead,
+			request->size - bytesRead, request->sourceOffset + bytesRead);
+		if (result <= 0)
+		{
+			break;
+		}
+		bytesRead += result;
+	}
+	close(fileDescriptor);
+	return bytesRead == request->size;
+}
+
+int sdlAssetThread(void *data)
+{
+	platform_asset_queue *queue = (platform_asset_queue*)data;
+	// Loading can wait, the game and render threads can not
+	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+	for (;;)
+	{
+		SDL_SemWait(queue->semaphore);
+		if (SDL_AtomicGet(&queue->quit))
+		{
+			break;
+		}
+
+		asset_load_request *request = popAssetLoad(queue);
+		if (request == NULL)
+		{
+			continue;
+		}
+
+		uint64 start = getWallClock();
+		bool32 loaded = sdlLoadAsset(queue, request);
+		queue->secondsLoading += getSecondsElapsed(start, getWallClock());
+		queue->loadCount++;
+		if (loaded)
+		{
+			queue->bytesLoaded += request->size;
+		}
+		else
+		{
+			queue->failCount++;
+		}
+
+		// Data must be all there before the game sees the state
+		__atomic_store_n(&request->state, loaded ? AssetLoad_Loaded : AssetLoad_Failed, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
 int32 SDLGetWindowRefreshRate(SDL_Window* window)
 {
 	SDL_DisplayMode mode;
@@ -611,16 +1738,15 @@ void initAudio(int32 samplesPerSecond, uint32 gameUpdateHz)
 
 		
 	audioConfig.samplesPerSecond = obtained.freq;
+	// Game always mixes at the rate that was asked for, unless
+	// there is no way to convert it
+	audioConfig.gameSamplesPerSecond = samplesPerSecond;
 	// 15th of a second latency
 	audioConfig.bytesPerSample = sizeof(int16) * 2; // left and right for stereo
 	audioConfig.latencyBytes = (audioConfig.samplesPerSecond * audioConfig.bytesPerSample) / gameUpdateHz;
 	audioConfig.toneHz = 256; // how many phases in second
 	audioConfig.toneVolume = 3000;
 	audioConfig.runningSampleIndex = 0;
-	// how long is one phase to get enough Hz in second
-	// -> how many samples for one phase
-	audioConfig.samplesPerWavePeriod = audioConfig.samplesPerSecond / audioConfig.toneHz;
-	audioConfig.halfSamplesPerWavePeriod = audioConfig.samplesPerWavePeriod / 2;
 	
 	audioConfig.sineWavePeriod = 2.0f * PI32;
 	
@@ -630,12 +1756,14 @@ void initAudio(int32 samplesPerSecond, uint32 gameUpdateHz)
 		* audioConfig.bytesPerSample) 
 		/ audioConfig.gameUpdateHz;
 	
-	// TODO This is just a quess. Compute this value and see what the lowest reasonable
-	// value is.
+	// Half a frame to start with, calibrateAudioLatency() brings this
+	// down (or up) once it has measured the machine for a second
 	audioConfig.safetyBytes = ((audioConfig.samplesPerSecond 
 		* audioConfig.bytesPerSample) 
 		/ gameUpdateHz) 
 		/ 2;
+	audioCalibration.safetySeconds = 0.5f / (real32)gameUpdateHz;
+	audioCalibration.expectedCallbackSeconds = (real32)obtained.samples / (real32)obtained.freq;
 	
 	
 	
@@ -645,17 +1773,39 @@ void initAudio(int32 samplesPerSecond, uint32 gameUpdateHz)
 	float latencySeconds = ((float)audioConfig.latencyBytes / (float)audioConfig.bytesPerSample) / (float)audioConfig.samplesPerSecond;
 	printf("Audio latency in seconds is %f\n", latencySeconds);
 	
-	// Create a ring buffer with one second of audio
-	ringBuffer.sizeBytes = audioConfig.samplesPerSecond * audioConfig.bytesPerSample;
-	ringBuffer.data = malloc(ringBuffer.sizeBytes);
-	gameInputSoundData = malloc(ringBuffer.sizeBytes);
-	if (ringBuffer.data != NULL)
+	// Create a ring buffer with (at least) one second of audio
+	if (allocateRingBuffer(&ringBuffer, audioConfig.samplesPerSecond * audioConfig.bytesPerSample))
 	{
-		printf("Reserved a ring buffer of %d bytes\n", ringBuffer.sizeBytes);
+		printf("Reserved a %s ring buffer of %d bytes\n", 
+			ringBuffer.isMirrored ? "mirrored" : "plain", ringBuffer.sizeBytes);
+	}
+	if (!ringBuffer.isMirrored)
+	{
+		gameInputSoundData = malloc(ringBuffer.sizeBytes);
+	}
+
+	if (obtained.freq != samplesPerSecond)
+	{
+		// A write is never longer than the ring, which is rounded up
+		// to whole pages and can be more than a second
+		uint32 ringFrames = ringBuffer.sizeBytes / audioConfig.bytesPerSample;
+		if (initResampler(&audioResampler, samplesPerSecond, obtained.freq, ringFrames))
+		{
+			printf("Resampling game audio from %d Hz to %d Hz\n", samplesPerSecond, obtained.freq);
+		}
+		else
+		{
+			audioConfig.gameSamplesPerSecond = obtained.freq;
+		}
 	}
-	ringBuffer.playCursorBytes = 0;
-	ringBuffer.writeCursorBytes = 0;
-	ringBuffer.updateNeeded = false;
+	// how long is one phase to get enough Hz in second
+	// -> how many samples for one phase
+	audioConfig.samplesPerWavePeriod = audioConfig.gameSamplesPerSecond / audioConfig.toneHz;
+	audioConfig.halfSamplesPerWavePeriod = audioConfig.samplesPerWavePeriod / 2;
+
+	ringBuffer.writtenBytes = 0;
+	ringBuffer.playedBytes = 0;
+	ringBuffer.underrunBytes = 0;
 
 	clearRingBuffer();
 	// start the callbacks
@@ -666,46 +1816,163 @@ void initAudio(int32 samplesPerSecond, uint32 gameUpdateHz)
 void audioCallback(void *userData, uint8 *buffer, int32 bytes)
 {
 	ringBufferInfo* ringInfo = (ringBufferInfo*)userData;
-	uint32 regionSize1bytes = bytes;
+	recordAudioCallback(&audioCalibration, getWallClock());
+	ringBufferConsume(ringInfo, buffer, bytes);
+}
+
+// CONSUMER, only the audio thread calls this.
+// Copies what is ready and plays silence for the rest. Returns the bytes
+// that came from the ring.
+uint32 ringBufferConsume(ringBufferInfo* ring, uint8* output, uint32 bytes)
+{
+	uint64 played = ring->playedBytes;
+	// Acquire pairs with the release in commitRingBufferWrite:
+	// samples before writtenBytes are all there
+	uint64 written = __atomic_load_n(&ring->writtenBytes, __ATOMIC_ACQUIRE);
+
+	uint32 readyBytes = 0;
+	if (written > played)
+	{
+		readyBytes = (written - played < bytes) ? (uint32)(written - played) : bytes;
+	}
+
+	uint32 readPosition = (uint32)(played % ring->sizeBytes);
+	uint32 regionSize1bytes = readyBytes;
 	uint32 regionSize2bytes = 0;
-	if (ringInfo->playCursorBytes + bytes > ringInfo->sizeBytes)
+	if (readPosition + readyBytes > ring->sizeBytes)
 	{
-			regionSize1bytes = ringInfo->sizeBytes - ringInfo->playCursorBytes;
-			regionSize2bytes = bytes - regionSize1bytes;
+		regionSize1bytes = ring->sizeBytes - readPosition;
+		regionSize2bytes = readyBytes - regionSize1bytes;
 	}
-	memcpy(buffer, (uint8*)(ringInfo->data) + ringInfo->playCursorBytes, regionSize1bytes); // to, from, amount
-	memcpy(&buffer[regionSize1bytes], ringInfo->data, regionSize2bytes);
-	
-	ringInfo->playCursorBytes = (ringInfo->playCursorBytes + bytes) % ringInfo->sizeBytes;
-	ringInfo->writeCursorBytes = (ringInfo->playCursorBytes + SDL_AUDIO_BUFFER_SIZE_BYTES) % ringInfo->sizeBytes;
-	ringInfo->updateNeeded = true;
-	
+	memcpy(output, (uint8*)(ring->data) + readPosition, regionSize1bytes); // to, from, amount
+	memcpy(output + regionSize1bytes, ring->data, regionSize2bytes);
+
+	if (readyBytes < bytes)
+	{
+		memset(output + readyBytes, 0, bytes - readyBytes);
+		__atomic_store_n(&ring->underrunBytes, ring->underrunBytes + (bytes - readyBytes), __ATOMIC_RELAXED);
+	}
+
+	// Only what was read. The game may be writing past writtenBytes
+	// right now, the next callback plays that from its start.
+	// Release: the game may write over these bytes only after they are copied.
+	__atomic_store_n(&ring->playedBytes, played + readyBytes, __ATOMIC_RELEASE);
+	return readyBytes;
 }
 
-void clearRingBuffer()
+// PRODUCER, only the game calls these.
+// Bytes that can be written without touching what is not yet played
+uint32 getRingBufferFreeBytes(ringBufferInfo* ring)
 {
+	uint64 played = __atomic_load_n(&ring->playedBytes, __ATOMIC_ACQUIRE);
+	return (uint32)(played + ring->sizeBytes - ring->writtenBytes);
+}
+
+void commitRingBufferWrite(ringBufferInfo* ring, uint32 bytes)
+{
+	// Release: samples must be in memory before the callback sees them
+	__atomic_store_n(&ring->writtenBytes, ring->writtenBytes + bytes, __ATOMIC_RELEASE);
+}
 
-	uint8* bytePointer = (uint8*)ringBuffer.data;
-	for(uint32 i = 0; i < ringBuffer.sizeBytes; i++)
+uint32 getRingPlayCursor(ringBufferInfo* ring)
+{
+	if (ring->sizeBytes == 0)
 	{
-		*bytePointer = 0;
-		bytePointer++;
+		return 0;
 	}
+	uint64 played = __atomic_load_n(&ring->playedBytes, __ATOMIC_ACQUIRE);
+	return (uint32)(played % ring->sizeBytes);
+}
 
-	ringBuffer.updateNeeded = true;
+// Like DirectSound, the earliest place that is safe to write is one
+// SDL buffer after the play cursor
+uint32 getRingWriteCursor(ringBufferInfo* ring)
+{
+	if (ring->sizeBytes == 0)
+	{
+		return 0;
+	}
+	uint64 played = __atomic_load_n(&ring->playedBytes, __ATOMIC_ACQUIRE);
+	return (uint32)((played + SDL_AUDIO_BUFFER_SIZE_BYTES) % ring->sizeBytes);
 }
 
-dualBuffer prepareSoundBuffer()
+// Maps the same pages twice in a row, so that a write that goes over the
+// end of the ring continues at its start. Size is rounded up to pages and
+// stays a whole number of samples, the page size is a multiple of four.
+// Falls back to plain memory when the mapping can not be made.
+bool32 allocateRingBuffer(ringBufferInfo* ring, uint32 minimumBytes)
 {
-	// Initialize to zero
-	dualBuffer soundBuffer;
+	uint32 pageSize = (uint32)sysconf(_SC_PAGESIZE);
+	uint32 size = ((minimumBytes + pageSize - 1) / pageSize) * pageSize;
 
-	if (ringBuffer.updateNeeded)
+	ring->data = NULL;
+	ring->isMirrored = false;
+	int fd = memfd_create("handmade_audio_ring", 0);
+	if (fd != -1 && ftruncate(fd, size) == 0)
 	{
-		ringBuffer.updateNeeded = false;
-		// Lock audio device so that the callback function
-		// does not change the values that we need to get
-		SDL_LockAudioDevice(audioDevice);
+		// Reserve both halves first so that nothing else gets the second one
+		uint8* base = (uint8*)mmap(NULL, 2 * (size_t)size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base != MAP_FAILED)
+		{
+			void* first = mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+			void* second = mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+			if (first == base && second == base + size)
+			{
+				ring->data = base;
+				ring->isMirrored = true;
+			}
+			else
+			{
+				munmap(base, 2 * (size_t)size);
+			}
+		}
+	}
+	if (fd != -1)
+	{
+		// The mappings keep the memory alive
+		close(fd);
+	}
+
+	if (ring->data == NULL)
+	{
+		size = minimumBytes;
+		ring->data = malloc(size);
+	}
+	ring->sizeBytes = (ring->data != NULL) ? size : 0;
+	return ring->data != NULL;
+}
+
+void freeRingBuffer(ringBufferInfo* ring)
+{
+	if (ring->isMirrored)
+	{
+		munmap(ring->data, 2 * (size_t)ring->sizeBytes);
+	}
+	else
+	{
+		free(ring->data);
+	}
+	ring->data = NULL;
+	ring->sizeBytes = 0;
+}
+
+void clearRingBuffer()
+{
+	memset(ringBuffer.data, 0, ringBuffer.sizeBytes);
+}
+
+dualBuffer prepareSoundBuffer()
+{
+	// Initialize to zero
+	dualBuffer soundBuffer;
+
+	// No ring if there is no audio device
+	if (ringBuffer.data != NULL)
+	{
+		// No lock: play cursor is read once and the callback can only
+		// move it forward, which only leaves more room to write.
+		uint32 freeBytes = getRingBufferFreeBytes(&ringBuffer);
+		uint32 playCursorBytes = getRingPlayCursor(&ringBuffer);
 		
 		/*NOTE .
 		 * Here is how sound output computation works
@@ -730,11 +1997,12 @@ dualBuffer prepareSoundBuffer()
 		 * */
 		
 		
-		// We don't actually use the writeCursorBytes to anything, we want 
-		// the part of the buffer where left with runningSampleIndex
+		// We don't actually use the write cursor to anything, we want 
+		// the part of the buffer where we left. That is also where
+		// runningSampleIndex is.
 		
-		uint32 wantedWriteByte = (audioConfig.runningSampleIndex * audioConfig.bytesPerSample) 
-			% ringBuffer.sizeBytes;
+		uint32 wantedWriteByte = (uint32)(ringBuffer.writtenBytes % ringBuffer.sizeBytes);
+		audioConfig.runningSampleIndex = (uint32)(ringBuffer.writtenBytes / audioConfig.bytesPerSample);
 			
 		uint32 targetCursorByte = 0;
 		
@@ -742,7 +2010,7 @@ dualBuffer prepareSoundBuffer()
 		
 		if (audioConfig.audioCardIsLatent)
 		{
-			targetCursorByte = (ringBuffer.playCursorBytes 
+			targetCursorByte = (playCursorBytes 
 			+ audioConfig.expectedSoundBytesPerFrame
 			+ audioConfig.safetyBytes);
 		}
@@ -755,34 +2023,34 @@ dualBuffer prepareSoundBuffer()
 		targetCursorByte = targetCursorByte % ringBuffer.sizeBytes;
 		
 		// simple implementation	
-		// uint32 targetCursorByte = ringBuffer.playCursorBytes + (audioConfig.latencyBytes);
+		// uint32 targetCursorByte = playCursorBytes + (audioConfig.latencyBytes);
 		// targetCursorByte = targetCursorByte % ringBuffer.sizeBytes;
-		uint32 bytesToWrite = 0;
-		
-		SDL_UnlockAudioDevice(audioDevice);
 
-		if (wantedWriteByte > targetCursorByte)
-		{
-			bytesToWrite = ringBuffer.sizeBytes - wantedWriteByte;
-			bytesToWrite += targetCursorByte;
-		}
-		else // write < play
+		// Target and where we are both as distance ahead of the play cursor,
+		// nothing to write if we are already past the target
+		uint32 targetAheadBytes = (targetCursorByte + ringBuffer.sizeBytes - playCursorBytes) % ringBuffer.sizeBytes;
+		uint32 writtenAheadBytes = ringBuffer.sizeBytes - freeBytes;
+		uint32 bytesToWrite = 0;
+		if (targetAheadBytes > writtenAheadBytes)
 		{
-			bytesToWrite = targetCursorByte - wantedWriteByte;
+			bytesToWrite = targetAheadBytes - writtenAheadBytes;
 		}
+		// Whole samples only
+		bytesToWrite -= bytesToWrite % audioConfig.bytesPerSample;
 		
 #if HANDMADE_INTERNAL
 		// save to debug marker 
-		timeMarkersPointer[timeMarkerIndex].outputPlayCursor = ringBuffer.playCursorBytes;
-		timeMarkersPointer[timeMarkerIndex].outputWriteCursor = ringBuffer.writeCursorBytes;
-		timeMarkersPointer[timeMarkerIndex].outputLocation = wantedWriteByte;
-		timeMarkersPointer[timeMarkerIndex].outputByteCount = bytesToWrite;
+		timeMarkers[timeMarkerIndex].outputPlayCursor = playCursorBytes;
+		timeMarkers[timeMarkerIndex].outputWriteCursor = getRingWriteCursor(&ringBuffer);
+		timeMarkers[timeMarkerIndex].outputLocation = wantedWriteByte;
+		timeMarkers[timeMarkerIndex].outputByteCount = bytesToWrite;
 #endif
 		void* region1start = (uint8*)ringBuffer.data + wantedWriteByte;
 		uint32 region1sizeBytes = bytesToWrite;
 		
-		// Check if about to write over the end of buffer
-		if (wantedWriteByte + region1sizeBytes > ringBuffer.sizeBytes)
+		// Check if about to write over the end of buffer,
+		// a mirrored ring just continues to its second mapping
+		if (!ringBuffer.isMirrored && wantedWriteByte + region1sizeBytes > ringBuffer.sizeBytes)
 		{
 			region1sizeBytes = ringBuffer.sizeBytes - wantedWriteByte;
 		}
@@ -812,57 +2080,431 @@ void writeSoundBuffer(game_sound_buffer& gameInputBuffer, dualBuffer& requiredBu
 	{
 		return;
 	}
-	//write from gameInputSoundData to ringbuffer as directed by parameters
-	
-#if 0
-	// Simple copy version
-	uint32 bytesToCopy1 = requiredBuffer.region1Samples * audioConfig.bytesPerSample;
-	uint32 bytesToCopy2 = requiredBuffer.region2Samples * audioConfig.bytesPerSample;
 	
-	void* destination = memcpy(requiredBuffer.region1Start, gameInputBuffer.samples, bytesToCopy1);
-	memcpy(requiredBuffer.region2Start, (uint8*)(gameInputBuffer.samples) + bytesToCopy1, bytesToCopy2);
-	
-	
-#else
-	
-	int16 *inputSample = (int16*)gameInputBuffer.samples;
-	int16 *ringBufferSample = (int16*)requiredBuffer.region1Start;
-	
-	uint32 samplesToCopy = requiredBuffer.region1Samples;
-	for(uint32 s = 0; s < samplesToCopy; s++)
+	// Copy from gameInputSoundData to the ring buffer, unless the
+	// game already wrote straight into it
+	if (gameInputBuffer.samples != requiredBuffer.region1Start)
 	{
+		uint32 bytesToCopy1 = requiredBuffer.region1Samples * audioConfig.bytesPerSample;
+		uint32 bytesToCopy2 = requiredBuffer.region2Samples * audioConfig.bytesPerSample;
+		
+		memcpy(requiredBuffer.region1Start, gameInputBuffer.samples, bytesToCopy1);
+		if (bytesToCopy2 > 0)
+		{
+			memcpy(requiredBuffer.region2Start, (uint8*)(gameInputBuffer.samples) + bytesToCopy1, bytesToCopy2);
+		}
+	}
 
-		// STEREO SOUND: each sample consist of two data points 
-		(*ringBufferSample) = (*inputSample);
+	// Now the callback may play them
+	uint32 bytesWritten = (requiredBuffer.region1Samples + requiredBuffer.region2Samples)
+		* audioConfig.bytesPerSample;
+	commitRingBufferWrite(&ringBuffer, bytesWritten);
+}
 
-		ringBufferSample++;
-		inputSample++;
-		
-		(*ringBufferSample) = (*inputSample);
+// ** AUDIO LATENCY CALIBRATION
 
-		ringBufferSample++;
-		inputSample++;
-		
+void addJitterSample(sdl_jitter_histogram* histogram, real32 seconds)
+{
+	uint32 bucket = 0;
+	if (seconds > 0.0f)
+	{
+		bucket = (uint32)(seconds / AUDIO_JITTER_BUCKET_SECONDS);
+		if (bucket >= AUDIO_JITTER_BUCKETS)
+		{
+			bucket = AUDIO_JITTER_BUCKETS - 1;
+		}
 	}
-	
-	uint32 samplesToCopy2 = requiredBuffer.region2Samples;
-	if (samplesToCopy2 > 0)
+	histogram->counts[bucket]++;
+	histogram->total++;
+}
+
+// Halves every count, so old samples matter less and less and a
+// single spike is forgotten after a while
+void decayJitterHistogram(sdl_jitter_histogram* histogram)
+{
+	histogram->total = 0;
+	for (uint32 bucket = 0; bucket < AUDIO_JITTER_BUCKETS; bucket++)
+	{
+		histogram->counts[bucket] /= 2;
+		histogram->total += histogram->counts[bucket];
+	}
+}
+
+// Upper edge of the bucket where fraction of the samples are at or below
+real32 getJitterPercentile(sdl_jitter_histogram* histogram, real32 fraction)
+{
+	uint32 wantedCount = (uint32)ceilf(fraction * (real32)histogram->total);
+	uint32 count = 0;
+	uint32 bucket = 0;
+	for (; bucket < AUDIO_JITTER_BUCKETS - 1; bucket++)
 	{
-		ringBufferSample = (int16*)requiredBuffer.region2Start;	
-		for(uint32 s = 0; s < samplesToCopy2; s++)
+		count += histogram->counts[bucket];
+		if (count >= wantedCount)
 		{
-			(*ringBufferSample) = (*inputSample);
+			break;
+		}
+	}
+	return (real32)(bucket + 1) * AUDIO_JITTER_BUCKET_SECONDS;
+}
 
-			ringBufferSample++;
-			inputSample++;
-			
-			(*ringBufferSample) = (*inputSample);
+// Audio thread, must not wait for anything
+void recordAudioCallback(sdl_audio_calibration* calibration, uint64 time)
+{
+	uint64 written = calibration->callbacksWritten;
+	calibration->callbackTimes[written % AUDIO_CALLBACK_TIMES] = time;
+	__atomic_store_n(&calibration->callbacksWritten, written + 1, __ATOMIC_RELEASE);
+}
+
+// Game side, called once before every sound write
+void calibrateAudioLatency(sdl_audio_calibration* calibration, uint64 writeTime)
+{
+	if (ringBuffer.data == NULL)
+	{
+		return;
+	}
+
+	// Callback arrivals since the last write
+	uint64 written = __atomic_load_n(&calibration->callbacksWritten, __ATOMIC_ACQUIRE);
+	if (written - calibration->callbacksRead > AUDIO_CALLBACK_TIMES)
+	{
+		// Game was away too long, the oldest times are gone
+		calibration->callbacksRead = written - AUDIO_CALLBACK_TIMES;
+		calibration->lastCallbackTime = 0;
+	}
+	for (; calibration->callbacksRead < written; calibration->callbacksRead++)
+	{
+		uint64 time = calibration->callbackTimes[calibration->callbacksRead % AUDIO_CALLBACK_TIMES];
+		if (calibration->lastCallbackTime != 0)
+		{
+			real32 interval = getSecondsElapsed(calibration->lastCallbackTime, time);
+			addJitterSample(&calibration->callbackJitter, fabsf(interval - calibration->expectedCallbackSeconds));
+		}
+		calibration->lastCallbackTime = time;
+	}
 
-			ringBufferSample++;
-			inputSample++;
+	// What the device played since the last write, silence included. If it
+	// is more than one frame, the margin has to cover the difference or the
+	// callback runs dry.
+	// Acquire first, the underrun count is then at least as new
+	uint64 played = __atomic_load_n(&ringBuffer.playedBytes, __ATOMIC_ACQUIRE);
+	uint64 underrun = __atomic_load_n(&ringBuffer.underrunBytes, __ATOMIC_RELAXED);
+	played += underrun;
+	real32 bytesPerSecond = (real32)(audioConfig.samplesPerSecond * audioConfig.bytesPerSample);
+
+	// Pauses and the first write are not part of the normal timing
+	if (calibration->lastWriteTime != 0
+		&& getSecondsElapsed(calibration->lastWriteTime, writeTime) < 8.0f * audioConfig.targetSecondsPerFrame)
+	{
+		real32 playedSeconds = (real32)(played - calibration->lastWritePlayedBytes) / bytesPerSecond;
+		addJitterSample(&calibration->writeJitter, playedSeconds - audioConfig.targetSecondsPerFrame);
+
+		if (underrun > calibration->lastUnderrunBytes)
+		{
+			uint64 missedBytes = underrun - calibration->lastUnderrunBytes;
+			calibration->underrunCount++;
+			calibration->underrunBytes += missedBytes;
+			calibration->underrunSeconds += (real32)missedBytes / bytesPerSecond + AUDIO_JITTER_BUCKET_SECONDS;
 		}
 	}
-#endif
+	calibration->lastWriteTime = writeTime;
+	calibration->lastWritePlayedBytes = played;
+	calibration->lastUnderrunBytes = underrun;
+
+	// Keep about ten seconds of history
+	uint32 windowCount = 10 * audioConfig.gameUpdateHz;
+	if (calibration->writeJitter.total >= windowCount)
+	{
+		decayJitterHistogram(&calibration->writeJitter);
+	}
+	if (calibration->callbackJitter.total >= windowCount)
+	{
+		decayJitterHistogram(&calibration->callbackJitter);
+	}
+
+	// Keep the first guess until there is a second of measurements
+	if (calibration->writeJitter.total >= audioConfig.gameUpdateHz)
+	{
+		real32 writeSeconds = getJitterPercentile(&calibration->writeJitter, AUDIO_SAFETY_PERCENTILE);
+		real32 callbackSeconds = getJitterPercentile(&calibration->callbackJitter, AUDIO_SAFETY_PERCENTILE);
+		real32 safetySeconds = ((writeSeconds > callbackSeconds) ? writeSeconds : callbackSeconds)
+			+ AUDIO_JITTER_BUCKET_SECONDS + calibration->underrunSeconds;
+
+		// Never more than two frames, then the game is just too slow
+		real32 maxSeconds = 2.0f * audioConfig.targetSecondsPerFrame;
+		calibration->safetySeconds = (safetySeconds < maxSeconds) ? safetySeconds : maxSeconds;
+
+		// Half of it is gone in about two seconds at 30 Hz
+		calibration->underrunSeconds *= 0.99f;
+	}
+
+	audioConfig.safetyBytes = (int32)(calibration->safetySeconds * (real32)audioConfig.samplesPerSecond)
+		* audioConfig.bytesPerSample;
+}
+
+internal uint32
+greatestCommonDivisor(uint32 a, uint32 b)
+{
+	while (b != 0)
+	{
+		uint32 remainder = a % b;
+		a = b;
+		b = remainder;
+	}
+	return a;
+}
+
+// Modified Bessel function of the first kind, for the Kaiser window
+internal real64
+besselI0(real64 x)
+{
+	real64 sum = 1.0;
+	real64 term = 1.0;
+	for (int32 k = 1; k < 32; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+bool32 initResampler(sdl_resampler* resampler, uint32 inputRate, uint32 outputRate, uint32 maxOutputFrames)
+{
+	*resampler = {};
+	uint32 divisor = greatestCommonDivisor(inputRate, outputRate);
+	uint32 phaseCount = outputRate / divisor;
+	uint32 inputStep = inputRate / divisor;
+	if (phaseCount > MAX_RESAMPLER_PHASES)
+	{
+		printf("Can not resample %u Hz to %u Hz, needs %u filters\n", inputRate, outputRate, phaseCount);
+		return false;
+	}
+
+	// Low pass below the lower of the two Nyquist frequencies, a bit
+	// lower still so that the transition band is mostly under it
+	real64 cutoff = 0.9 * ((outputRate < inputRate) ? (real64)outputRate / (real64)inputRate : 1.0);
+	real64 beta = 8.6; // Kaiser window, about 85 dB stop band
+	real64 halfTaps = RESAMPLER_TAPS / 2;
+
+	resampler->filters = (real32*)malloc(phaseCount * RESAMPLER_TAPS * sizeof(real32));
+	for (uint32 phase = 0; phase < phaseCount; phase++)
+	{
+		// Output is phase / phaseCount after input halfTaps - 1
+		real32* filter = resampler->filters + phase * RESAMPLER_TAPS;
+		real64 sum = 0.0;
+		for (uint32 tap = 0; tap < RESAMPLER_TAPS; tap++)
+		{
+			real64 distance = (real64)tap - (halfTaps - 1.0) - (real64)phase / (real64)phaseCount;
+			real64 x = cutoff * distance;
+			real64 sinc = (x == 0.0) ? 1.0 : sin(PI32 * x) / (PI32 * x);
+			real64 windowPosition = distance / halfTaps;
+			real64 window = 0.0;
+			if (windowPosition > -1.0 && windowPosition < 1.0)
+			{
+				window = besselI0(beta * sqrt(1.0 - windowPosition * windowPosition)) / besselI0(beta);
+			}
+			filter[tap] = (real32)(sinc * window);
+			sum += filter[tap];
+		}
+		// Every phase passes a constant through as it is
+		for (uint32 tap = 0; tap < RESAMPLER_TAPS; tap++)
+		{
+			filter[tap] = (real32)(filter[tap] / sum);
+		}
+	}
+
+	uint32 maxInputFrames = (uint32)(((uint64)maxOutputFrames * inputStep) / phaseCount) + 1 + RESAMPLER_TAPS;
+	resampler->historyCapacity = maxInputFrames + RESAMPLER_TAPS;
+	resampler->history[0] = (real32*)malloc(2 * resampler->historyCapacity * sizeof(real32));
+	resampler->history[1] = resampler->history[0] + resampler->historyCapacity;
+	resampler->inputCapacity = maxInputFrames;
+	resampler->input = (int16*)malloc(2 * maxInputFrames * sizeof(int16));
+
+	if (resampler->filters == NULL || resampler->history[0] == NULL || resampler->input == NULL)
+	{
+		freeResampler(resampler);
+		return false;
+	}
+
+	resampler->inputRate = inputRate;
+	resampler->outputRate = outputRate;
+	resampler->phaseCount = phaseCount;
+	resampler->inputStep = inputStep;
+	return true;
+}
+
+void freeResampler(sdl_resampler* resampler)
+{
+	free(resampler->filters);
+	free(resampler->history[0]);
+	free(resampler->input);
+	*resampler = {};
+}
+
+// Inputs to add before outputFrames more outputs can be made
+uint32 getResamplerInputFrames(sdl_resampler* resampler, uint32 outputFrames)
+{
+	if (outputFrames == 0)
+	{
+		return 0;
+	}
+	uint64 lastPhase = resampler->phase + (uint64)(outputFrames - 1) * resampler->inputStep;
+	uint64 lastBase = resampler->nextBase + lastPhase / resampler->phaseCount;
+	uint64 needed = lastBase + RESAMPLER_TAPS;
+	return (needed > resampler->historyCount) ? (uint32)(needed - resampler->historyCount) : 0;
+}
+
+// Moves to the next output, the same in every kernel
+internal inline void
+advanceResampler(sdl_resampler* resampler, uint32* base, uint32* phase)
+{
+	*phase += resampler->inputStep;
+	while (*phase >= resampler->phaseCount)
+	{
+		*phase -= resampler->phaseCount;
+		(*base)++;
+	}
+}
+
+internal inline void
+storeResampledFrame(int16* output, real32 left, real32 right)
+{
+	__m128 minValue = _mm_set1_ps(-32768.0f);
+	__m128 maxValue = _mm_set1_ps(32767.0f);
+	output[0] = (int16)_mm_cvtss_si32(_mm_min_ss(_mm_max_ss(_mm_set_ss(left), minValue), maxValue));
+	output[1] = (int16)_mm_cvtss_si32(_mm_min_ss(_mm_max_ss(_mm_set_ss(right), minValue), maxValue));
+}
+
+RESAMPLE_FRAMES(resampleFramesScalar)
+{
+	uint32 base = resampler->nextBase;
+	uint32 phase = resampler->phase;
+	for (uint32 frame = 0; frame < outputCount; frame++)
+	{
+		real32* filter = resampler->filters + phase * RESAMPLER_TAPS;
+		real32* left = resampler->history[0] + base;
+		real32* right = resampler->history[1] + base;
+		real32 leftSum = 0.0f;
+		real32 rightSum = 0.0f;
+		for (uint32 tap = 0; tap < RESAMPLER_TAPS; tap++)
+		{
+			leftSum += left[tap] * filter[tap];
+			rightSum += right[tap] * filter[tap];
+		}
+		storeResampledFrame(output + 2 * frame, leftSum, rightSum);
+		advanceResampler(resampler, &base, &phase);
+	}
+	resampler->nextBase = base;
+	resampler->phase = phase;
+}
+
+internal inline real32
+horizontalSum(__m128 value)
+{
+	__m128 pairs = _mm_add_ps(value, _mm_movehl_ps(value, value));
+	__m128 sum = _mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1));
+	return _mm_cvtss_f32(sum);
+}
+
+RESAMPLE_FRAMES(resampleFramesSSE2)
+{
+	uint32 base = resampler->nextBase;
+	uint32 phase = resampler->phase;
+	for (uint32 frame = 0; frame < outputCount; frame++)
+	{
+		real32* filter = resampler->filters + phase * RESAMPLER_TAPS;
+		real32* left = resampler->history[0] + base;
+		real32* right = resampler->history[1] + base;
+
+		// Two sums per channel so that the adds do not wait for each other
+		__m128 leftSum0 = _mm_setzero_ps();
+		__m128 leftSum1 = _mm_setzero_ps();
+		__m128 rightSum0 = _mm_setzero_ps();
+		__m128 rightSum1 = _mm_setzero_ps();
+		for (uint32 tap = 0; tap < RESAMPLER_TAPS; tap += 8)
+		{
+			__m128 filter0 = _mm_loadu_ps(filter + tap);
+			__m128 filter1 = _mm_loadu_ps(filter + tap + 4);
+			leftSum0 = _mm_add_ps(leftSum0, _mm_mul_ps(_mm_loadu_ps(left + tap), filter0));
+			leftSum1 = _mm_add_ps(leftSum1, _mm_mul_ps(_mm_loadu_ps(left + tap + 4), filter1));
+			rightSum0 = _mm_add_ps(rightSum0, _mm_mul_ps(_mm_loadu_ps(right + tap), filter0));
+			rightSum1 = _mm_add_ps(rightSum1, _mm_mul_ps(_mm_loadu_ps(right + tap + 4), filter1));
+		}
+		storeResampledFrame(output + 2 * frame,
+			horizontalSum(_mm_add_ps(leftSum0, leftSum1)), horizontalSum(_mm_add_ps(rightSum0, rightSum1)));
+		advanceResampler(resampler, &base, &phase);
+	}
+	resampler->nextBase = base;
+	resampler->phase = phase;
+}
+
+__attribute__((target("avx2")))
+RESAMPLE_FRAMES(resampleFramesAVX2)
+{
+	uint32 base = resampler->nextBase;
+	uint32 phase = resampler->phase;
+	for (uint32 frame = 0; frame < outputCount; frame++)
+	{
+		real32* filter = resampler->filters + phase * RESAMPLER_TAPS;
+		real32* left = resampler->history[0] + base;
+		real32* right = resampler->history[1] + base;
+
+		__m256 leftSum0 = _mm256_setzero_ps();
+		__m256 leftSum1 = _mm256_setzero_ps();
+		__m256 rightSum0 = _mm256_setzero_ps();
+		__m256 rightSum1 = _mm256_setzero_ps();
+		for (uint32 tap = 0; tap < RESAMPLER_TAPS; tap += 16)
+		{
+			__m256 filter0 = _mm256_loadu_ps(filter + tap);
+			__m256 filter1 = _mm256_loadu_ps(filter + tap + 8);
+			leftSum0 = _mm256_add_ps(leftSum0, _mm256_mul_ps(_mm256_loadu_ps(left + tap), filter0));
+			leftSum1 = _mm256_add_ps(leftSum1, _mm256_mul_ps(_mm256_loadu_ps(left + tap + 8), filter1));
+			rightSum0 = _mm256_add_ps(rightSum0, _mm256_mul_ps(_mm256_loadu_ps(right + tap), filter0));
+			rightSum1 = _mm256_add_ps(rightSum1, _mm256_mul_ps(_mm256_loadu_ps(right + tap + 8), filter1));
+		}
+		__m256 leftSum = _mm256_add_ps(leftSum0, leftSum1);
+		__m256 rightSum = _mm256_add_ps(rightSum0, rightSum1);
+		__m128 leftHalves = _mm_add_ps(_mm256_castps256_ps128(leftSum), _mm256_extractf128_ps(leftSum, 1));
+		__m128 rightHalves = _mm_add_ps(_mm256_castps256_ps128(rightSum), _mm256_extractf128_ps(rightSum, 1));
+		storeResampledFrame(output + 2 * frame, horizontalSum(leftHalves), horizontalSum(rightHalves));
+		advanceResampler(resampler, &base, &phase);
+	}
+	resampler->nextBase = base;
+	resampler->phase = phase;
+}
+
+resample_frames* getResampleFramesKernel()
+{
+	local_persist resample_frames* kernel = NULL;
+	if (kernel == NULL)
+	{
+		kernel = SDL_HasAVX2() ? resampleFramesAVX2 : resampleFramesSSE2;
+	}
+	return kernel;
+}
+
+// Input must be getResamplerInputFrames(outputFrames) frames
+void resampleAudio(resample_frames* kernel, sdl_resampler* resampler, 
+	int16* input, uint32 inputFrames, int16* output, uint32 outputFrames)
+{
+	hm_assert(resampler->historyCount + inputFrames <= resampler->historyCapacity);
+	real32* left = resampler->history[0] + resampler->historyCount;
+	real32* right = resampler->history[1] + resampler->historyCount;
+	for (uint32 frame = 0; frame < inputFrames; frame++)
+	{
+		left[frame] = input[2 * frame];
+		right[frame] = input[2 * frame + 1];
+	}
+	resampler->historyCount += inputFrames;
+
+	kernel(resampler, output, outputFrames);
+
+	// Drop the inputs that no output needs anymore
+	uint32 drop = (resampler->nextBase < resampler->historyCount) ? resampler->nextBase : resampler->historyCount;
+	uint32 keep = resampler->historyCount - drop;
+	memmove(resampler->history[0], resampler->history[0] + drop, keep * sizeof(real32));
+	memmove(resampler->history[1], resampler->history[1] + drop, keep * sizeof(real32));
+	resampler->historyCount = keep;
+	resampler->nextBase -= drop;
 }
 
 void handleEvent(SDL_Event *event)
@@ -1141,7 +2783,7 @@ void handleKey(SDL_Keycode keyCode, bool wasDown)
 		{
 			if (down)
 			{
-				globalPause = !globalPause;
+				SDL_AtomicSet(&globalPause, !SDL_AtomicGet(&globalPause));
 			}
 		} break;
 #endif 
@@ -1150,13 +2792,34 @@ void handleKey(SDL_Keycode keyCode, bool wasDown)
 
 void handleWindowResizeEvent(SDL_Event* event)
 {
+	// Texture stays the same, only the place where it is drawn changes.
+	// No memory is allocated here.
 	WindowDimensions d = getWindowDimensions(event->window.windowID);
-	SDL_Renderer* r = getRenderer(event->window.windowID);
-	if (r)
+	sdlUpdatePresentRect(gWindowBuffer, d.width, d.height);
+}
+
+void sdlUpdatePresentRect(WindowBuffer *buffer, int32 windowWidth, int32 windowHeight)
+{
+	// Largest rect with the aspect ratio of the backbuffer that fits
+	// the window, centered. The rest is black bars.
+	int32 width = windowWidth;
+	int32 height = windowHeight;
+	if (buffer->bitmapWidth > 0 && buffer->bitmapHeight > 0)
 	{
-			sdlResizeWindowTexture(gWindowBuffer, r, d.width, d.height);
+		if ((int64)windowWidth * buffer->bitmapHeight > (int64)windowHeight * buffer->bitmapWidth)
+		{
+			width = (int32)(((int64)windowHeight * buffer->bitmapWidth) / buffer->bitmapHeight);
+		}
+		else
+		{
+			height = (int32)(((int64)windowWidth * buffer->bitmapHeight) / buffer->bitmapWidth);
+		}
 	}
 
+	buffer->presentRect.x = (windowWidth - width) / 2;
+	buffer->presentRect.y = (windowHeight - height) / 2;
+	buffer->presentRect.w = width;
+	buffer->presentRect.h = height;
 }
 
 void sdlResizeWindowTexture(WindowBuffer *buffer, SDL_Renderer *renderer, int32 width, int32 height)
@@ -1191,6 +2854,7 @@ void sdlResizeWindowTexture(WindowBuffer *buffer, SDL_Renderer *renderer, int32
 	}
 	else
 	{
+		buffer->contentsValid = false;
 		if (buffer->bitmapMemory)
 		{
 			// if we used malloc, here would be free()
@@ -1244,12 +2908,15 @@ void sdlResizeWindowTexture(WindowBuffer *buffer, SDL_Renderer *renderer, int32
 		if (buffer->bitmapMemory == MAP_FAILED)
 		{
 			printf("Could not map memory for bitmap buffer\n");
+			buffer->bitmapMemory = NULL;
 		}
 	}
+	buffer->fullFrameBytes = width * height * buffer->bytesPerPixel;
 }
 
 
-void updateGame(WindowBuffer* windowBuffer, game_input_state& inputState, game_memory& gameMemory)
+void updateGame(game_pixel_buffer* pixelBuffer, game_input_state& inputState, game_memory& gameMemory,
+	sdl_flip_info& flip)
 {
 	hm_assert(sizeof(game_state) <= gameMemory.permanentStorageSize);
 	game_state* gameState = (game_state*)gameMemory.permanentStoragePointer;
@@ -1269,26 +2936,39 @@ void updateGame(WindowBuffer* windowBuffer, game_input_state& inputState, game_m
 		gameMemory.isInitialized = true;
 	}
 
+	// Real time since the last update, the game simulates it in its own
+	// fixed ticks. Time in pause is counted too, the game drops what it
+	// can not simulate in one frame.
+	local_persist uint64 lastUpdateCounter = 0;
+	uint64 updateCounter = getWallClock();
+	inputState.secondsElapsed = (lastUpdateCounter != 0)
+		? getSecondsElapsed(lastUpdateCounter, updateCounter)
+		: audioConfig.targetSecondsPerFrame;
+	lastUpdateCounter = updateCounter;
+
 	// Update graphics first and then sound.
 	
 	// Graphics update
 
-		game_pixel_buffer gamePixelBuffer = preparePixelBuffer(windowBuffer);
-
 		// Game modifies the given buffers
-		gameCodeHandles.updateAndRender(&gameMemory, &gamePixelBuffer, &inputState, gameState);
+		gameCodeHandles.updateAndRender(&gameMemory, pixelBuffer, &inputState, gameState);
 		
 	// Sound update
 		
 		uint64 audioWallClock = getWallClock();
+		audioConfig.flipWallClock = flip.wallClock;
 		real32 fromBeginToAudioSeconds  = getSecondsElapsed(audioConfig.flipWallClock, audioWallClock);
 
-		real32 secondsLeftUntilFlip = (audioConfig.targetSecondsPerFrame - fromBeginToAudioSeconds);
+		// Pipelined, this frame is presented depth - 1 flips after the
+		// next one, while the main thread shows the frames before it
+		uint32 framesAhead = framePipeline.depth - 1;
+		real32 secondsLeftUntilFlip = ((real32)(framesAhead + 1) * audioConfig.targetSecondsPerFrame
+			- fromBeginToAudioSeconds);
 		audioConfig.expectedBytesUntilFlip = (int32)((secondsLeftUntilFlip / audioConfig.targetSecondsPerFrame) * (real32)audioConfig.expectedSoundBytesPerFrame);
 		
 		// inspect audio latency
-		int playCursor = ringBuffer.playCursorBytes;
-		int writeCursor = ringBuffer.writeCursorBytes;
+		int playCursor = getRingPlayCursor(&ringBuffer);
+		int writeCursor = getRingWriteCursor(&ringBuffer);
 		if (writeCursor < playCursor)
 		{
 			writeCursor += ringBuffer.sizeBytes;
@@ -1300,12 +2980,19 @@ void updateGame(WindowBuffer* windowBuffer, game_input_state& inputState, game_m
 			
 		audioConfig.currentLatencyBytes = bytesBetweenAudioCursors;
 		audioConfig.currentLatencySeconds = secondsBetweenCursors;
-		
-		printf("Delta: %d : %f\n", bytesBetweenAudioCursors, secondsBetweenCursors);
+
+		// Safety margin for this write from what the last ones needed
+		calibrateAudioLatency(&audioCalibration, audioWallClock);
 		
 		// Find out whether audio card is latent. Used in prepareSoundBuffer
 		
 		audioConfig.expectedFrameBoundaryByte = playCursor + audioConfig.expectedBytesUntilFlip;
+
+#if HANDMADE_INTERNAL
+		timeMarkers[timeMarkerIndex].flipPlayCursor = flip.playCursor;
+		timeMarkers[timeMarkerIndex].flipWriteCursor = flip.writeCursor;
+		timeMarkers[timeMarkerIndex].flipCursor = audioConfig.expectedFrameBoundaryByte;
+#endif
 		
 		// Normalize  
 		int safeWriteCursorByte = writeCursor;
@@ -1325,81 +3012,501 @@ void updateGame(WindowBuffer* windowBuffer, game_input_state& inputState, game_m
 		
 		dualBuffer preparedBuffer = prepareSoundBuffer();
 		game_sound_buffer gameSoundBuffer;
+		uint32 deviceSamples = preparedBuffer.region1Samples + preparedBuffer.region2Samples;
 		
-		gameSoundBuffer.samples = gameInputSoundData;
-		gameSoundBuffer.samplesToWrite = preparedBuffer.region1Samples 
-		+ preparedBuffer.region2Samples;
+		// A mirrored ring gives one contiguous region, so the device
+		// samples are written in place. Otherwise they go to
+		// gameInputSoundData and are copied to the two regions.
+		void* deviceOutput = ringBuffer.isMirrored ? preparedBuffer.region1Start : gameInputSoundData;
 		
-		if (gameSoundBuffer.samplesToWrite > 0)
+		// With a resampler the game writes at its own rate and the
+		// converted samples go to the device output
+		bool32 isResampling = audioResampler.phaseCount != 0;
+		if (isResampling)
 		{
-			memset(gameInputSoundData, 0, ringBuffer.sizeBytes);
+			gameSoundBuffer.samples = audioResampler.input;
+			gameSoundBuffer.samplesToWrite = getResamplerInputFrames(&audioResampler, deviceSamples);
+		}
+		else
+		{
+			gameSoundBuffer.samples = deviceOutput;
+			gameSoundBuffer.samplesToWrite = deviceSamples;
 		}
 		
-		
+
 		gameSoundBuffer.tForSine = audioConfig.tForSine;
 		gameSoundBuffer.runningSampleIndex = audioConfig.runningSampleIndex;
 		gameSoundBuffer.samplesPerWavePeriod = audioConfig.samplesPerWavePeriod;
+		gameSoundBuffer.samplesPerSecond = audioConfig.gameSamplesPerSecond;
 		
 		gameCodeHandles.getSoundSamples(&gameMemory, &gameSoundBuffer);
 		audioConfig.tForSine = gameSoundBuffer.tForSine;
 		audioConfig.runningSampleIndex = gameSoundBuffer.runningSampleIndex;
 		
+		if (isResampling)
+		{
+			resampleAudio(getResampleFramesKernel(), &audioResampler, 
+				audioResampler.input, gameSoundBuffer.samplesToWrite,
+				(int16*)deviceOutput, deviceSamples);
+			gameSoundBuffer.samples = deviceOutput;
+			gameSoundBuffer.samplesToWrite = deviceSamples;
+		}
 	
-	// Write output from game to buffers
-	
+	// Write sound output from game to ring buffer, pixels are uploaded
+	// by the caller
+
 	writeSoundBuffer(gameSoundBuffer, preparedBuffer);
-	renderPixelBuffer(windowBuffer);
-}
 
-game_pixel_buffer preparePixelBuffer(WindowBuffer* buffer)
-{
-	game_pixel_buffer gameScreenBuffer;
-	void *texturePixels = NULL;
-	int32 result = 0;
-	int32 texturePitch = 0;
+#if HANDMADE_INTERNAL
+	// Debug audio timing, drawn by the thread that owns the markers
+	SDLDebugSyncDisplay(*pixelBuffer, ArrayCount(timeMarkers)
+		, timeMarkers, timeMarkerIndex, ringBuffer);
 
-	if (getUseSDLTextureLock())
+	timeMarkerIndex++;
+	if (timeMarkerIndex >= ArrayCount(timeMarkers))
 	{
-		result = SDL_LockTexture(buffer->texture,
-			NULL, // Replace all
-			&texturePixels,	
-			&texturePitch);
+		timeMarkerIndex = 0;
 	}
-	else
+#endif
+}
+
+sdl_page_mode getPageModeArgument(int argc, char *argv[])
+{
+	sdl_page_mode mode = PageMode_Normal;
+	const char* option = "--pages=";
+	for (int i = 1; i < argc; i++)
 	{
-		texturePixels = buffer->bitmapMemory;
-		texturePitch = buffer->bitmapWidth * buffer->bytesPerPixel;
+		if (strncmp(argv[i], option, strlen(option)) == 0)
+		{
+			const char* value = argv[i] + strlen(option);
+			if (strcmp(value, "transparent") == 0)
+			{
+				mode = PageMode_Transparent;
+			}
+			else if (strcmp(value, "huge") == 0)
+			{
+				mode = PageMode_HugeTLB;
+			}
+		}
 	}
+	return mode;
+}
 
-	if (result == 0)
+sdl_present_mode getPresentModeArgument(int argc, char *argv[])
+{
+	sdl_present_mode mode = PresentMode_Vsync;
+	for (int i = 1; i < argc; i++)
 	{
-		gameScreenBuffer.texturePixels = texturePixels;
-		gameScreenBuffer.texturePitch = texturePitch;
-		gameScreenBuffer.bitmapWidth = buffer->bitmapWidth;
-		gameScreenBuffer.bitmapHeight = buffer->bitmapHeight;
-		gameScreenBuffer.bytesPerPixel = buffer->bytesPerPixel;
+		if (strcmp(argv[i], "--present=timer") == 0)
+		{
+			mode = PresentMode_Timer;
+		}
 	}
-
-	return gameScreenBuffer;
+	return mode;
 }
 
-void renderPixelBuffer(WindowBuffer *buffer)
+// With vsync the game rate divides the monitor rate evenly and is the
+// one closest to WANTED_GAME_UPDATE_HZ: 60 Hz gives 30, 144 Hz gives 36
+// and 75 Hz gives 25
+void choosePresentation(sdl_presentation* presentation, sdl_present_mode mode, uint32 monitorRefreshHz)
 {
-	if (getUseSDLTextureLock())
+	*presentation = {};
+	presentation->mode = mode;
+	presentation->monitorRefreshHz = monitorRefreshHz;
+	presentation->refreshesPerFrame = 1;
+	presentation->gameUpdateHz = WANTED_GAME_UPDATE_HZ;
+	if (mode != PresentMode_Vsync)
 	{
-		SDL_UnlockTexture(buffer->texture);
+		return;
 	}
-	else
+
+	// Higher rates first, so a tie goes to the higher one
+	uint32 bestDifference = monitorRefreshHz + WANTED_GAME_UPDATE_HZ;
+	for (uint32 refreshes = 1; refreshes <= monitorRefreshHz; refreshes++)
 	{
-		int32 result = SDL_UpdateTexture(buffer->texture,
-				NULL, 							// update whole texture, not a portion
-				buffer->bitmapMemory, 				// the memory where to get the texture
-				buffer->bitmapWidth * buffer->bytesPerPixel); 	// pitch, how many bytes is one line
-		if (result != 0)
+		if (monitorRefreshHz % refreshes != 0)
+		{
+			continue;
+		}
+		uint32 hz = monitorRefreshHz / refreshes;
+		uint32 difference = (hz > WANTED_GAME_UPDATE_HZ) ? hz - WANTED_GAME_UPDATE_HZ : WANTED_GAME_UPDATE_HZ - hz;
+		if (difference < bestDifference)
 		{
-			printf("error updating the texture: %s\n", SDL_GetError());
+			bestDifference = difference;
+			presentation->refreshesPerFrame = refreshes;
 		}
 	}
+	presentation->gameUpdateHz = monitorRefreshHz / presentation->refreshesPerFrame;
+}
+
+// Called after the presents of every vsync frame. Drivers and compositors
+// can ignore the vsync flag, and then the presents come back at once.
+void sdlCheckVsync(sdl_presentation* presentation, sdl_frame_pacer* pacer)
+{
+	uint64 now = getClockNs(CLOCK_MONOTONIC);
+	uint64 intervalNs = now - pacer->lastWakeNs;
+	recordFrameWake(pacer, now, intervalNs > pacer->periodNs + pacer->periodNs / 2);
+
+	if (intervalNs < pacer->periodNs * 3 / 4)
+	{
+		presentation->earlyFrameCount++;
+	}
+	presentation->checkedFrameCount++;
+	if (presentation->checkedFrameCount == VSYNC_CHECK_FRAMES)
+	{
+		if (presentation->earlyFrameCount > VSYNC_CHECK_FRAMES / 2)
+		{
+			printf("Presents do not wait for vsync, pacing with the timer\n");
+			presentation->mode = PresentMode_Timer;
+			presentation->refreshesPerFrame = 1;
+			// Telemetry starts again too, the early frames would spoil it
+			startFramePacer(pacer, (real32)((real64)pacer->periodNs / 1000000000.0));
+		}
+		presentation->checkedFrameCount = 0;
+		presentation->earlyFrameCount = 0;
+	}
+}
+
+bool32 getPrefaultArgument(int argc, char *argv[])
+{
+	bool32 prefault = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--prefault") == 0)
+		{
+			prefault = true;
+		}
+	}
+	return prefault;
+}
+
+// Returns NULL on failure. If the page mode can not be had, falls back
+// to the next smaller one and sets mode to what was used. Prefault
+// touches every page now, so that the first frames do not page fault.
+void* sdlAllocateGameMemory(void* baseAddress, uint64 size, sdl_page_mode* mode, bool32 prefault)
+{
+	const char* modeNames[] = {"normal", "transparent huge", "huge"};
+	sdl_page_mode wantedMode = *mode;
+	uint64 start = getWallClock();
+	void* memory = MAP_FAILED;
+
+	if (*mode == PageMode_HugeTLB)
+	{
+		// Size must be whole huge pages, 1 GB + 64 MB is.
+		// Populate is cheap here, there is no madvise to wait for.
+		memory = mmap(baseAddress, size, PROT_READ | PROT_WRITE,
+			MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB | (prefault ? MAP_POPULATE : 0), -1, 0);
+		if (memory == MAP_FAILED)
+		{
+			*mode = PageMode_Transparent;
+		}
+	}
+
+	if (memory == MAP_FAILED)
+	{
+		memory = mmap( baseAddress,  // place for memory
+			size, // how many bytes
+			PROT_READ | PROT_WRITE, // Protection flags to read/write
+			MAP_ANONYMOUS | MAP_PRIVATE, // not a file, only for us
+			-1, 						// no file
+			0); 				// offset into the file
+		if (memory == MAP_FAILED)
+		{
+			return NULL;
+		}
+
+		if (*mode == PageMode_Transparent && madvise(memory, size, MADV_HUGEPAGE) != 0)
+		{
+			*mode = PageMode_Normal;
+		}
+
+		// After the madvise, or the pages would already be small ones
+		if (prefault)
+		{
+#ifdef MADV_POPULATE_WRITE
+			if (madvise(memory, size, MADV_POPULATE_WRITE) != 0)
+#endif
+			{
+				// Older kernels: write to every page, it is zeros anyway
+				uint64 pageSize = (uint64)sysconf(_SC_PAGESIZE);
+				for (uint64 offset = 0; offset < size; offset += pageSize)
+				{
+					((volatile uint8*)memory)[offset] = 0;
+				}
+			}
+		}
+	}
+
+	if (*mode != wantedMode)
+	{
+		printf("Could not get %s pages for game memory, using %s pages\n",
+			modeNames[wantedMode], modeNames[*mode]);
+	}
+	printf("Game memory: %lu MB of %s pages%s in %.3f ms\n", size / (1024 * 1024),
+		modeNames[*mode], prefault ? ", prefaulted" : "",
+		getSecondsElapsed(start, getWallClock()) * 1000.0f);
+	return memory;
+}
+
+int32 getPipelineDepthArgument(int argc, char *argv[])
+{
+	int32 depth = 1;
+	const char* option = "--pipeline=";
+	for (int i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], option, strlen(option)) == 0)
+		{
+			depth = atoi(argv[i] + strlen(option));
+		}
+	}
+
+	if (depth < 1)
+	{
+		depth = 1;
+	}
+	else if (depth > MAX_PIPELINE_DEPTH)
+	{
+		depth = MAX_PIPELINE_DEPTH;
+	}
+	return depth;
+}
+
+void sdlStartFramePipeline(sdl_frame_pipeline* pipeline, int32 depth, game_memory* gameMemory)
+{
+	// Backbuffers must be our own memory, a locked texture can only
+	// be used on the main thread.
+	hm_assert(!getUseSDLTextureLock());
+
+	pipeline->depth = depth;
+	pipeline->nextToRender = 0;
+	pipeline->nextToPresent = 0;
+	pipeline->gameMemory = gameMemory;
+	SDL_AtomicSet(&pipeline->quit, 0);
+
+	pipeline->mutex = SDL_CreateMutex();
+	pipeline->freeBuffers = SDL_CreateSemaphore(depth);
+	pipeline->readyBuffers = SDL_CreateSemaphore(0);
+	// First frame can start right away
+	pipeline->frameTicks = SDL_CreateSemaphore(1);
+
+	pipeline->gameThread = SDL_CreateThread(sdlGameThread, "HandmadeGame", pipeline);
+	if (pipeline->gameThread == NULL)
+	{
+		printf("Could not create game thread, running without pipeline: %s\n", SDL_GetError());
+		pipeline->depth = 1;
+	}
+}
+
+void sdlStopFramePipeline(sdl_frame_pipeline* pipeline)
+{
+	SDL_AtomicSet(&pipeline->quit, 1);
+	// Wake the game thread from wherever it waits
+	SDL_SemPost(pipeline->frameTicks);
+	SDL_SemPost(pipeline->freeBuffers);
+	SDL_WaitThread(pipeline->gameThread, NULL);
+	pipeline->gameThread = NULL;
+
+	for (int32 bufferIndex = 0; bufferIndex < pipeline->depth; bufferIndex++)
+	{
+		sdl_backbuffer& backbuffer = pipeline->backbuffers[bufferIndex];
+		if (backbuffer.memory)
+		{
+			munmap(backbuffer.memory, backbuffer.width * backbuffer.height * 4);
+			backbuffer.memory = NULL;
+		}
+	}
+	SDL_DestroySemaphore(pipeline->frameTicks);
+	SDL_DestroySemaphore(pipeline->freeBuffers);
+	SDL_DestroySemaphore(pipeline->readyBuffers);
+	SDL_DestroyMutex(pipeline->mutex);
+	pipeline->mutex = NULL;
+}
+
+int sdlGameThread(void* data)
+{
+	sdl_frame_pipeline* pipeline = (sdl_frame_pipeline*)data;
+	game_input_state input;
+
+	for (;;)
+	{
+		SDL_SemWait(pipeline->frameTicks);
+		// Render only one frame even if we fell behind, catching up
+		// would add latency
+		while (SDL_SemTryWait(pipeline->frameTicks) == 0)
+		{
+		}
+		if (SDL_AtomicGet(&pipeline->quit))
+		{
+			break;
+		}
+
+		SDL_SemWait(pipeline->freeBuffers);
+		if (SDL_AtomicGet(&pipeline->quit))
+		{
+			break;
+		}
+
+		sdl_backbuffer* backbuffer = &pipeline->backbuffers[pipeline->nextToRender];
+
+		SDL_LockMutex(pipeline->mutex);
+		input = pipeline->latestInput;
+		sdl_flip_info flip = pipeline->latestFlip;
+		int32 width = gWindowBuffer->bitmapWidth;
+		int32 height = gWindowBuffer->bitmapHeight;
+		SDL_UnlockMutex(pipeline->mutex);
+
+		sdlReloadGameCodeIfNeeded();
+
+		uint64 simulateStart = getWallClock();
+		backbuffer->pixelBuffer = prepareBackbuffer(backbuffer, width, height);
+		if (!SDL_AtomicGet(&globalPause))
+		{
+			updateGame(&backbuffer->pixelBuffer, input, *pipeline->gameMemory, flip);
+		}
+		else
+		{
+			// Nothing new to show
+			backbuffer->pixelBuffer.dirtyRectCount = 0;
+		}
+		backbuffer->simulateSeconds = getSecondsElapsed(simulateStart, getWallClock());
+		backbuffer->audioLatencySeconds = audioConfig.currentLatencySeconds;
+		backbuffer->audioSafetySeconds = audioCalibration.safetySeconds;
+		backbuffer->audioUnderrunCount = audioCalibration.underrunCount;
+
+		pipeline->nextToRender = (pipeline->nextToRender + 1) % pipeline->depth;
+		SDL_SemPost(pipeline->readyBuffers);
+	}
+	return 0;
+}
+
+game_pixel_buffer prepareBackbuffer(sdl_backbuffer* backbuffer, int32 width, int32 height)
+{
+	int32 bytesPerPixel = 4;
+	if (backbuffer->width != width || backbuffer->height != height)
+	{
+		if (backbuffer->memory)
+		{
+			munmap(backbuffer->memory, backbuffer->width * backbuffer->height * bytesPerPixel);
+		}
+		backbuffer->memory = mmap(0, width * height * bytesPerPixel,
+			PROT_READ | PROT_WRITE,
+			MAP_ANONYMOUS | MAP_PRIVATE,
+			-1, 0);
+		if (backbuffer->memory == MAP_FAILED)
+		{
+			printf("Could not map memory for backbuffer\n");
+			backbuffer->memory = NULL;
+		}
+		backbuffer->width = width;
+		backbuffer->height = height;
+	}
+
+	game_pixel_buffer result;
+	if (backbuffer->memory)
+	{
+		result.texturePixels = backbuffer->memory;
+		result.texturePitch = width * bytesPerPixel;
+		result.bitmapWidth = width;
+		result.bitmapHeight = height;
+		result.bytesPerPixel = bytesPerPixel;
+	}
+	// Backbuffers take turns, so this one has an older frame
+	result.keepsContents = false;
+	game_rect wholeBuffer = {0, 0, width, height};
+	result.dirtyRects[0] = wholeBuffer;
+	result.dirtyRectCount = 1;
+	return result;
+}
+
+game_pixel_buffer preparePixelBuffer(WindowBuffer* buffer)
+{
+	game_pixel_buffer gameScreenBuffer;
+	void *texturePixels = NULL;
+	int32 result = 0;
+	int32 texturePitch = 0;
+
+	if (getUseSDLTextureLock())
+	{
+		result = SDL_LockTexture(buffer->texture,
+			NULL, // Replace all
+			&texturePixels,	
+			&texturePitch);
+	}
+	else
+	{
+		texturePixels = buffer->bitmapMemory;
+		texturePitch = buffer->bitmapWidth * buffer->bytesPerPixel;
+	}
+
+	if (result == 0)
+	{
+		gameScreenBuffer.texturePixels = texturePixels;
+		gameScreenBuffer.texturePitch = texturePitch;
+		gameScreenBuffer.bitmapWidth = buffer->bitmapWidth;
+		gameScreenBuffer.bitmapHeight = buffer->bitmapHeight;
+		gameScreenBuffer.bytesPerPixel = buffer->bytesPerPixel;
+		gameScreenBuffer.keepsContents = buffer->contentsValid;
+
+		// Game should tell what it changed, if it does not, upload all
+		game_rect wholeBuffer = {0, 0, buffer->bitmapWidth, buffer->bitmapHeight};
+		gameScreenBuffer.dirtyRects[0] = wholeBuffer;
+		gameScreenBuffer.dirtyRectCount = 1;
+	}
+
+	return gameScreenBuffer;
+}
+
+void renderPixelBuffer(WindowBuffer *buffer, game_pixel_buffer* pixelBuffer)
+{
+	uint32 bytesUploaded = 0;
+	if (getUseSDLTextureLock())
+	{
+		// Unlock always uploads the whole texture
+		SDL_UnlockTexture(buffer->texture);
+		bytesUploaded = buffer->fullFrameBytes;
+	}
+	else if (pixelBuffer->texturePixels != NULL)
+	{
+		// Pixels might be in a pipeline backbuffer instead of bitmapMemory
+		int32 pitch = pixelBuffer->texturePitch;
+		for (int32 rectIndex = 0;
+			rectIndex < pixelBuffer->dirtyRectCount;
+			rectIndex++)
+		{
+			game_rect& dirty = pixelBuffer->dirtyRects[rectIndex];
+			SDL_Rect rect;
+			rect.x = dirty.minX;
+			rect.y = dirty.minY;
+			rect.w = dirty.maxX - dirty.minX;
+			rect.h = dirty.maxY - dirty.minY;
+			if (rect.w <= 0 || rect.h <= 0)
+			{
+				continue;
+			}
+
+			uint8* firstPixel = (uint8*)pixelBuffer->texturePixels
+				+ rect.y * pitch
+				+ rect.x * buffer->bytesPerPixel;
+			int32 result = SDL_UpdateTexture(buffer->texture,
+					&rect, 							// only the part that changed
+					firstPixel, 				// the memory where to get the texture
+					pitch); 	// pitch, how many bytes is one line
+			if (result != 0)
+			{
+				printf("error updating the texture: %s\n", SDL_GetError());
+			}
+			bytesUploaded += rect.w * rect.h * buffer->bytesPerPixel;
+		}
+		buffer->contentsValid = true;
+	}
+
+	if (bytesUploaded == 0)
+	{
+		buffer->framesSkipped++;
+	}
+	buffer->bytesUploadedLastFrame = bytesUploaded;
+	buffer->bytesUploadedTotal += bytesUploaded;
+	buffer->bytesFullUploadTotal += buffer->fullFrameBytes;
 }
 
 
@@ -1414,12 +3521,16 @@ void sdlUpdateWindow(WindowBuffer *buffer, SDL_Renderer *renderer)
 		return;
 	}
 
-	// Copy from texture to renderer, use whole area of both
+	// Clear for the black bars around the picture
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+	SDL_RenderClear(renderer);
+
+	// Copy whole texture to renderer, scaling it to the present rect
 	int32 result;
 	result = SDL_RenderCopy(renderer,
 		buffer->texture,
 		NULL,
-		NULL);
+		&buffer->presentRect);
 
 	if (result != 0)
 	{
@@ -1456,6 +3567,54 @@ SDL_Renderer* getRenderer(uint32 windowID)
 	return NULL;
 }
 
+// ////////
+// ASSETS
+// ///////////
+
+bool32 sdlMapAssetArchive(const char* fileName, game_memory* gameMemory)
+{
+	int fileDescriptor = open(fileName, O_RDONLY);
+	if (fileDescriptor == -1)
+	{
+		return false;
+	}
+
+	struct stat fileStatus;
+	if (fstat(fileDescriptor, &fileStatus) == -1 || fileStatus.st_size == 0)
+	{
+		close(fileDescriptor);
+		return false;
+	}
+
+	// Read only and private: pages come from the page cache when touched
+	// and are never copied, the mapping stays after the file is closed.
+	void* memory = mmap(0, fileStatus.st_size,
+		PROT_READ,
+		MAP_PRIVATE,
+		fileDescriptor,
+		0);
+	close(fileDescriptor);
+	if (memory == MAP_FAILED)
+	{
+		printf("Could not map asset archive %s\n", fileName);
+		return false;
+	}
+
+	gameMemory->assetArchiveMemory = memory;
+	gameMemory->assetArchiveSize = fileStatus.st_size;
+	return true;
+}
+
+void sdlUnmapAssetArchive(game_memory* gameMemory)
+{
+	if (gameMemory->assetArchiveMemory)
+	{
+		munmap(gameMemory->assetArchiveMemory, gameMemory->assetArchiveSize);
+		gameMemory->assetArchiveMemory = NULL;
+		gameMemory->assetArchiveSize = 0;
+	}
+}
+
 // ////////
 // DEBUG FUNCTIONS
 // ///////////
@@ -1591,11 +3750,14 @@ void drawDebugCursor(uint32 cursor, game_pixel_buffer& writebuffer
 }
 
 void
-SDLDebugSyncDisplay(WindowBuffer* buffer, uint32 arrayCount
+SDLDebugSyncDisplay(game_pixel_buffer& writebuffer, uint32 arrayCount
 	, sdl_audio_debug_marker* markerArray, int currentMarkerIndex, ringBufferInfo& ringBufferInfo)
 {
-	game_pixel_buffer writebuffer = preparePixelBuffer(buffer);
-	
+	if (writebuffer.texturePixels == NULL)
+	{
+		return;
+	}
+
 	int32 padX = 16;
 	int32 padY = 16;
 	
@@ -1605,7 +3767,7 @@ SDLDebugSyncDisplay(WindowBuffer* buffer, uint32 arrayCount
 	uint32 redcolor = 0xFFFF0000;
 	uint32 yellowColor = 0xFFFFFF00;
 	
-	real32 c = (real32)(buffer->bitmapWidth - 2 * padX)/ (real32)ringBufferInfo.sizeBytes;
+	real32 c = (real32)(writebuffer.bitmapWidth - 2 * padX)/ (real32)ringBufferInfo.sizeBytes;
 	for (uint32 markerIndex = 0;
 		markerIndex < arrayCount;
 		markerIndex++)
@@ -1660,7 +3822,1491 @@ SDLDebugSyncDisplay(WindowBuffer* buffer, uint32 arrayCount
 				, padX, c, top, bottom, whitecolor);
 			
 		}
-		
-	renderPixelBuffer(buffer);
+
+	// Lines go on top of what the game drew, upload them too
+	game_rect markerArea = {0, padY, writebuffer.bitmapWidth, padY + 4 * lineHeight};
+	for (int32 rectIndex = 0; rectIndex < writebuffer.dirtyRectCount; rectIndex++)
+	{
+		// Grow a rect that already touches the area
+		game_rect& dirty = writebuffer.dirtyRects[rectIndex];
+		if (dirty.minY < markerArea.maxY && markerArea.minY < dirty.maxY)
+		{
+			dirty.minX = 0;
+			dirty.maxX = writebuffer.bitmapWidth;
+			dirty.minY = (dirty.minY < markerArea.minY) ? dirty.minY : markerArea.minY;
+			dirty.maxY = (dirty.maxY > markerArea.maxY) ? dirty.maxY : markerArea.maxY;
+			return;
+		}
+	}
+
+	if (writebuffer.dirtyRectCount < MAX_DIRTY_RECTS)
+	{
+		writebuffer.dirtyRects[writebuffer.dirtyRectCount++] = markerArea;
+	}
+	else
+	{
+		game_rect wholeBuffer = {0, 0, writebuffer.bitmapWidth, writebuffer.bitmapHeight};
+		writebuffer.dirtyRects[0] = wholeBuffer;
+		writebuffer.dirtyRectCount = 1;
+	}
+}
+
+// ////////
+// BENCHMARKS
+// ///////////
+
+// Common game_pixel_buffer sizes to run the pixel benchmarks on
+struct benchmark_resolution
+{
+	int32 width;
+	int32 height;
+};
+
+global_variable benchmark_resolution benchmarkResolutions[] = 
+{
+	{640, 480},
+	{800, 600},
+	{1280, 720},
+	{1920, 1080},
+	{2560, 1440},
+	{3840, 2160}
+};
+
+internal game_pixel_buffer
+allocateBenchmarkPixelBuffer(int32 width, int32 height)
+{
+	game_pixel_buffer result;
+	result.bitmapWidth = width;
+	result.bitmapHeight = height;
+	result.bytesPerPixel = 4;
+	result.texturePitch = width * result.bytesPerPixel;
+	result.texturePixels = mmap(0, result.texturePitch * height, 
+		PROT_READ | PROT_WRITE, 
+		MAP_ANONYMOUS | MAP_PRIVATE,
+		-1, 0);
+	if (result.texturePixels == MAP_FAILED)
+	{
+		printf("Could not map memory for benchmark buffer\n");
+		result.texturePixels = NULL;
+	}
+	return result;
+}
+
+internal void
+freeBenchmarkPixelBuffer(game_pixel_buffer& buffer)
+{
+	if (buffer.texturePixels)
+	{
+		munmap(buffer.texturePixels, buffer.texturePitch * buffer.bitmapHeight);
+		buffer.texturePixels = NULL;
+	}
+}
+
+void benchmarkGradient()
+{
+	struct gradient_path
+	{
+		const char* name;
+		render_gradient_row* kernel;
+	};
+	gradient_path paths[] = 
+	{
+		{"scalar", renderGradientRowScalar},
+		{"sse2", renderGradientRowSSE2},
+		{"avx2", renderGradientRowAVX2}
+	};
+	bool32 hasAVX2 = SDL_HasAVX2();
+	int32 repeats = 20;
+
+	printf("renderWeirdGradient, ns/pixel\n");
+	for (uint32 r = 0; r < ArrayCount(benchmarkResolutions); r++)
+	{
+		int32 width = benchmarkResolutions[r].width;
+		int32 height = benchmarkResolutions[r].height;
+		game_pixel_buffer reference = allocateBenchmarkPixelBuffer(width, height);
+		game_pixel_buffer buffer = allocateBenchmarkPixelBuffer(width, height);
+		if (reference.texturePixels == NULL || buffer.texturePixels == NULL)
+		{
+			freeBenchmarkPixelBuffer(reference);
+			freeBenchmarkPixelBuffer(buffer);
+			continue;
+		}
+
+		renderWeirdGradientWith(renderGradientRowScalar, &reference, 13, 7);
+		uint64 pixelCount = (uint64)width * (uint64)height;
+
+		printf("  %4dx%-4d", width, height);
+		for (uint32 p = 0; p < ArrayCount(paths); p++)
+		{
+			if (paths[p].kernel == renderGradientRowAVX2 && !hasAVX2)
+			{
+				printf("  %s: n/a", paths[p].name);
+				continue;
+			}
+
+			// Compare the output against scalar before timing
+			memset(buffer.texturePixels, 0, buffer.texturePitch * height);
+			renderWeirdGradientWith(paths[p].kernel, &buffer, 13, 7);
+			bool32 matches = memcmp(buffer.texturePixels, reference.texturePixels,
+				buffer.texturePitch * height) == 0;
+
+			uint64 start = getWallClock();
+			for (int32 i = 0; i < repeats; i++)
+			{
+				renderWeirdGradientWith(paths[p].kernel, &buffer, i, i);
+			}
+			real32 seconds = getSecondsElapsed(start, getWallClock());
+			real64 nsPerPixel = ((real64)seconds * 1.0e9) / (real64)(pixelCount * repeats);
+			printf("  %s: %.3f%s", paths[p].name, nsPerPixel, matches ? "" : " MISMATCH");
+		}
+		printf("\n");
+
+		freeBenchmarkPixelBuffer(reference);
+		freeBenchmarkPixelBuffer(buffer);
+	}
+}
+
+void benchmarkTiledRender()
+{
+	// Run the same frame with a growing number of worker threads.
+	// Threads from the earlier queues just sleep on their semaphores.
+	int32 maxWorkers = SDL_GetCPUCount() - 1;
+	int32 repeats = 20;
+	weird_gradient_offsets offsets = {13, 7};
+
+	printf("Tiled renderWeirdGradient, ms/frame\n");
+	for (uint32 r = 0; r < ArrayCount(benchmarkResolutions); r++)
+	{
+		int32 width = benchmarkResolutions[r].width;
+		int32 height = benchmarkResolutions[r].height;
+		if (width < 1920)
+		{
+			continue;
+		}
+		game_pixel_buffer reference = allocateBenchmarkPixelBuffer(width, height);
+		game_pixel_buffer buffer = allocateBenchmarkPixelBuffer(width, height);
+		if (reference.texturePixels == NULL || buffer.texturePixels == NULL)
+		{
+			freeBenchmarkPixelBuffer(reference);
+			freeBenchmarkPixelBuffer(buffer);
+			continue;
+		}
+		renderWeirdGradient(&reference, offsets.xOffset, offsets.yOffset);
+
+		printf("  %4dx%-4d", width, height);
+		for (int32 workers = 0; 
+			workers <= maxWorkers; 
+			workers = (workers == 0) ? 1 : workers * 2)
+		{
+			game_memory memory;
+			platform_work_queue *queue = NULL;
+			if (workers > 0)
+			{
+				queue = new platform_work_queue();
+				sdlMakeWorkQueue(queue, workers);
+				memory.renderQueue = queue;
+				memory.addWorkEntry = sdlAddWorkEntry;
+				memory.completeAllWork = sdlCompleteAllWork;
+				memory.renderThreadCount = workers + 1;
+			}
+
+			memset(buffer.texturePixels, 0, buffer.texturePitch * height);
+			renderTiled(&memory, &buffer, renderWeirdGradientTile, &offsets);
+			bool32 matches = memcmp(buffer.texturePixels, reference.texturePixels,
+				buffer.texturePitch * height) == 0;
+
+			uint64 start = getWallClock();
+			for (int32 i = 0; i < repeats; i++)
+			{
+				renderTiled(&memory, &buffer, renderWeirdGradientTile, &offsets);
+			}
+			real32 msPerFrame = 1000.0f * getSecondsElapsed(start, getWallClock()) / (real32)repeats;
+			printf("  %d+1 threads: %.3f%s", workers, msPerFrame, matches ? "" : " MISMATCH");
+			// Queue is leaked on purpose, its workers never exit
+		}
+		printf("\n");
+
+		freeBenchmarkPixelBuffer(reference);
+		freeBenchmarkPixelBuffer(buffer);
+	}
+}
+
+internal bool32
+isFilledWith(game_pixel_buffer& buffer, int32 minX, int32 minY, int32 maxX, int32 maxY, 
+	uint32 inside, uint32 outside)
+{
+	for (int32 y = 0; y < buffer.bitmapHeight; y++)
+	{
+		uint32* row = (uint32*)((uint8*)buffer.texturePixels + y * buffer.texturePitch);
+		for (int32 x = 0; x < buffer.bitmapWidth; x++)
+		{
+			bool32 isInside = x >= minX && x < maxX && y >= minY && y < maxY;
+			if (row[x] != (isInside ? inside : outside))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void benchmarkFill()
+{
+	struct fill_path
+	{
+		const char* name;
+		fill_row* kernel;
+	};
+	fill_path paths[] = 
+	{
+		{"memset", NULL},
+		{"scalar", fillRowScalar},
+		{"stream sse2", fillRowStreamSSE2},
+		{"stream avx2", fillRowStreamAVX2}
+	};
+	bool32 hasAVX2 = SDL_HasAVX2();
+	int32 repeats = 50;
+	uint32 color = 0xFF000000;
+
+	// memset can only clear to a color with all bytes the same,
+	// it is here as the speed to beat.
+	printf("Fill whole buffer, ms/frame (GB/s)\n");
+	for (uint32 r = 0; r < ArrayCount(benchmarkResolutions); r++)
+	{
+		int32 width = benchmarkResolutions[r].width;
+		int32 height = benchmarkResolutions[r].height;
+		if (width < 1280)
+		{
+			continue;
+		}
+		game_pixel_buffer buffer = allocateBenchmarkPixelBuffer(width, height);
+		if (buffer.texturePixels == NULL)
+		{
+			continue;
+		}
+		uint64 bytes = (uint64)buffer.texturePitch * (uint64)height;
+
+		printf("  %4dx%-4d", width, height);
+		for (uint32 p = 0; p < ArrayCount(paths); p++)
+		{
+			if (paths[p].kernel == fillRowStreamAVX2 && !hasAVX2)
+			{
+				printf("  %s: n/a", paths[p].name);
+				continue;
+			}
+
+			// Check the whole buffer and an unaligned rect before timing
+			bool32 matches = true;
+			if (paths[p].kernel)
+			{
+				memset(buffer.texturePixels, 0, bytes);
+				fillRectangleWith(paths[p].kernel, &buffer, 3, 5, width - 7, height - 1, color);
+				matches = isFilledWith(buffer, 3, 5, width - 7, height - 1, color, 0);
+				fillRectangleWith(paths[p].kernel, &buffer, 0, 0, width, height, color);
+				matches = matches && isFilledWith(buffer, 0, 0, width, height, color, 0);
+			}
+
+			uint64 start = getWallClock();
+			for (int32 i = 0; i < repeats; i++)
+			{
+				if (paths[p].kernel)
+				{
+					fillRectangleWith(paths[p].kernel, &buffer, 0, 0, width, height, color);
+				}
+				else
+				{
+					memset(buffer.texturePixels, 0, bytes);
+				}
+			}
+			real32 seconds = getSecondsElapsed(start, getWallClock());
+			real64 msPerFrame = 1000.0 * (real64)seconds / (real64)repeats;
+			real64 gbPerSecond = (real64)(bytes * repeats) / ((real64)seconds * 1.0e9);
+			printf("  %s: %.3f (%.1f)%s", paths[p].name, msPerFrame, gbPerSecond, 
+				matches ? "" : " MISMATCH");
+		}
+		printf("\n");
+
+		freeBenchmarkPixelBuffer(buffer);
+	}
+}
+
+// Bitmaps with known pixels, packed to an archive and optionally
+// also written as one file each
+struct benchmark_assets
+{
+	char directory[64];
+	char archivePath[128];
+	uint32 count;
+	uint32 side;
+	bool32 hasFiles;
+	asset_source* sources;
+	char* names;
+	uint32* pixels;
+	bool32 packed;
+};
+
+internal uint32
+getBenchmarkPixel(uint32 assetIndex, uint32 pixelIndex)
+{
+	return 0xFF000000 | (assetIndex << 8) | (pixelIndex & 0xFF);
+}
+
+internal bool32
+createBenchmarkAssets(benchmark_assets* assets, uint32 count, uint32 side, bool32 writeFiles)
+{
+	snprintf(assets->directory, sizeof(assets->directory), "/tmp/handmade_asset_benchXXXXXX");
+	if (mkdtemp(assets->directory) == NULL)
+	{
+		printf("Could not create directory for the asset benchmark\n");
+		return false;
+	}
+	snprintf(assets->archivePath, sizeof(assets->archivePath), "%s/assets.hha", assets->directory);
+	assets->count = count;
+	assets->side = side;
+	assets->hasFiles = writeFiles;
+
+	uint32 assetBytes = side * side * 4;
+	assets->sources = (asset_source*)calloc(count, sizeof(asset_source));
+	assets->names = (char*)calloc(count, 32);
+	assets->pixels = (uint32*)malloc((uint64)count * assetBytes);
+	char path[256];
+	for (uint32 i = 0; i < count; i++)
+	{
+		uint32* assetPixels = assets->pixels + (uint64)i * side * side;
+		for (uint32 p = 0; p < side * side; p++)
+		{
+			assetPixels[p] = getBenchmarkPixel(i, p);
+		}
+
+		char* name = assets->names + i * 32;
+		snprintf(name, 32, "bitmap_%u", i);
+		asset_source& source = assets->sources[i];
+		source.name = name;
+		source.data = assetPixels;
+		source.info.type = AssetType_Bitmap;
+		source.info.dataSize = assetBytes;
+		source.info.bitmap.width = side;
+		source.info.bitmap.height = side;
+
+		if (writeFiles)
+		{
+			snprintf(path, sizeof(path), "%s/%s", assets->directory, name);
+			debugPlatformWriteEntireFile(path, assetBytes, assetPixels);
+		}
+	}
+
+	// Packing sorts the sources, names stay in index order
+	uint64 archiveSize = getAssetArchiveSize(assets->sources, count);
+	void* archive = malloc(archiveSize);
+	assets->packed = packAssetArchive(assets->sources, count, archive, archiveSize)
+		&& debugPlatformWriteEntireFile(assets->archivePath, (uint32)archiveSize, archive);
+	free(archive);
+	return assets->packed;
+}
+
+internal void
+deleteBenchmarkAssets(benchmark_assets* assets)
+{
+	char path[256];
+	if (assets->hasFiles)
+	{
+		for (uint32 i = 0; i < assets->count; i++)
+		{
+			snprintf(path, sizeof(path), "%s/bitmap_%u", assets->directory, i);
+			unlink(path);
+		}
+	}
+	unlink(assets->archivePath);
+	rmdir(assets->directory);
+	free(assets->pixels);
+	free(assets->names);
+	free(assets->sources);
+}
+
+void benchmarkAssetLoad()
+{
+	// Thousands of small bitmaps, first as one file each like
+	// debugPlatformReadEntireFile would load them and then as one archive.
+	// Files are written first so both read from the page cache.
+	benchmark_assets files;
+	if (!createBenchmarkAssets(&files, 4096, 16, true))
+	{
+		return;
+	}
+	uint32 assetCount = files.count;
+
+	// Sum of one pixel per asset so that every asset is really touched
+	uint64 expectedSum = 0;
+	for (uint32 i = 0; i < assetCount; i++)
+	{
+		expectedSum += getBenchmarkPixel(i, 1);
+	}
+
+	printf("Load %u assets of %u bytes, ms\n", assetCount, files.side * files.side * 4);
+
+	// One file per asset: open, read, close and a malloc for each
+	char path[256];
+	uint64 start = getWallClock();
+	uint64 sum = 0;
+	for (uint32 i = 0; i < assetCount; i++)
+	{
+		snprintf(path, sizeof(path), "%s/bitmap_%u", files.directory, i);
+		debug_read_file_result file = debugPlatformReadEntireFile(path);
+		if (file.memoryPointer)
+		{
+			sum += ((uint32*)file.memoryPointer)[1];
+			debugPlatformFreeFileMemory(file.memoryPointer);
+		}
+	}
+	real32 filesMs = 1000.0f * getSecondsElapsed(start, getWallClock());
+	printf("  file per asset: %.3f%s\n", filesMs, (sum == expectedSum) ? "" : " MISMATCH");
+
+	// Archive: one mmap and a lookup for each asset
+	game_memory memory;
+	start = getWallClock();
+	sum = 0;
+	game_assets assets;
+	if (sdlMapAssetArchive(files.archivePath, &memory)
+		&& initializeAssets(&assets, memory.assetArchiveMemory, memory.assetArchiveSize))
+	{
+		real32 mapMs = 1000.0f * getSecondsElapsed(start, getWallClock());
+		for (uint32 i = 0; i < assetCount; i++)
+		{
+			loaded_bitmap bitmap;
+			if (getBitmapAsset(&assets, files.names + i * 32, &bitmap))
+			{
+				sum += ((uint32*)bitmap.memory)[1];
+			}
+		}
+		real32 archiveMs = 1000.0f * getSecondsElapsed(start, getWallClock());
+		printf("  mapped archive: %.3f (map %.3f)%s\n", archiveMs, mapMs,
+			(sum == expectedSum) ? "" : " MISMATCH");
+		sdlUnmapAssetArchive(&memory);
+	}
+	else
+	{
+		printf("  mapped archive: could not load\n");
+	}
+
+	deleteBenchmarkAssets(&files);
+}
+
+void benchmarkAssetStreaming()
+{
+	// Game asks for a burst of assets that fills the whole stream memory
+	// and keeps running frames while the I/O thread loads them.
+	// What the game spends per frame on asking and checking must stay
+	// far below the frame time. Then it releases them and asks for
+	// as many others, which only fit if the slots are reused.
+	uint32 side = 256;
+	uint32 assetCount = (uint32)(ASSET_STREAM_MEMORY_SIZE / (side * side * 4));
+	if (assetCount > MAX_STREAMED_ASSETS)
+	{
+		assetCount = MAX_STREAMED_ASSETS;
+	}
+	benchmark_assets files;
+	if (!createBenchmarkAssets(&files, assetCount * 2, side, false))
+	{
+		return;
+	}
+
+	game_memory memory;
+	game_assets assets;
+	// Room to align the start of the slot memory
+	asset_stream* stream = (asset_stream*)malloc(sizeof(asset_stream) + ASSET_STREAM_MEMORY_SIZE + HHA_PAYLOAD_ALIGNMENT);
+	if (stream && sdlMapAssetArchive(files.archivePath, &memory)
+		&& initializeAssets(&assets, memory.assetArchiveMemory, memory.assetArchiveSize))
+	{
+		memory_arena streamArena;
+		initializeArena(&streamArena, stream + 1, ASSET_STREAM_MEMORY_SIZE + HHA_PAYLOAD_ALIGNMENT);
+		initializeAssetStream(stream, &streamArena, ASSET_STREAM_MEMORY_SIZE);
+		platform_asset_queue queue;
+		sdlStartAssetQueue(&queue, memory.assetArchiveMemory, memory.assetArchiveSize);
+		memory.assetQueue = &queue;
+		memory.queueAssetLoad = sdlQueueAssetLoad;
+
+		real32 targetSecondsPerFrame = 1.0f / 30.0f;
+		for (uint32 burst = 0; burst < 2; burst++)
+		{
+			uint32 firstAsset = burst * assetCount;
+			real32 maxGameSeconds = 0.0f;
+			uint32 frameCount = 0;
+			uint32 loadedCount = 0;
+			uint64 burstStart = getWallClock();
+			while (loadedCount < assetCount && frameCount < 300)
+			{
+				uint64 frameStart = getWallClock();
+				loadedCount = 0;
+				for (uint32 i = 0; i < assetCount; i++)
+				{
+					// A few priority levels, the last assets are most urgent
+					asset_stream_slot* slot = requestAsset(&memory, &assets, stream,
+						AssetType_Bitmap, files.names + (firstAsset + i) * 32, (int32)(i * 4 / assetCount));
+					if (slot && getStreamedAssetData(slot))
+					{
+						loadedCount++;
+					}
+				}
+				real32 gameSeconds = getSecondsElapsed(frameStart, getWallClock());
+				if (gameSeconds > maxGameSeconds)
+				{
+					maxGameSeconds = gameSeconds;
+				}
+				frameCount++;
+
+				real32 frameSeconds = getSecondsElapsed(frameStart, getWallClock());
+				if (frameSeconds < targetSecondsPerFrame)
+				{
+					SDL_Delay((uint32)(1000.0f * (targetSecondsPerFrame - frameSeconds)));
+				}
+			}
+			real32 burstMs = 1000.0f * getSecondsElapsed(burstStart, getWallClock());
+
+			bool32 matches = (loadedCount == assetCount);
+			for (uint32 i = 0; i < assetCount && matches; i++)
+			{
+				uint32 assetIndex = firstAsset + i;
+				asset_stream_slot* slot = requestAsset(&memory, &assets, stream,
+					AssetType_Bitmap, files.names + assetIndex * 32, 0);
+				uint32* pixels = (uint32*)getStreamedAssetData(slot);
+				matches = pixels && pixels[side * side - 1] == getBenchmarkPixel(assetIndex, side * side - 1);
+				releaseAsset(stream, slot);
+			}
+
+			printf("Stream %u assets of %u KB at 30 Hz%s: %u frames, %.3f ms, "
+				"game max %.3f ms/frame%s\n",
+				assetCount, side * side * 4 / 1024, burst ? ", reusing slots" : "",
+				frameCount, burstMs, maxGameSeconds * 1000.0f, matches ? "" : " MISMATCH");
+		}
+
+		sdlStopAssetQueue(&queue);
+		sdlUnmapAssetArchive(&memory);
+	}
+	else
+	{
+		printf("Stream assets: could not load\n");
+	}
+
+	free(stream);
+	deleteBenchmarkAssets(&files);
+}
+
+// Stress test for the audio ring. Every stereo sample is one uint32 with
+// a running number, so the consumer can see if one is lost, repeated or
+// only half written. Zero is the silence played on underrun.
+struct audio_ring_stress
+{
+	ringBufferInfo ring;
+	uint32 frameCount;
+	uint32 framesSeen;
+	uint32 errorCount;
+	uint32 firstError;
+};
+
+#include <sched.h> // sched_yield
+
+internal int
+audioRingStressConsumer(void* data)
+{
+	audio_ring_stress* stress = (audio_ring_stress*)data;
+	uint32 output[1024];
+	uint32 expected = 1;
+	uint32 chunk = 1;
+	while (expected <= stress->frameCount)
+	{
+		// Odd sizes so that reads cross the end of the ring at every place
+		chunk = (chunk * 7 + 3) % ArrayCount(output) + 1;
+		uint32 readyBytes = ringBufferConsume(&stress->ring, (uint8*)output, chunk * sizeof(uint32));
+
+		for (uint32 i = 0; i < chunk; i++)
+		{
+			bool32 isSilence = i >= readyBytes / sizeof(uint32);
+			if (isSilence ? (output[i] != 0) : (output[i] != expected))
+			{
+				if (stress->errorCount == 0)
+				{
+					stress->firstError = expected;
+				}
+				stress->errorCount++;
+			}
+			if (!isSilence)
+			{
+				expected++;
+			}
+		}
+		if (readyBytes == 0)
+		{
+			sched_yield();
+		}
+	}
+	stress->framesSeen = expected - 1;
+	return 0;
+}
+
+// Callback runs dry while the game is between writing samples and
+// committing them. Nothing that is committed after that may be skipped.
+internal void
+checkAudioRingUnderrunDuringWrite()
+{
+	ringBufferInfo ring = {};
+	ring.sizeBytes = 64 * sizeof(uint32);
+	ring.data = calloc(1, ring.sizeBytes);
+	uint32* samples = (uint32*)ring.data;
+	uint32 output[16];
+
+	// Samples 1-4 are ready, 5-13 are written but not committed yet
+	for (uint32 i = 0; i < 13; i++)
+	{
+		samples[i] = i + 1;
+	}
+	commitRingBufferWrite(&ring, 4 * sizeof(uint32));
+	uint32 freeBytes = getRingBufferFreeBytes(&ring);
+
+	// Callback wants 8 and gets 4, the rest is silence
+	uint32 readyBytes = ringBufferConsume(&ring, (uint8*)output, 8 * sizeof(uint32));
+	bool32 isCorrect = (readyBytes == 4 * sizeof(uint32))
+		&& output[3] == 4 && output[4] == 0 && output[7] == 0;
+
+	// Game commits what it wrote, the next callback gets all of it
+	commitRingBufferWrite(&ring, 9 * sizeof(uint32));
+	readyBytes = ringBufferConsume(&ring, (uint8*)output, 9 * sizeof(uint32));
+	isCorrect = isCorrect && (readyBytes == 9 * sizeof(uint32));
+	for (uint32 i = 0; i < 9 && isCorrect; i++)
+	{
+		isCorrect = (output[i] == 5 + i);
+	}
+
+	printf("Audio ring underrun during a write: %u bytes of silence, %s\n",
+		(uint32)ring.underrunBytes, 
+		(isCorrect && freeBytes == 60 * sizeof(uint32) && ring.underrunBytes == 4 * sizeof(uint32))
+		? "no samples lost" : "FAILED");
+	free(ring.data);
+}
+
+void benchmarkAudioRing()
+{
+	checkAudioRingUnderrunDuringWrite();
+
+	audio_ring_stress stress = {};
+	// Small ring so that the cursors wrap all the time
+	stress.ring.sizeBytes = 4096 * sizeof(uint32) - 4 * 3;
+	stress.ring.data = calloc(1, stress.ring.sizeBytes);
+	stress.frameCount = 20 * 1000 * 1000;
+
+	uint64 start = getWallClock();
+	SDL_Thread* consumer = SDL_CreateThread(audioRingStressConsumer, "AudioRingConsumer", &stress);
+	if (consumer == NULL)
+	{
+		printf("Could not create audio ring consumer thread\n");
+		free(stress.ring.data);
+		return;
+	}
+
+	// Producer writes like writeSoundBuffer: free space, write, commit
+	uint32 nextFrame = 1;
+	uint32 chunk = 1;
+	while (nextFrame <= stress.frameCount)
+	{
+		uint32 freeFrames = getRingBufferFreeBytes(&stress.ring) / sizeof(uint32);
+		chunk = (chunk * 5 + 1) % 2048 + 1;
+		uint32 frames = (chunk < freeFrames) ? chunk : freeFrames;
+		if (frames > stress.frameCount - nextFrame + 1)
+		{
+			frames = stress.frameCount - nextFrame + 1;
+		}
+		if (frames == 0)
+		{
+			sched_yield();
+			continue;
+		}
+
+		uint32* samples = (uint32*)stress.ring.data;
+		uint32 ringFrames = stress.ring.sizeBytes / sizeof(uint32);
+		uint32 position = (uint32)((stress.ring.writtenBytes / sizeof(uint32)) % ringFrames);
+		for (uint32 i = 0; i < frames; i++)
+		{
+			samples[position] = nextFrame++;
+			position = (position + 1 == ringFrames) ? 0 : position + 1;
+		}
+		commitRingBufferWrite(&stress.ring, frames * sizeof(uint32));
+	}
+
+	SDL_WaitThread(consumer, NULL);
+	real32 seconds = getSecondsElapsed(start, getWallClock());
+
+	printf("Audio ring stress: %u samples in %.3f s, %lu bytes of underrun, %u errors",
+		stress.framesSeen, seconds, stress.ring.underrunBytes, stress.errorCount);
+	if (stress.errorCount)
+	{
+		printf(" (first at sample %u)", stress.firstError);
+	}
+	printf("%s\n", (stress.errorCount == 0 && stress.framesSeen == stress.frameCount) ? "" : " FAILED");
+	free(stress.ring.data);
+
+	// A write over the end of a mirrored ring must show up at its start
+	ringBufferInfo mirrored = {};
+	if (allocateRingBuffer(&mirrored, 48000 * sizeof(uint32)) && mirrored.isMirrored)
+	{
+		uint32 ringFrames = mirrored.sizeBytes / sizeof(uint32);
+		uint32* samples = (uint32*)mirrored.data;
+		for (uint32 i = 0; i < 64; i++)
+		{
+			samples[ringFrames - 32 + i] = i + 1;
+		}
+		uint32 errorCount = 0;
+		for (uint32 i = 0; i < 64; i++)
+		{
+			uint32 position = (ringFrames - 32 + i) % ringFrames;
+			errorCount += (samples[position] != i + 1);
+		}
+		printf("Audio ring mirror: %u bytes, %s\n", mirrored.sizeBytes, errorCount ? "FAILED" : "ok");
+	}
+	else
+	{
+		printf("Audio ring mirror: not available\n");
+	}
+	freeRingBuffer(&mirrored);
+}
+
+void benchmarkOscillators()
+{
+	struct oscillator_path
+	{
+		const char* name;
+		oscillator_blocks* kernel;
+	};
+	oscillator_path paths[] = 
+	{
+		{"scalar", oscillatorBlocksScalar},
+		{"sse2", oscillatorBlocksSSE2},
+		{"avx2", oscillatorBlocksAVX2}
+	};
+	bool32 hasAVX2 = SDL_HasAVX2();
+	real32 samplesPerSecond = 48000.0f;
+	// Like writeSineWave: one render per frame at 30 Hz
+	const uint32 chunkSamples = 1600;
+	real32 mix[chunkSamples];
+
+	// Accuracy against sin in double for 10 seconds of a 440 Hz voice
+	printf("Oscillator max error vs sin, 10 s of 440 Hz at amplitude 1:");
+	for (uint32 p = 0; p < ArrayCount(paths); p++)
+	{
+		if (paths[p].kernel == oscillatorBlocksAVX2 && !hasAVX2)
+		{
+			printf("  %s: n/a", paths[p].name);
+			continue;
+		}
+		oscillator_bank bank = {};
+		oscillator_voice* voice = addOscillatorVoice(&bank, 440.0f, samplesPerSecond, 1.0f);
+		voice->phase = 1.0f;
+		real64 phase = voice->phase;
+		real64 phaseStep = voice->phaseStep;
+
+		real64 maxError = 0.0;
+		for (uint32 chunk = 0; chunk < 10 * (uint32)samplesPerSecond / chunkSamples; chunk++)
+		{
+			renderOscillatorBankWith(paths[p].kernel, &bank, mix, chunkSamples);
+			for (uint32 i = 0; i < chunkSamples; i++)
+			{
+				real64 error = fabs((real64)mix[i] - sin(phase + (real64)i * phaseStep));
+				maxError = (error > maxError) ? error : maxError;
+			}
+			phase = fmod(phase + (real64)chunkSamples * phaseStep, 2.0 * PI32);
+		}
+		// int16 output has steps of 1 / 32768 of the full amplitude
+		printf("  %s: %.2e%s", paths[p].name, maxError, (maxError < 1.0 / 32768.0) ? "" : " TOO BIG");
+	}
+
+	// sinf of the same phases, the best a per sample sinf can do
+	real32 sinfError = 0.0f;
+	{
+		real64 phaseStep = 2.0 * PI32 * 440.0 / samplesPerSecond;
+		for (uint32 i = 0; i < 10 * (uint32)samplesPerSecond; i++)
+		{
+			real32 phase = (real32)fmod(1.0 + (real64)i * phaseStep, 2.0 * PI32);
+			real32 error = (real32)fabs(sinf(phase) - sin((real64)phase));
+			sinfError = (error > sinfError) ? error : sinfError;
+		}
+	}
+	printf("  sinf: %.2e\n", sinfError);
+
+	// Throughput with a bank full of voices
+	oscillator_bank bank = {};
+	for (uint32 v = 0; v < MAX_OSCILLATOR_VOICES; v++)
+	{
+		addOscillatorVoice(&bank, 110.0f + 37.0f * v, samplesPerSecond, 400.0f);
+	}
+	int16 output[2 * chunkSamples];
+	uint32 chunkCount = 200;
+	real64 voiceSamples = (real64)chunkCount * chunkSamples * bank.voiceCount;
+
+	printf("Oscillator bank, %u voices, Msamples/s (voices * samples)\n", bank.voiceCount);
+	printf(" ");
+	{
+		// Per sample sinf, like writeSineWave was
+		uint64 start = getWallClock();
+		for (uint32 chunk = 0; chunk < chunkCount; chunk++)
+		{
+			memset(mix, 0, sizeof(mix));
+			for (uint32 v = 0; v < bank.voiceCount; v++)
+			{
+				oscillator_voice& voice = bank.voices[v];
+				for (uint32 i = 0; i < chunkSamples; i++)
+				{
+					mix[i] += voice.volume * sinf(voice.phase);
+					voice.phase += voice.phaseStep;
+					if (voice.phase > 2.0f * PI32)
+					{
+						voice.phase -= 2.0f * PI32;
+					}
+				}
+			}
+			writeMixToStereo(mix, output, chunkSamples);
+		}
+		real32 seconds = getSecondsElapsed(start, getWallClock());
+		printf(" sinf: %.1f", voiceSamples / (1.0e6 * seconds));
+	}
+	for (uint32 p = 0; p < ArrayCount(paths); p++)
+	{
+		if (paths[p].kernel == oscillatorBlocksAVX2 && !hasAVX2)
+		{
+			printf("  %s: n/a", paths[p].name);
+			continue;
+		}
+		uint64 start = getWallClock();
+		for (uint32 chunk = 0; chunk < chunkCount; chunk++)
+		{
+			renderOscillatorBankWith(paths[p].kernel, &bank, mix, chunkSamples);
+			writeMixToStereo(mix, output, chunkSamples);
+		}
+		real32 seconds = getSecondsElapsed(start, getWallClock());
+		printf("  %s: %.1f", paths[p].name, voiceSamples / (1.0e6 * seconds));
+	}
+	printf("\n");
+}
+
+// Plays voiceCount voices of the sounds with different pitch, pan and
+// volume ramps, same every time so that the kernels can be compared
+internal void
+startBenchmarkVoices(audio_state* audio, loaded_sound* sounds, uint32 soundCount, uint32 voiceCount)
+{
+	initializeAudioState(audio);
+	for (uint32 v = 0; v < voiceCount; v++)
+	{
+		playing_sound* sound = playSound(audio, sounds + (v % soundCount), (v % 4) != 0);
+		changePitch(sound, 0.5f + 0.03f * (real32)(v % 50));
+		changeVolume(sound, 0.0f, 0.1f, -1.0f + 2.0f * (real32)(v % 7) / 6.0f);
+		changeVolume(sound, 0.05f + 0.01f * (real32)(v % 13), 0.2f, 0.0f);
+	}
+}
+
+void benchmarkMixer()
+{
+	struct mixer_path
+	{
+		const char* name;
+		mix_sound_segment* kernel;
+	};
+	mixer_path paths[] = 
+	{
+		{"scalar", mixSoundSegmentScalar},
+		{"sse2", mixSoundSegmentSSE2},
+		{"avx2", mixSoundSegmentAVX2}
+	};
+	bool32 hasAVX2 = SDL_HasAVX2();
+	const uint32 samplesPerSecond = 48000;
+	const uint32 frameSamples = 1600;
+	real32* left = (real32*)malloc(2 * frameSamples * sizeof(real32));
+	real32* right = left + frameSamples;
+	audio_state* audio = (audio_state*)malloc(sizeof(audio_state));
+
+	// Half a second of noise in each format
+	loaded_sound sounds[4];
+	uint32 random = 12345;
+	for (uint32 s = 0; s < ArrayCount(sounds); s++)
+	{
+		loaded_sound& sound = sounds[s];
+		sound.channelCount = 1 + (s % 2);
+		sound.samplesPerSecond = (s < 2) ? 44100 : 48000;
+		sound.sampleCount = sound.samplesPerSecond / 2;
+		sound.samples = (int16*)malloc(sound.sampleCount * sound.channelCount * sizeof(int16));
+		for (uint32 i = 0; i < sound.sampleCount * sound.channelCount; i++)
+		{
+			random = random * 1664525 + 1013904223;
+			sound.samples[i] = (int16)(random >> 16);
+		}
+	}
+
+	// A ramp must go straight to the target without overshoot, split
+	// over two outputs so that it continues from where it was
+	{
+		int16 constant[2] = {10000, 10000};
+		loaded_sound flat = {constant, 2, 1, samplesPerSecond};
+		initializeAudioState(audio);
+		playing_sound* sound = playSound(audio, &flat, true);
+		changeVolume(sound, 0.0f, 0.0f, 0.0f);
+		changeVolume(sound, 0.01f, 1.0f, 0.0f);
+
+		real32 target = 10000.0f * cosf(0.25f * PI32);
+		real32 previous = 0.0f;
+		bool32 isRampGood = true;
+		for (uint32 part = 0; part < 2; part++)
+		{
+			memset(left, 0, 2 * frameSamples * sizeof(real32));
+			mixPlayingSounds(getMixSoundSegmentKernel(), audio, left, right, 301, samplesPerSecond);
+			for (uint32 i = 0; i < 301; i++)
+			{
+				isRampGood = isRampGood && left[i] >= previous - 0.01f && left[i] <= target + 0.01f && left[i] == right[i];
+				previous = left[i];
+			}
+		}
+		isRampGood = isRampGood && fabsf(previous - target) < 0.01f;
+		printf("Mixer volume ramp: %s\n", isRampGood ? "ok" : "FAILED");
+	}
+
+	uint32 voiceCounts[] = {16, 64, 256};
+	int16* output = (int16*)malloc(2 * frameSamples * sizeof(int16));
+	uint32 frameCount = 30;
+	printf("Mixer, %u sample frames: ms/frame (voices per ms)\n", frameSamples);
+	for (uint32 c = 0; c < ArrayCount(voiceCounts); c++)
+	{
+		uint32 voiceCount = voiceCounts[c];
+		printf("  %3u voices", voiceCount);
+		uint32 scalarHash = 0;
+		for (uint32 p = 0; p < ArrayCount(paths); p++)
+		{
+			if (paths[p].kernel == mixSoundSegmentAVX2 && !hasAVX2)
+			{
+				printf("  %s: n/a", paths[p].name);
+				continue;
+			}
+
+			startBenchmarkVoices(audio, sounds, ArrayCount(sounds), voiceCount);
+			uint32 hash = 2166136261u;
+			real32 seconds = 0.0f;
+			for (uint32 frame = 0; frame < frameCount; frame++)
+			{
+				uint64 start = getWallClock();
+				memset(left, 0, 2 * frameSamples * sizeof(real32));
+				mixPlayingSounds(paths[p].kernel, audio, left, right, frameSamples, samplesPerSecond);
+				writeChannelsToStereo(left, right, output, frameSamples);
+				seconds += getSecondsElapsed(start, getWallClock());
+
+				for (uint32 i = 0; i < 2 * frameSamples; i++)
+				{
+					hash = (hash ^ (uint16)output[i]) * 16777619u;
+				}
+			}
+			real64 msPerFrame = 1000.0 * (real64)seconds / (real64)frameCount;
+			if (p == 0)
+			{
+				scalarHash = hash;
+			}
+			printf("  %s: %.3f (%.0f)%s", paths[p].name, msPerFrame, (real64)voiceCount / msPerFrame,
+				(hash == scalarHash) ? "" : " MISMATCH");
+		}
+		printf("\n");
+	}
+
+	for (uint32 s = 0; s < ArrayCount(sounds); s++)
+	{
+		free(sounds[s].samples);
+	}
+	free(output);
+	free(audio);
+	free(left);
+}
+
+// Streams a sine through the resampler one game frame at a time, like
+// updateGame does, and returns the signal to noise ratio in dB against
+// the exact sine at the output rate
+internal real64
+measureResamplerQuality(resample_frames* kernel, uint32 inputRate, uint32 outputRate, real64 toneHz)
+{
+	sdl_resampler resampler;
+	if (!initResampler(&resampler, inputRate, outputRate, outputRate))
+	{
+		return 0.0;
+	}
+	const real64 amplitude = 16000.0;
+	uint32 frameOutputs = outputRate / 30;
+	int16* output = (int16*)malloc(2 * frameOutputs * sizeof(int16));
+
+	// Output k is at input k * inputRate / outputRate + taps / 2 - 1
+	real64 delay = RESAMPLER_TAPS / 2 - 1;
+	uint64 inputIndex = 0;
+	uint64 outputIndex = 0;
+	real64 signal = 0.0;
+	real64 noise = 0.0;
+	for (uint32 frame = 0; frame < 60; frame++)
+	{
+		uint32 inputFrames = getResamplerInputFrames(&resampler, frameOutputs);
+		for (uint32 i = 0; i < inputFrames; i++)
+		{
+			real64 value = amplitude * sin(2.0 * PI32 * toneHz * (real64)(inputIndex++) / inputRate);
+			resampler.input[2 * i] = (int16)lrint(value);
+			resampler.input[2 * i + 1] = (int16)lrint(-value);
+		}
+		resampleAudio(kernel, &resampler, resampler.input, inputFrames, output, frameOutputs);
+
+		for (uint32 i = 0; i < frameOutputs; i++, outputIndex++)
+		{
+			// Skip the start where the filter still sees the zeros before the sine
+			if (outputIndex < RESAMPLER_TAPS * 4)
+			{
+				continue;
+			}
+			real64 position = (real64)outputIndex * inputRate / outputRate + delay;
+			real64 expected = amplitude * sin(2.0 * PI32 * toneHz * position / inputRate);
+			signal += 2.0 * expected * expected;
+			noise += (output[2 * i] - expected) * (output[2 * i] - expected);
+			noise += (output[2 * i + 1] + expected) * (output[2 * i + 1] + expected);
+		}
+	}
+	free(output);
+	freeResampler(&resampler);
+	return 10.0 * log10(signal / noise);
+}
+
+void benchmarkResampler()
+{
+	struct resampler_path
+	{
+		const char* name;
+		resample_frames* kernel;
+	};
+	resampler_path paths[] = 
+	{
+		{"scalar", resampleFramesScalar},
+		{"sse2", resampleFramesSSE2},
+		{"avx2", resampleFramesAVX2}
+	};
+	struct rate_pair
+	{
+		uint32 inputRate;
+		uint32 outputRate;
+	};
+	rate_pair pairs[] = {{44100, 48000}, {48000, 96000}};
+	real64 tones[] = {1000.0, 10000.0};
+	bool32 hasAVX2 = SDL_HasAVX2();
+
+	printf("Resampler, %u taps: SNR dB at 1 kHz / 10 kHz, Mframes/s out\n", RESAMPLER_TAPS);
+	for (uint32 r = 0; r < ArrayCount(pairs); r++)
+	{
+		uint32 inputRate = pairs[r].inputRate;
+		uint32 outputRate = pairs[r].outputRate;
+		printf("  %5u -> %5u", inputRate, outputRate);
+		for (uint32 p = 0; p < ArrayCount(paths); p++)
+		{
+			if (paths[p].kernel == resampleFramesAVX2 && !hasAVX2)
+			{
+				printf("  %s: n/a", paths[p].name);
+				continue;
+			}
+
+			real64 lowSNR = measureResamplerQuality(paths[p].kernel, inputRate, outputRate, tones[0]);
+			real64 highSNR = measureResamplerQuality(paths[p].kernel, inputRate, outputRate, tones[1]);
+
+			// Ten seconds of noise in game sized pieces
+			sdl_resampler resampler;
+			initResampler(&resampler, inputRate, outputRate, outputRate);
+			uint32 frameOutputs = outputRate / 30;
+			int16* output = (int16*)malloc(2 * frameOutputs * sizeof(int16));
+			uint32 random = 1;
+			for (uint32 i = 0; i < 2 * resampler.inputCapacity; i++)
+			{
+				random = random * 1664525 + 1013904223;
+				resampler.input[i] = (int16)(random >> 16);
+			}
+			uint32 frameCount = 300;
+			uint64 start = getWallClock();
+			for (uint32 frame = 0; frame < frameCount; frame++)
+			{
+				uint32 inputFrames = getResamplerInputFrames(&resampler, frameOutputs);
+				resampleAudio(paths[p].kernel, &resampler, resampler.input, inputFrames, output, frameOutputs);
+			}
+			real32 seconds = getSecondsElapsed(start, getWallClock());
+			free(output);
+			freeResampler(&resampler);
+
+			real64 framesPerSecond = (real64)frameCount * frameOutputs / seconds;
+			printf("  %s: %.1f / %.1f, %.1f", paths[p].name, lowSNR, highSNR, framesPerSecond / 1.0e6);
+		}
+		printf("\n");
+	}
+}
+
+internal int16
+getBenchmarkSoundSample(uint32 sampleIndex)
+{
+	return (int16)((sampleIndex * 7) % 20011) - 10000;
+}
+
+void benchmarkSoundStream()
+{
+	// A looping track longer than the stream memory, with a chunk before
+	// the samples like many files have. Played at its own rate and fully
+	// left, the mixer outputs the file's samples as they are.
+	uint32 sampleCount = 5 * SOUND_STREAM_CHUNKS * SOUND_STREAM_CHUNK_SAMPLES + 1234;
+	uint32 listBytes = 26;
+	uint32 dataBytes = sampleCount * 2 * sizeof(int16);
+	uint32 fileBytes = 12 + (8 + 16) + (8 + listBytes) + 8 + dataBytes;
+	uint8* file = (uint8*)malloc(fileBytes);
+	uint8* at = file;
+	uint32 header[] = 
+	{
+		0x46464952, fileBytes - 8, 0x45564157, // RIFF, WAVE
+		0x20746D66, 16, 0x00020001, 48000, 48000 * 4, 0x00100004, // fmt, PCM stereo 16 bit
+		0x5453494C, listBytes // LIST
+	};
+	memcpy(at, header, sizeof(header));
+	at += sizeof(header);
+	memset(at, 'x', listBytes);
+	at += listBytes;
+	uint32 dataHeader[] = {0x61746164, dataBytes}; // data
+	memcpy(at, dataHeader, sizeof(dataHeader));
+	at += sizeof(dataHeader);
+	int16* samples = (int16*)at;
+	for (uint32 i = 0; i < sampleCount; i++)
+	{
+		samples[2 * i] = getBenchmarkSoundSample(i);
+		samples[2 * i + 1] = -samples[2 * i];
+	}
+
+	char directory[64];
+	snprintf(directory, sizeof(directory), "/tmp/handmade_sound_benchXXXXXX");
+	char path[128];
+	bool32 isWritten = false;
+	if (mkdtemp(directory))
+	{
+		snprintf(path, sizeof(path), "%s/music.wav", directory);
+		isWritten = debugPlatformWriteEntireFile(path, fileBytes, file);
+	}
+	free(file);
+	if (!isWritten)
+	{
+		printf("Sound stream: could not write the track\n");
+		return;
+	}
+
+	game_memory memory;
+	platform_asset_queue queue;
+	sdlStartAssetQueue(&queue, NULL, 0);
+	memory.assetQueue = &queue;
+	memory.queueAssetLoad = sdlQueueAssetLoad;
+
+	audio_state* audio = (audio_state*)malloc(sizeof(audio_state));
+	sound_stream* stream = (sound_stream*)malloc(sizeof(sound_stream) + SOUND_STREAM_MEMORY_SIZE);
+	initializeAudioState(audio);
+	initializeSoundStream(stream, stream + 1, path, true);
+
+	// Game frames of 1600 samples without waiting for real time,
+	// the short delay is time for the I/O thread
+	const uint32 frameSamples = 1600;
+	real32 left[frameSamples];
+	real32 right[frameSamples];
+	uint64 samplesChecked = 0;
+	uint64 samplesToCheck = 3 * (uint64)sampleCount;
+	uint32 errorCount = 0;
+	real32 maxUpdateSeconds = 0.0f;
+	for (uint32 frame = 0; frame < 2000 && samplesChecked < samplesToCheck; frame++)
+	{
+		uint64 start = getWallClock();
+		bool32 wasPlaying = stream->sound != NULL;
+		updateSoundStream(&memory, audio, stream);
+		real32 updateSeconds = getSecondsElapsed(start, getWallClock());
+		if (updateSeconds > maxUpdateSeconds)
+		{
+			maxUpdateSeconds = updateSeconds;
+		}
+		if (stream->sound && !wasPlaying)
+		{
+			changeVolume(stream->sound, 0.0f, 1.0f, -1.0f);
+		}
+
+		memset(left, 0, sizeof(left));
+		memset(right, 0, sizeof(right));
+		mixPlayingSounds(mixSoundSegmentScalar, audio, left, right, frameSamples, 48000);
+		if (stream->sound)
+		{
+			for (uint32 i = 0; i < frameSamples; i++)
+			{
+				int16 expected = getBenchmarkSoundSample((uint32)(samplesChecked % sampleCount));
+				errorCount += (left[i] != (real32)expected);
+				samplesChecked++;
+			}
+		}
+		SDL_Delay(1);
+	}
+	sdlStopAssetQueue(&queue);
+
+	printf("Sound stream: %lu samples, %u KB track in %u KB, update max %.3f ms, %u errors%s\n",
+		samplesChecked, dataBytes / 1024, (uint32)(SOUND_STREAM_MEMORY_SIZE / 1024),
+		maxUpdateSeconds * 1000.0f, errorCount,
+		(errorCount == 0 && samplesChecked >= samplesToCheck) ? "" : " FAILED");
+
+	free(stream);
+	free(audio);
+	unlink(path);
+	rmdir(directory);
+}
+
+void benchmarkGameMemory()
+{
+	// Game touches its memory all over: first time it page faults,
+	// after that it misses the TLB when there are too many pages
+	uint64 size = SizeMegaBytes(64) + SizeGigaBytes(1);
+	const uint32 touchCount = 200000;
+	const uint32 passCount = 10;
+	struct memory_setup
+	{
+		sdl_page_mode mode;
+		bool32 prefault;
+	};
+	memory_setup setups[] = 
+	{
+		{PageMode_Normal, false},
+		{PageMode_Normal, true},
+		{PageMode_Transparent, false},
+		{PageMode_Transparent, true},
+		{PageMode_HugeTLB, false},
+		{PageMode_HugeTLB, true},
+	};
+	const char* modeNames[] = {"normal", "transparent", "huge"};
+
+	printf("Game memory, %u random writes: allocate ms, first pass ms, later passes ms\n", touchCount);
+	for (uint32 s = 0; s < ArrayCount(setups); s++)
+	{
+		sdl_page_mode mode = setups[s].mode;
+		uint64 start = getWallClock();
+		uint8* memory = (uint8*)sdlAllocateGameMemory(NULL, size, &mode, setups[s].prefault);
+		real32 allocateSeconds = getSecondsElapsed(start, getWallClock());
+		if (memory == NULL)
+		{
+			continue;
+		}
+
+		real32 passSeconds[2] = {};
+		for (uint32 pass = 0; pass < passCount; pass++)
+		{
+			// Same addresses every pass
+			uint64 random = 12345;
+			start = getWallClock();
+			for (uint32 i = 0; i < touchCount; i++)
+			{
+				random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+				memory[(random >> 16) % size] += 1;
+			}
+			passSeconds[pass == 0 ? 0 : 1] += getSecondsElapsed(start, getWallClock());
+		}
+		printf("  %-11s %-9s %9.3f %9.3f %9.3f\n", modeNames[mode],
+			setups[s].prefault ? "prefault" : "", allocateSeconds * 1000.0f,
+			passSeconds[0] * 1000.0f, passSeconds[1] * 1000.0f / (real32)(passCount - 1));
+		munmap(memory, size);
+	}
+}
+
+internal void
+spinForSeconds(real32 seconds)
+{
+	uint64 start = getWallClock();
+	while (getSecondsElapsed(start, getWallClock()) < seconds)
+	{
+		_mm_pause();
+	}
+}
+
+void benchmarkFramePacing()
+{
+	// Same frames for both: a few ms of work, and every 30th frame
+	// overruns the frame time
+	const uint32 frameCount = 180;
+	const real32 secondsPerFrame = 1.0f / 60.0f;
+	const real32 workSeconds = 0.004f;
+	const real32 overrunSeconds = secondsPerFrame * 1.2f;
+
+	// What main did before: SDL_Delay for all but a ms, then spin
+	sdl_frame_pacer delayPacer;
+	startFramePacer(&delayPacer, secondsPerFrame);
+	uint64 frameStart = getWallClock();
+	for (uint32 frame = 0; frame < frameCount; frame++)
+	{
+		spinForSeconds((frame % 30 == 29) ? overrunSeconds : workSeconds);
+		real32 secondsElapsed = getSecondsElapsed(frameStart, getWallClock());
+		bool32 isMissed = (secondsElapsed >= secondsPerFrame);
+		if (!isMissed)
+		{
+			uint32 msToSleep = (uint32)((secondsPerFrame - secondsElapsed) * 1000.0f);
+			if (msToSleep > 1)
+			{
+				SDL_Delay(msToSleep - 1);
+			}
+			uint64 spinStart = getClockNs(CLOCK_MONOTONIC);
+			while (getSecondsElapsed(frameStart, getWallClock()) < secondsPerFrame)
+			{
+			}
+			delayPacer.spinTotalNs += getClockNs(CLOCK_MONOTONIC) - spinStart;
+		}
+		recordFrameWake(&delayPacer, getClockNs(CLOCK_MONOTONIC), isMissed);
+		frameStart = getWallClock();
+	}
+	printFramePacerStats(&delayPacer, "Pacing, delay and spin");
+
+	sdl_frame_pacer deadlinePacer;
+	startFramePacer(&deadlinePacer, secondsPerFrame);
+	for (uint32 frame = 0; frame < frameCount; frame++)
+	{
+		spinForSeconds((frame % 30 == 29) ? overrunSeconds : workSeconds);
+		waitForFrameDeadline(&deadlinePacer);
+	}
+	printFramePacerStats(&deadlinePacer, "Pacing, deadlines");
+}
+
+void sdlRunBenchmarks()
+{
+	gPerformanceCounterFrequency = SDL_GetPerformanceFrequency();
+	benchmarkGradient();
+	benchmarkTiledRender();
+	benchmarkFill();
+	benchmarkAssetLoad();
+	benchmarkAssetStreaming();
+	benchmarkAudioRing();
+	benchmarkOscillators();
+	benchmarkMixer();
+	benchmarkResampler();
+	benchmarkSoundStream();
+	benchmarkGameMemory();
+	benchmarkFramePacing();
+}
+
+internal void
+writeWaveHeader(FILE* file, uint32 samplesPerSecond, uint32 dataBytes)
+{
+	uint32 header[] = 
+	{
+		0x46464952, 36 + dataBytes, 0x45564157, // RIFF, WAVE
+		0x20746D66, 16, 0x00020001, samplesPerSecond, samplesPerSecond * 4, 0x00100004, // fmt, PCM stereo 16 bit
+		0x61746164, dataBytes // data
+	};
+	fwrite(header, sizeof(header), 1, file);
+}
+
+int sdlRenderAudioOffline(const char* fileName, real32 seconds)
+{
+	gPerformanceCounterFrequency = SDL_GetPerformanceFrequency();
+
+	FILE* file = fopen(fileName, "wb");
+	if (file == NULL)
+	{
+		printf("Could not open %s for writing\n", fileName);
+		return 1;
+	}
+
+	game_memory gameMemory;
+	gameMemory.permanentStorageSize = SizeMegaBytes(64);
+	gameMemory.transientStorageSize = SizeGigaBytes(1);
+	uint64 totalMemorySize = gameMemory.permanentStorageSize + gameMemory.transientStorageSize;
+	sdl_page_mode pageMode = PageMode_Normal;
+	gameMemory.permanentStoragePointer = sdlAllocateGameMemory(NULL, totalMemorySize, &pageMode, false);
+	if (gameMemory.permanentStoragePointer == NULL)
+	{
+		printf("Could not allocate memory for game.\n");
+		fclose(file);
+		return 1;
+	}
+	gameMemory.transientStoragePointer = (uint8*)(gameMemory.permanentStoragePointer) + gameMemory.permanentStorageSize;
+
+	// Same assets as the game, but loaded when asked
+	if (!sdlMapAssetArchive("assets.hha", &gameMemory))
+	{
+		printf("No asset archive, running without assets\n");
+	}
+	platform_asset_queue loadQueue = {};
+	loadQueue.archiveMemory = gameMemory.assetArchiveMemory;
+	loadQueue.archiveSize = gameMemory.assetArchiveSize;
+	gameMemory.assetQueue = &loadQueue;
+	gameMemory.queueAssetLoad = sdlLoadAssetNow;
+
+	sdl_game_code gameCode = sdl_loadGameCode(GAME_CODE_PATH);
+
+	// The game runs a frame, then makes one frame of sound, like it
+	// does with a sound card that is never late
+	uint32 gameUpdateHz = 30;
+	uint32 samplesPerSecond = 48000;
+	uint32 samplesPerFrame = samplesPerSecond / gameUpdateHz;
+	uint32 frameCount = (uint32)(seconds * (real32)gameUpdateHz);
+	int16* samples = (int16*)malloc(samplesPerFrame * 2 * sizeof(int16));
+
+	// Pixels are not looked at, a small buffer is enough
+	int32 pixelWidth = 64;
+	int32 pixelHeight = 64;
+	game_pixel_buffer pixelBuffer;
+	pixelBuffer.texturePixels = malloc(pixelWidth * pixelHeight * 4);
+	pixelBuffer.texturePitch = pixelWidth * 4;
+	pixelBuffer.bitmapWidth = pixelWidth;
+	pixelBuffer.bitmapHeight = pixelHeight;
+	pixelBuffer.bytesPerPixel = 4;
+
+	game_input_state input;
+	input.secondsElapsed = 1.0f / (real32)gameUpdateHz;
+	game_state* gameState = (game_state*)gameMemory.permanentStoragePointer;
+	gameState->toneHz = 256;
+	gameMemory.isInitialized = true;
+
+	game_sound_buffer soundBuffer;
+	soundBuffer.samples = samples;
+	soundBuffer.samplesToWrite = samplesPerFrame;
+	soundBuffer.samplesPerSecond = samplesPerSecond;
+	soundBuffer.samplesPerWavePeriod = samplesPerSecond / gameState->toneHz;
+	soundBuffer.tForSine = 0.0f;
+	soundBuffer.runningSampleIndex = 0;
+
+	writeWaveHeader(file, samplesPerSecond, 0);
+
+	// FNV-1a of everything written, equal hashes mean equal files
+	uint32 hash = 2166136261u;
+	uint32 frameBytes = samplesPerFrame * 2 * sizeof(int16);
+	real32 soundSeconds = 0.0f;
+	uint64 start = getWallClock();
+	for (uint32 frame = 0; frame < frameCount; frame++)
+	{
+		pixelBuffer.dirtyRectCount = 1;
+		pixelBuffer.dirtyRects[0] = {0, 0, pixelWidth, pixelHeight};
+		gameCode.updateAndRender(&gameMemory, &pixelBuffer, &input, gameState);
+
+		uint64 soundStart = getWallClock();
+		gameCode.getSoundSamples(&gameMemory, &soundBuffer);
+		soundSeconds += getSecondsElapsed(soundStart, getWallClock());
+
+		uint8* bytes = (uint8*)samples;
+		for (uint32 i = 0; i < frameBytes; i++)
+		{
+			hash = (hash ^ bytes[i]) * 16777619u;
+		}
+		fwrite(samples, frameBytes, 1, file);
+	}
+	real32 wallSeconds = getSecondsElapsed(start, getWallClock());
+
+	// Sizes are known only now
+	uint32 dataBytes = frameCount * frameBytes;
+	fseek(file, 0, SEEK_SET);
+	writeWaveHeader(file, samplesPerSecond, dataBytes);
+	bool32 isWritten = (ferror(file) == 0);
+	isWritten &= (fclose(file) == 0);
+
+	real32 renderedSeconds = (real32)frameCount / (real32)gameUpdateHz;
+	printf("Rendered %.2f s of audio to %s in %.3f s, %.1f times realtime (sound only %.1f), hash %08x%s\n",
+		renderedSeconds, fileName, wallSeconds,
+		(wallSeconds > 0.0f) ? renderedSeconds / wallSeconds : 0.0f,
+		(soundSeconds > 0.0f) ? renderedSeconds / soundSeconds : 0.0f,
+		hash, isWritten ? "" : " WRITE FAILED");
+
+	sdl_unloadGameCode(&gameCode);
+	sdlStopAssetQueue(&loadQueue);
+	sdlUnmapAssetArchive(&gameMemory);
+	free(pixelBuffer.texturePixels);
+	free(samples);
+	munmap(gameMemory.permanentStoragePointer, totalMemorySize);
+	return isWritten ? 0 : 1;
 }
 #endif
@@ -10,6 +10,187 @@ struct WindowBuffer
 	int32 bitmapWidth;
 	int32 bitmapHeight;
 	int32 bytesPerPixel;
+
+	// bitmapMemory still has what the game rendered last frame
+	bool32 contentsValid;
+
+	// Where the texture is drawn in the window. Game always renders at the
+	// same resolution and the renderer scales it to the window size.
+	SDL_Rect presentRect;
+
+	// Texture upload counters
+	uint32 bytesUploadedLastFrame;
+	uint32 fullFrameBytes;
+	uint64 bytesUploadedTotal;
+	uint64 bytesFullUploadTotal; // what it would have been without dirty rects
+	uint32 framesSkipped;
+};
+
+// Asset loads waiting for the I/O thread, declared in handmade.h
+static const uint32 MAX_ASSET_LOAD_REQUESTS = 256;
+
+struct platform_asset_queue
+{
+	// Protects the heap, held only to push or pop one request
+	SDL_mutex* mutex;
+	// Counts requests in the heap, I/O thread sleeps on this
+	SDL_sem* semaphore;
+
+	// Binary heap, the request to load next is at the top
+	asset_load_request* heap[MAX_ASSET_LOAD_REQUESTS];
+	uint32 count;
+	uint32 nextSequence;
+
+	void* archiveMemory;
+	uint64 archiveSize;
+
+	SDL_Thread* thread;
+	SDL_atomic_t quit;
+
+	// Only the I/O thread writes these
+	uint32 loadCount;
+	uint32 failCount;
+	uint64 bytesLoaded;
+	real32 secondsLoading;
+};
+
+// Pipelined mode: the game thread simulates and renders the next frame 
+// into one backbuffer while the main thread presents the previous one.
+static const int32 MAX_PIPELINE_DEPTH = 3;
+
+struct sdl_backbuffer
+{
+	void* memory;
+	int32 width;
+	int32 height;
+	game_pixel_buffer pixelBuffer;
+	real32 simulateSeconds;
+
+	// Audio state when this frame was made, for the overlay
+	real32 audioLatencySeconds;
+	real32 audioSafetySeconds;
+	uint32 audioUnderrunCount;
+};
+
+// What the main thread knew at the last present. The game thread gets it
+// with the input of its next frame and keeps its own copy, so that only
+// one thread touches the audio timing.
+struct sdl_flip_info
+{
+	uint64 wallClock;
+	int32 playCursor;
+	int32 writeCursor;
+};
+
+// Seconds spent in each stage of the frame
+struct sdl_stage_timings
+{
+	real32 input;
+	real32 simulate; // game update, render and sound
+	real32 upload;
+	real32 wait;
+	real32 present;
+};
+
+struct sdl_frame_pipeline
+{
+	// Number of backbuffers, 1 runs everything on the main thread
+	int32 depth;
+	sdl_backbuffer backbuffers[MAX_PIPELINE_DEPTH];
+	int32 nextToRender; // only game thread uses
+	int32 nextToPresent; // only main thread uses
+
+	// Main thread posts one tick per frame, game thread renders one 
+	// frame per tick. This keeps the game at most one frame ahead.
+	SDL_sem* frameTicks;
+	SDL_sem* freeBuffers;
+	SDL_sem* readyBuffers;
+
+	// Protects latestInput and latestFlip
+	SDL_mutex* mutex;
+	game_input_state latestInput;
+	sdl_flip_info latestFlip;
+
+	SDL_Thread* gameThread;
+	SDL_atomic_t quit;
+	game_memory* gameMemory;
+
+	sdl_stage_timings lastFrame;
+	sdl_stage_timings total;
+	uint32 frameCount;
+	// First frame that simulated, it pays for touching memory first
+	real32 firstSimulateSeconds;
+};
+
+// How game memory is backed, chosen with --pages=normal|transparent|huge.
+// A huge page is 2 MB, so the game memory needs 544 TLB entries
+// instead of 278528.
+enum sdl_page_mode
+{
+	PageMode_Normal,
+	PageMode_Transparent, // madvise(MADV_HUGEPAGE), kernel gives huge pages when it has them
+	PageMode_HugeTLB, // MAP_HUGETLB, needs pages reserved in /proc/sys/vm/nr_hugepages
+};
+
+// Frames end at absolute deadlines one period apart, so a late wake up
+// does not move the frames after it. The main thread sleeps until a bit
+// before the deadline and spins the rest. The spin is long enough for
+// PACER_SPIN_PERCENTILE of the recent sleeps, it is 50-100 us on a quiet
+// desktop and up to PACER_MAX_SPIN_NS on a busy one.
+static const uint32 PACER_LATENESS_BUCKETS = 40;
+static const uint64 PACER_LATENESS_BUCKET_NS = 50000;
+static const uint64 PACER_MAX_SPIN_NS = PACER_LATENESS_BUCKETS * PACER_LATENESS_BUCKET_NS;
+static const real32 PACER_SPIN_PERCENTILE = 0.99f;
+static const uint32 PACER_LATENESS_DECAY_COUNT = 256; // counts are halved at this many
+
+struct sdl_frame_pacer
+{
+	uint64 periodNs;
+	uint64 deadlineNs; // CLOCK_MONOTONIC, end of the current frame
+	uint64 spinNs;
+	// How late the sleeps have woken up, last bucket has the rest
+	uint32 latenessCounts[PACER_LATENESS_BUCKETS];
+	uint32 latenessTotal;
+
+	// Telemetry
+	uint64 startNs;
+	uint64 startCpuNs; // CPU time of the thread that waits
+	uint64 lastWakeNs;
+	uint64 spinTotalNs;
+	uint32 frameCount;
+	uint32 missedCount;
+	bool32 lastWasMissed;
+	// Time between wake ups minus the period, without missed frames
+	uint32 errorCount;
+	real64 errorSum;
+	real64 errorSquaredSum;
+	real64 maxError;
+};
+
+// How frames are shown, chosen with --present=vsync|timer. With vsync
+// the game runs at the monitor rate divided by refreshesPerFrame, and
+// each frame is presented that many times. The presents wait for the
+// vertical blank, so nothing tears and nothing spins.
+static const uint32 WANTED_GAME_UPDATE_HZ = 30;
+// Presents are watched this many frames at a time, if most come back
+// too soon the driver does not really wait and the timer takes over
+static const uint32 VSYNC_CHECK_FRAMES = 30;
+
+enum sdl_present_mode
+{
+	PresentMode_Timer, // sdl_frame_pacer waits, presents do not
+	PresentMode_Vsync,
+};
+
+struct sdl_presentation
+{
+	sdl_present_mode mode;
+	uint32 monitorRefreshHz;
+	uint32 refreshesPerFrame;
+	uint32 gameUpdateHz;
+
+	uint32 checkedFrameCount;
+	uint32 earlyFrameCount;
 };
 
 struct WindowDimensions
@@ -18,6 +199,9 @@ struct WindowDimensions
 	int32 height;
 };
 
+// Only the thread that runs the game touches these
+static const uint32 AUDIO_DEBUG_MARKERS = 15;
+
 struct sdl_audio_debug_marker
 {
 	int outputPlayCursor;
@@ -42,5 +226,97 @@ struct sdl_audio_debug_marker
 	}
 };
 
+// Audio latency calibration. The platform measures when the audio
+// callbacks arrive and how much the device played between two sound
+// writes, and keeps the safety margin just above the worst of those.
+// Histograms have buckets of AUDIO_JITTER_BUCKET_SECONDS, the last
+// bucket also counts everything longer.
+static const uint32 AUDIO_JITTER_BUCKETS = 64;
+static const real32 AUDIO_JITTER_BUCKET_SECONDS = 0.00025f;
+static const real32 AUDIO_SAFETY_PERCENTILE = 0.999f;
+static const uint32 AUDIO_CALLBACK_TIMES = 64;
+
+struct sdl_jitter_histogram
+{
+	uint32 counts[AUDIO_JITTER_BUCKETS];
+	uint32 total;
+};
+
+struct sdl_audio_calibration
+{
+	// Arrival times of the callbacks, counters work like the sound ring:
+	// the audio thread writes callbacksWritten, the game callbacksRead
+	uint64 callbackTimes[AUDIO_CALLBACK_TIMES];
+	uint64 callbacksWritten;
+	uint64 callbacksRead;
+
+	// Only the game writes the rest
+	real32 expectedCallbackSeconds;
+	uint64 lastCallbackTime; // 0 when the previous arrival is not known
+	sdl_jitter_histogram callbackJitter; // difference to the expected interval
+	sdl_jitter_histogram writeJitter; // played between writes minus one frame
+
+	uint64 lastWriteTime;
+	uint64 lastWritePlayedBytes;
+	uint64 lastUnderrunBytes;
+
+	// Telemetry, underruns only count while the game is writing
+	uint32 underrunCount;
+	uint64 underrunBytes;
+	real32 underrunSeconds; // added to the margin after an underrun, fades out
+	real32 safetySeconds;
+};
+
+// Converts the rate the game mixes at to the rate the device plays at.
+// Polyphase windowed sinc: the ratio is phaseCount / inputStep in lowest
+// terms, every output uses RESAMPLER_TAPS inputs and one of phaseCount
+// precomputed filters. Rates stay exact, there is no drift.
+static const uint32 RESAMPLER_TAPS = 64;
+static const uint32 MAX_RESAMPLER_PHASES = 1024;
+
+struct sdl_resampler
+{
+	uint32 inputRate;
+	uint32 outputRate;
+	uint32 phaseCount;	// 0 when there is nothing to convert
+	uint32 inputStep;	// phase advance per output
+	real32* filters;	// phaseCount * RESAMPLER_TAPS
+
+	// Position of the next output: its first tap is history[nextBase]
+	// and it uses filter number phase
+	uint32 nextBase;
+	uint32 phase;
+
+	// Inputs still needed, one array per channel
+	uint32 historyCount;
+	uint32 historyCapacity;
+	real32* history[2];
+
+	// Game writes its samples here
+	int16* input;
+	uint32 inputCapacity;
+};
+
+// Work queue for the worker threads, declared in handmade.h
+struct sdl_work_queue_entry
+{
+	platform_work_queue_callback *callback;
+	void *data;
+};
+
+struct platform_work_queue
+{
+	SDL_atomic_t completionGoal;
+	SDL_atomic_t completionCount;
+
+	// Only the adding thread writes this one
+	SDL_atomic_t nextEntryToWrite;
+	SDL_atomic_t nextEntryToRead;
+
+	// Counts entries waiting, worker threads sleep on this
+	SDL_sem *semaphore;
+
+	sdl_work_queue_entry entries[256];
+};
 
 #endif
\ No newline at end of file